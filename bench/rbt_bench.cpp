@@ -0,0 +1,587 @@
+/*********************************************************************
+* rbt_bench.cpp
+*
+* To compile and run (or: make bench, in ../src):
+*
+g++ -Wall -Wextra -pedantic-errors -O3 -I../src -o rbt_bench \
+rbt_bench.cpp ../src/librbt.a -lpthread && ./rbt_bench
+*
+* Microbenchmarks of the rbt_ functions, compared with std::map (key
+* and value) and std::set (of node pointers, as the rbt_ trees).
+*
+* Usage: rbt_bench [-n sizes] [-k int|str|fix|all] [-f csv|json]
+*
+*   -n : comma separated tree sizes, eg. 1e3,1e6,1e8 (default:
+*        1e3,1e4,1e5,1e6)
+*   -k : key type: int (8 bytes), str (40 bytes, as the samples), fix
+*        (the str keys as a fixed-length key, rbt only) or all
+*   -f : output format, one result per line (default: csv)
+*
+* Results: impl, key, size, op, count (of ops), ns per op.
+* Keys are 0,2,4,.. in random order (misses are the odd values), and
+* a range query finds the 50 keys with the same key/100.
+*
+**********************************************************************
+* Copyright (c) 2020 Michael Walsh Pedersen
+*********************************************************************/
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+#include "rbt.h"
+
+/*********************************************************************
+* nodes and keys:
+*********************************************************************/
+
+struct IntNode {
+    void *left;
+    void *right;
+    char  color;
+    long long key;
+    long long data;
+};
+
+struct StrNode {
+    void *left;
+    void *right;
+    char  color;
+    char  key[40];
+    char  data[40];
+};
+
+struct Str40 {            // std::map key for StrNode
+    char s[40];
+    bool operator<( const Str40 & o ) const
+        { return strcmp( s, o.s ) < 0; }
+};
+
+#define RANGE_DIGITS 37   // str keys with the same 37 first digits
+#define RANGE_DIV    100  // int keys with the same key/100
+
+static void make_key( long long v, long long * key )
+{
+    *key = v;
+}
+
+static void make_key( long long v, char * key )
+{
+    snprintf( key, 40, "%039lld", v );
+}
+
+static void make_key( long long v, char (*key)[40] )
+{
+    make_key( v, *key );
+}
+
+static void make_key( long long v, Str40 * key )
+{
+    make_key( v, key->s );
+}
+
+static int int_nodeCmp( void * a, void * b )
+{
+    long long x = ((IntNode*)a)->key, y = ((IntNode*)b)->key;
+    return x < y ? -1 : x > y;
+}
+
+static int int_keyCmp( void * a, void * k )
+{
+    long long x = ((IntNode*)a)->key, y = *(long long*)k;
+    return x < y ? -1 : x > y;
+}
+
+static int int_rangeCmp( void * a, void * k )
+{
+    long long x = ((IntNode*)a)->key / RANGE_DIV, y = *(long long*)k;
+    return x < y ? -1 : x > y;
+}
+
+static int str_nodeCmp( void * a, void * b )
+{
+    return strcmp( ((StrNode*)a)->key, ((StrNode*)b)->key );
+}
+
+static int str_keyCmp( void * a, void * k )
+{
+    return strcmp( ((StrNode*)a)->key, (char*)k );
+}
+
+static int str_rangeCmp( void * a, void * k )
+{
+    return strncmp( ((StrNode*)a)->key, (char*)k, RANGE_DIGITS );
+}
+
+static void freeNode( void * n )
+{
+    free( n );
+}
+
+static RBTDEF int_DEF = {
+    offsetof( IntNode, left ), offsetof( IntNode, right ),
+    offsetof( IntNode, color ), int_nodeCmp, int_keyCmp,
+    NULL, NULL, freeNode, sizeof(IntNode), 0, NULL, NULL, 0, 0 };
+
+static RBTDEF str_DEF = {
+    offsetof( StrNode, left ), offsetof( StrNode, right ),
+    offsetof( StrNode, color ), str_nodeCmp, str_keyCmp,
+    NULL, NULL, freeNode, sizeof(StrNode), 0, NULL, NULL, 0, 0 };
+
+static RBTDEF fix_DEF = {
+    offsetof( StrNode, left ), offsetof( StrNode, right ),
+    offsetof( StrNode, color ), str_nodeCmp, str_keyCmp,
+    NULL, NULL, freeNode, sizeof(StrNode), 0, NULL, NULL,
+    offsetof( StrNode, key ), sizeof(((StrNode*)0)->key) };
+
+/* key types: */
+
+struct IntKeys {
+    typedef IntNode   Node;
+    typedef long long MapKey;
+    typedef long long Key;
+    static const char * name() { return "int"; }
+    static RBTDEF * def() { return &int_DEF; }
+    static int (*rangeCmp())(void*,void*) { return int_rangeCmp; }
+    static void range_key( long long v, Key * k ) { *k = v / RANGE_DIV; }
+    static void range_lo( long long v, MapKey * k )
+        { *k = v / RANGE_DIV * RANGE_DIV; }
+    static void range_hi( long long v, MapKey * k )
+        { *k = v / RANGE_DIV * RANGE_DIV + RANGE_DIV; }
+    static void * key_ptr( Key * k ) { return k; }
+    static const bool std_too = true;   // also std::map and std::set
+};
+
+struct StrKeys {
+    typedef StrNode   Node;
+    typedef Str40     MapKey;
+    typedef Str40     Key;
+    static const char * name() { return "str"; }
+    static RBTDEF * def() { return &str_DEF; }
+    static int (*rangeCmp())(void*,void*) { return str_rangeCmp; }
+    static void range_key( long long v, Key * k ) { make_key( v, k ); }
+    static void range_lo( long long v, MapKey * k )
+        { make_key( v / RANGE_DIV * RANGE_DIV, k ); }
+    static void range_hi( long long v, MapKey * k )
+        { make_key( v / RANGE_DIV * RANGE_DIV + RANGE_DIV, k ); }
+    static void * key_ptr( Key * k ) { return k->s; }
+    static const bool std_too = true;
+};
+
+struct FixKeys : StrKeys {
+    static const char * name() { return "fix"; }
+    static RBTDEF * def() { return &fix_DEF; }
+    static const bool std_too = false;
+};
+
+template<class N> struct NodeLess {
+    bool operator()( const N * a, const N * b ) const;
+};
+template<> bool NodeLess<IntNode>::operator()(
+    const IntNode * a, const IntNode * b ) const
+    { return a->key < b->key; }
+template<> bool NodeLess<StrNode>::operator()(
+    const StrNode * a, const StrNode * b ) const
+    { return strcmp( a->key, b->key ) < 0; }
+
+/*********************************************************************
+* results:
+*********************************************************************/
+
+static bool        json = false;
+static bool        first_result = true;
+static long long   sink = 0;    // keeps results alive
+
+typedef std::chrono::steady_clock Clock;
+
+static void result( const char * impl, const char * key, size_t size,
+    const char * op, size_t count, Clock::time_point t0 )
+{
+    double ns = std::chrono::duration<double, std::nano>(
+        Clock::now() - t0 ).count();
+    double per = count ? ns / count : 0;
+
+    if( json )
+    {
+        printf( "%s\n  {\"impl\":\"%s\",\"key\":\"%s\",\"size\":%zu,"
+            "\"op\":\"%s\",\"count\":%zu,\"ns_per_op\":%.2f}",
+            first_result ? "[" : ",", impl, key, size, op, count, per );
+    }
+    else
+    {
+        if( first_result )
+            printf( "impl,key,size,op,count,ns_per_op\n" );
+        printf( "%s,%s,%zu,%s,%zu,%.2f\n", impl, key, size, op, count, per );
+    }
+    first_result = false;
+    fflush( stdout );
+}
+
+/*********************************************************************
+* benchmarks:
+*********************************************************************/
+
+template<class K> static typename K::Node * new_node( long long v )
+{
+    typename K::Node * n =
+        (typename K::Node*)malloc( sizeof(typename K::Node) );
+    make_key( v, &n->key );
+    make_key( v, &n->data );
+    return n;
+}
+
+template<class K> static void bench_rbt( size_t n,
+    const std::vector<long long> & vals,
+    const std::vector<long long> & vals2 )
+{
+    const char * kn = K::name();
+    RBT          tree;
+    typename K::Key key;
+    typename K::Key key2;
+    Clock::time_point t0;
+    size_t       i, c;
+    void       * node;
+    void       * last;
+
+    rbt_init( &tree, K::def() );
+
+    /* insert: sorted, reverse, random */
+    t0 = Clock::now();
+    for( i = 0 ; i < n ; i++ )
+        rbt_insert( &tree, new_node<K>( 2 * (long long)i ) );
+    result( "rbt", kn, n, "insert_sorted", n, t0 );
+    rbt_clr( &tree );
+
+    t0 = Clock::now();
+    for( i = n ; i > 0 ; i-- )
+        rbt_insert( &tree, new_node<K>( 2 * (long long)( i - 1 ) ) );
+    result( "rbt", kn, n, "insert_reverse", n, t0 );
+    rbt_clr( &tree );
+
+    t0 = Clock::now();
+    for( i = 0 ; i < n ; i++ )
+        rbt_insert( &tree, new_node<K>( vals[i] ) );
+    result( "rbt", kn, n, "insert_random", n, t0 );
+
+    /* lookups */
+    t0 = Clock::now();
+    for( i = 0 ; i < n ; i++ )
+    {
+        make_key( vals2[i], &key );
+        sink += rbt_get( &tree, K::key_ptr( &key ) ) != NULL;
+    }
+    result( "rbt", kn, n, "get_hit", n, t0 );
+
+    t0 = Clock::now();
+    for( i = 0 ; i < n ; i++ )
+    {
+        make_key( vals2[i] + 1, &key );
+        sink += rbt_get( &tree, K::key_ptr( &key ) ) != NULL;
+    }
+    result( "rbt", kn, n, "get_miss", n, t0 );
+
+    /* scans */
+    t0 = Clock::now();
+    for( node = rbt_first( &tree ) ; node ; node = rbt_next( &tree, node ) )
+        sink++;
+    result( "rbt", kn, n, "scan_next", n, t0 );
+
+    t0 = Clock::now();
+    for( node = rbt_last( &tree ) ; node ; node = rbt_prev( &tree, node ) )
+        sink++;
+    result( "rbt", kn, n, "scan_prev", n, t0 );
+
+    /* range queries (rbt_feq, rbt_leq, and rbt_next between) */
+    c = n / 50 + 1;
+    t0 = Clock::now();
+    for( i = 0 ; i < c ; i++ )
+    {
+        K::range_key( vals2[i], &key2 );
+        node = rbt_feq( &tree, K::rangeCmp(), K::key_ptr( &key2 ) );
+        last = rbt_leq( &tree, K::rangeCmp(), K::key_ptr( &key2 ) );
+        for( ; node ; node = rbt_next( &tree, node ) )
+        {
+            sink++;
+            if( node == last )
+                break;
+        }
+    }
+    result( "rbt", kn, n, "range", c, t0 );
+
+    /* delete */
+    t0 = Clock::now();
+    for( i = 0 ; i < n ; i++ )
+    {
+        make_key( vals2[i], &key );
+        sink += rbt_delkey( &tree, K::key_ptr( &key ) );
+    }
+    result( "rbt", kn, n, "delkey", n, t0 );
+    rbt_clr( &tree );
+}
+
+template<class K> static void bench_map( size_t n,
+    const std::vector<long long> & vals,
+    const std::vector<long long> & vals2 )
+{
+    typedef typename K::MapKey MapKey;
+    typedef std::map<MapKey, MapKey> Map;
+    const char * kn = K::name();
+    Clock::time_point t0;
+    size_t       i, c;
+    MapKey       key, hi;
+
+    {
+        Map m;
+        t0 = Clock::now();
+        for( i = 0 ; i < n ; i++ )
+        {
+            make_key( 2 * (long long)i, &key );
+            m[key] = key;
+        }
+        result( "std::map", kn, n, "insert_sorted", n, t0 );
+    }
+    {
+        Map m;
+        t0 = Clock::now();
+        for( i = n ; i > 0 ; i-- )
+        {
+            make_key( 2 * (long long)( i - 1 ), &key );
+            m[key] = key;
+        }
+        result( "std::map", kn, n, "insert_reverse", n, t0 );
+    }
+    Map m;
+    t0 = Clock::now();
+    for( i = 0 ; i < n ; i++ )
+    {
+        make_key( vals[i], &key );
+        m[key] = key;
+    }
+    result( "std::map", kn, n, "insert_random", n, t0 );
+
+    t0 = Clock::now();
+    for( i = 0 ; i < n ; i++ )
+    {
+        make_key( vals2[i], &key );
+        sink += m.find( key ) != m.end();
+    }
+    result( "std::map", kn, n, "get_hit", n, t0 );
+
+    t0 = Clock::now();
+    for( i = 0 ; i < n ; i++ )
+    {
+        make_key( vals2[i] + 1, &key );
+        sink += m.find( key ) != m.end();
+    }
+    result( "std::map", kn, n, "get_miss", n, t0 );
+
+    t0 = Clock::now();
+    for( typename Map::iterator it = m.begin() ; it != m.end() ; ++it )
+        sink++;
+    result( "std::map", kn, n, "scan_next", n, t0 );
+
+    t0 = Clock::now();
+    for( typename Map::reverse_iterator it = m.rbegin() ; it != m.rend() ;
+        ++it )
+        sink++;
+    result( "std::map", kn, n, "scan_prev", n, t0 );
+
+    c = n / 50 + 1;
+    t0 = Clock::now();
+    for( i = 0 ; i < c ; i++ )
+    {
+        K::range_lo( vals2[i], &key );
+        K::range_hi( vals2[i], &hi );
+        typename Map::iterator end = m.lower_bound( hi );
+        for( typename Map::iterator it = m.lower_bound( key ) ; it != end ;
+            ++it )
+            sink++;
+    }
+    result( "std::map", kn, n, "range", c, t0 );
+
+    t0 = Clock::now();
+    for( i = 0 ; i < n ; i++ )
+    {
+        make_key( vals2[i], &key );
+        sink += m.erase( key );
+    }
+    result( "std::map", kn, n, "delkey", n, t0 );
+}
+
+template<class K> static void bench_set( size_t n,
+    const std::vector<long long> & vals,
+    const std::vector<long long> & vals2 )
+{
+    typedef typename K::Node Node;
+    typedef std::set<Node*, NodeLess<Node> > Set;
+    const char * kn = K::name();
+    Clock::time_point t0;
+    size_t       i, c;
+    Node         probe, hi;
+    typename Set::iterator it;
+
+    {
+        Set s;
+        t0 = Clock::now();
+        for( i = 0 ; i < n ; i++ )
+            s.insert( new_node<K>( 2 * (long long)i ) );
+        result( "std::set", kn, n, "insert_sorted", n, t0 );
+        for( it = s.begin() ; it != s.end() ; ++it )
+            free( *it );
+    }
+    {
+        Set s;
+        t0 = Clock::now();
+        for( i = n ; i > 0 ; i-- )
+            s.insert( new_node<K>( 2 * (long long)( i - 1 ) ) );
+        result( "std::set", kn, n, "insert_reverse", n, t0 );
+        for( it = s.begin() ; it != s.end() ; ++it )
+            free( *it );
+    }
+    Set s;
+    t0 = Clock::now();
+    for( i = 0 ; i < n ; i++ )
+        s.insert( new_node<K>( vals[i] ) );
+    result( "std::set", kn, n, "insert_random", n, t0 );
+
+    t0 = Clock::now();
+    for( i = 0 ; i < n ; i++ )
+    {
+        make_key( vals2[i], &probe.key );
+        sink += s.find( &probe ) != s.end();
+    }
+    result( "std::set", kn, n, "get_hit", n, t0 );
+
+    t0 = Clock::now();
+    for( i = 0 ; i < n ; i++ )
+    {
+        make_key( vals2[i] + 1, &probe.key );
+        sink += s.find( &probe ) != s.end();
+    }
+    result( "std::set", kn, n, "get_miss", n, t0 );
+
+    t0 = Clock::now();
+    for( it = s.begin() ; it != s.end() ; ++it )
+        sink++;
+    result( "std::set", kn, n, "scan_next", n, t0 );
+
+    t0 = Clock::now();
+    for( typename Set::reverse_iterator r = s.rbegin() ; r != s.rend() ;
+        ++r )
+        sink++;
+    result( "std::set", kn, n, "scan_prev", n, t0 );
+
+    c = n / 50 + 1;
+    t0 = Clock::now();
+    for( i = 0 ; i < c ; i++ )
+    {
+        typename K::MapKey lo, up;
+        K::range_lo( vals2[i], &lo );
+        K::range_hi( vals2[i], &up );
+        memcpy( &probe.key, &lo, sizeof(probe.key) );
+        memcpy( &hi.key, &up, sizeof(hi.key) );
+        typename Set::iterator end = s.lower_bound( &hi );
+        for( it = s.lower_bound( &probe ) ; it != end ; ++it )
+            sink++;
+    }
+    result( "std::set", kn, n, "range", c, t0 );
+
+    t0 = Clock::now();
+    for( i = 0 ; i < n ; i++ )
+    {
+        make_key( vals2[i], &probe.key );
+        it = s.find( &probe );
+        if( it != s.end() )
+        {
+            free( *it );
+            s.erase( it );
+            sink++;
+        }
+    }
+    result( "std::set", kn, n, "delkey", n, t0 );
+}
+
+template<class K> static void bench_all( size_t n )
+{
+    std::vector<long long> vals( n ), vals2( n );
+    std::mt19937_64 rnd( n );
+    size_t i;
+
+    for( i = 0 ; i < n ; i++ )
+        vals[i] = 2 * (long long)i;
+    vals2 = vals;
+    std::shuffle( vals.begin(), vals.end(), rnd );
+    std::shuffle( vals2.begin(), vals2.end(), rnd );
+
+    bench_rbt<K>( n, vals, vals2 );
+    if( K::std_too )
+    {
+        bench_map<K>( n, vals, vals2 );
+        bench_set<K>( n, vals, vals2 );
+    }
+}
+
+/*********************************************************************
+* main:
+*********************************************************************/
+
+int main( int argc, char * argv[] )
+{
+    std::vector<size_t> sizes;
+    std::string keys = "all";
+    std::string list = "1e3,1e4,1e5,1e6";
+    int i;
+
+    for( i = 1 ; i + 1 < argc ; i += 2 )
+    {
+        if( strcmp( argv[i], "-n" ) == 0 )
+            list = argv[i+1];
+        else if( strcmp( argv[i], "-k" ) == 0 )
+            keys = argv[i+1];
+        else if( strcmp( argv[i], "-f" ) == 0 )
+            json = strcmp( argv[i+1], "json" ) == 0;
+        else
+            break;
+    }
+    if( i < argc || ( keys != "int" && keys != "str" && keys != "fix"
+        && keys != "all" ) )
+    {
+        fprintf( stderr, "usage: %s [-n sizes] [-k int|str|fix|all] "
+            "[-f csv|json]\n", argv[0] );
+        return 1;
+    }
+    for( const char * p = list.c_str() ; *p ; )
+    {
+        char * end;
+        double v = strtod( p, &end );
+        if( end == p || v < 1 )
+        {
+            fprintf( stderr, "bad size list: %s\n", list.c_str() );
+            return 1;
+        }
+        sizes.push_back( (size_t)v );
+        p = *end == ',' ? end + 1 : end;
+    }
+
+    for( size_t s = 0 ; s < sizes.size() ; s++ )
+    {
+        if( keys == "int" || keys == "all" )
+            bench_all<IntKeys>( sizes[s] );
+        if( keys == "str" || keys == "all" )
+            bench_all<StrKeys>( sizes[s] );
+        if( keys == "fix" || keys == "all" )
+            bench_all<FixKeys>( sizes[s] );
+    }
+    if( json && !first_result )
+        printf( "\n]\n" );
+    return sink == -1;
+}
+
+/***[end-of-file]****************************************************/
+/********************************************************************/
@@ -8,7 +8,8 @@ sampRBTcpp01.cpp ../src/librbt.a && ./sampRBTcpp01
 *
 * Sample C++ program for rbt_ functions.
 *
-* Shows the use of multiples red-black trees.
+* Shows the use of multiples red-black trees, the 2nd as a multiset
+* (non-unique key).
 *
 * All identifiers starting with 'my', 'My' or 'MY' are
 * used to identify the sample-specific code.
@@ -18,8 +19,9 @@ sampRBTcpp01.cpp ../src/librbt.a && ./sampRBTcpp01
 *********************************************************************/
 
 #include <iostream>
+#include <iterator>
 #include <cstring>
-#include "rbt.h"
+#include "rbt.hpp"
 
 /*********************************************************************
 * define 'struct myNode' node and 'class myTree' :
@@ -66,6 +68,7 @@ public:
 
     struct myNode * feq2nd  ( const char * key2 );
     struct myNode * leq2nd  ( const char * key2 );
+    rbt::tree<myNode> view2nd() { return rbt::tree<myNode>( &tree[1] ); }
 };
 
 /*********************************************************************
@@ -93,11 +96,7 @@ static int myNode_compareNode( struct myNode * r1, struct myNode * r2 )
 
 static int myNode_compareNode2nd( struct myNode * r1, struct myNode * r2 )
 {
-    int rc;
-    rc = strcmp( r1->key2, r2->key2 );
-    if( rc )
-        return rc;
-    return myNode_compareNode( r1, r2 );
+    return strcmp( r1->key2, r2->key2 ); // equal nodes kept (RBT_MULTISET)
 }
 
 static int myNode_compareKey( struct myNode * r1, char * key )
@@ -141,7 +140,13 @@ static RBTDEF myNode_DEF[] = // (RBTDEF[])
     /* .keyCmp    = */ (int (*)(void *, void *)) myNode_compareKey,  /* compare function for key */
     /* .allocRoot = */ (void *(*)(size_t))       NULL,         /* malloc function for root data */
     /* .freeRoot  = */ (void (*)(void *))        NULL,           /* free function for root data */
-    /* .freeNode  = */ (void (*)(void *))        myNode_freeNode /* free function for node */
+    /* .freeNode  = */ (void (*)(void *))        myNode_freeNode, /* free function for node */
+    /* .node_size = */ sizeof( struct myNode ),                  /* sizeof node */
+    /* .flags     = */ 0,
+    /* .keyHash   = */ NULL,                                     /* (optional) hash index */
+    /* .nodeHash  = */ NULL,
+    /* .key_ofs   = */ 0,                                        /* (optional) fixed-length key */
+    /* .key_len   = */ 0
   },
   {
     /* .left_ofs  = */ offsetof( struct myNode, left [1] ),          /* offsetof to left child */
@@ -151,7 +156,13 @@ static RBTDEF myNode_DEF[] = // (RBTDEF[])
     /* .keyCmp    = */ (int (*)(void *, void *)) NULL,  /* compare function for key */
     /* .allocRoot = */ (void *(*)(size_t))       NULL,         /* malloc function for root data */
     /* .freeRoot  = */ (void (*)(void *))        NULL,           /* free function for root data */
-    /* .freeNode  = */ (void (*)(void *))        myNode_freeNode /* free function for node */
+    /* .freeNode  = */ (void (*)(void *))        myNode_freeNode, /* free function for node */
+    /* .node_size = */ sizeof( struct myNode ),                  /* sizeof node */
+    /* .flags     = */ RBT_MULTISET,                /* non-unique key2 */
+    /* .keyHash   = */ NULL,                                     /* (no hash index for multiset) */
+    /* .nodeHash  = */ NULL,
+    /* .key_ofs   = */ 0,
+    /* .key_len   = */ 0
   }
 };
 
@@ -388,6 +399,23 @@ void testRun()
             break;
     }
 
+    // same range by the C++ iterators (rbt.hpp)
+    std::cout << std::endl << "--- range 'BB' to 'CC' by iterators ---"
+        << std::endl;
+    rbt::tree<myNode> t2 = t->view2nd();
+    const char * key2_bb = "BB", * key2_cc = "CC";
+    for( myNode & n : rbt::range<myNode>(
+            t2.lower_bound( (int (*)(void*,void*))myNode_compareKey2, key2_bb ),
+            t2.upper_bound( (int (*)(void*,void*))myNode_compareKey2, key2_cc ) ) )
+    {
+        std::cout << "2> ( " << n.key2 << ":" << n.key <<  " , "
+            << n.data << " );"  << std::endl;
+    }
+    rbt::range<myNode> aa = t2.range(
+        (int (*)(void*,void*))myNode_compareKey2, "AA" );
+    std::cout << "'AA' nodes: " << std::distance( aa.begin(), aa.end() )
+        << std::endl;
+
     // delete first node in 2nd tree
     if( t->delnode_keep( t->first2nd(), &r ) == 0 )
     {
@@ -52,19 +52,152 @@ typedef struct
     void     *(*allocRoot)(size_t);  /* malloc function for root data */
     void     (*freeRoot)(void*);     /* free function for root data */
     void     (*freeNode)(void*);     /* free function for node */
+    size_t     node_size;            /* sizeof node (0: unknown) */
+    int        flags;                /* RBT_MULTISET (0: none) */
+    unsigned long long (*keyHash)(
+                void*key);           /* hash of key (NULL: no hash index) */
+    unsigned long long (*nodeHash)(
+                void*node);          /* hash of the key of node */
+    size_t     key_ofs;              /* offsetof to fixed-length key */
+    size_t     key_len;              /* its bytes (0: by nodeCmp/keyCmp) */
 }
 RBTDEF;
 
-/* tree root struct: */
+/* RBTDEF flags: */
+
+#define RBT_MULTISET      1          /* keep nodes with equal keys */
+
+/* bits of the color attribute that a walk along the threads tests, eg.
+   rbt.hpp (the other bits are internal, see rbt_internal.h): */
+
+#define RBT_LEFT_DATA     2          /* left is a child, else a thread */
+#define RBT_RIGHT_DATA    4          /* right is a child, else a thread */
+#define RBT_TOMB          8          /* lazy deleted (rbt_lazy_delete) */
+
+/* operation statistics (counted when build with -DRBT_STATS): */
+
+typedef struct
+{
+    unsigned long long node_cmp;     /* nodeCmp calls */
+    unsigned long long key_cmp;      /* keyCmp calls */
+    unsigned long long visits;       /* nodes visited */
+    unsigned long long rotations;    /* rotations */
+    unsigned long long recolors;     /* recolorings */
+    unsigned long long duplicates;   /* replaced duplicates (insert) */
+    unsigned long long del_notfound; /* deletes not found */
+}
+RBTSTATS;
+
+/* tree shape and memory profile (see rbt_profile): */
+
+#define RBT_PROFILE_DEPTHS 128       /* > max height of any tree */
+
+typedef struct
+{
+    size_t     nodes;
+    size_t     depth_hist[RBT_PROFILE_DEPTHS]; /* nodes per depth */
+                                     /* ([0]: too deep) */
+    int        max_depth;            /* depth: nodes visited by a search */
+    double     avg_depth;
+    int        black_height;         /* black nodes on a root-leaf path */
+    double     red_ratio;            /* red nodes / nodes */
+    size_t     addr_spread;          /* highest - lowest node address */
+    double     avg_link_dist;        /* avg |child - parent| address */
+    double     page_locality;        /* parent and child in same 4K page */
+    size_t     node_bytes;           /* nodes * node_size (0: unknown) */
+    size_t     link_bytes;           /* nodes * (2 pointers + color) */
+}
+RBTPROFILE;
+
+/* latency histograms (recorded when build with -DRBT_LATENCY): */
+
+#define RBT_LAT_INSERT   0           /* rbt_insert, rbt_insert_keep */
+#define RBT_LAT_GET      1           /* rbt_get, rbt_get_finger */
+#define RBT_LAT_DELETE   2           /* rbt_delkey, _delnode, _erase */
+#define RBT_LAT_ITER     3           /* rbt_first, _next, _last, _prev */
+#define RBT_LAT_RANGE    4           /* rbt_feq, _leq, _fge, _fgt */
+#define RBT_LAT_OPS      5
+#define RBT_LAT_BUCKETS  976         /* 16 per power of 2 up to 2^64 */
 
 typedef struct
+{
+    double     ns_per_tick;          /* cycle counter ticks to ns */
+    unsigned long long count[RBT_LAT_OPS][RBT_LAT_BUCKETS]; /* in ticks */
+}
+RBTLATENCY;
+
+/* tree root struct: */
+
+typedef struct RBTJOURNAL RBTJOURNAL; /* (see rbt_journal.c) */
+typedef struct RBTHASH    RBTHASH;    /* (see rbt_hash.c) */
+typedef struct RBTCAPACITY RBTCAPACITY; /* (see below) */
+typedef struct RBTCONC    RBTCONC;    /* (see rbt_concurrent.c) */
+typedef struct RBTREPL    RBTREPL;    /* (see rbt_replica.c) */
+typedef struct RBTREPLICA RBTREPLICA; /* (see rbt_replica.c) */
+typedef struct RBTRELAX   RBTRELAX;   /* (see rbt_rebalance.c) */
+
+typedef struct RBT
 {
     void         * root;             /* root pointer */
     size_t         size;             /* total number of nodes */
+    int            size_unknown;     /* size not counted yet (rbt_split) */
     RBTDEF       * def;              /* */
+    RBTJOURNAL   * journal;          /* write-ahead journal or NULL */
+    RBTHASH      * hash;             /* hash index or NULL */
+    unsigned long long del_gen;      /* +1 when nodes leave the tree */
+    int            lazy;             /* lazy delete (see rbt_lazy_delete) */
+    size_t         tombs;            /* deleted, not yet purged nodes */
+    size_t         max_tombs;        /* purge at once above (0: no limit) */
+    void         * purge_pos;        /* rbt_purge continues here */
+    unsigned long long purge_gen;    /*   (if del_gen is the same) */
+    struct RBT   * delta;            /* write buffer (see rbt_buffer) */
+    size_t         delta_max;        /* merge the buffer at this size */
+    void         * first;            /* cached first and last node, */
+    void         * last;             /*   see rbt_first.c */
+    unsigned long long minmax_gen;   /*   (valid if del_gen is the same) */
+    RBTCAPACITY  * cap;              /* size limits (see rbt_capacity) */
+    size_t         bytes;            /* node bytes (counted with cap) */
+    RBTCONC      * conc;             /* concurrent mode or NULL */
+    RBTREPL      * repl;             /* images for replicas or NULL */
+    RBTRELAX     * relax;            /* relaxed balance mode or NULL */
+    RBTSTATS       stats;            /* (see rbt_stats) */
 }
 RBT;
 
+/* size limits for rbt_capacity: */
+
+struct RBTCAPACITY
+{
+    size_t     max_nodes;            /* max nodes (0: no limit) */
+    size_t     max_bytes;            /* max node bytes (0: no limit) */
+    size_t   (*nodeBytes)(
+                void*node);          /* bytes of node (NULL: node_size) */
+    int        evict;                /* RBT_EVICT_xxx */
+    void     *(*victim)(
+                RBT*rbt,
+                void*ctx);           /* RBT_EVICT_VICTIM: node to evict */
+    void     (*evicted)(
+                void*node,
+                void*ctx);           /* evicted node (NULL: freeNode) */
+    void     * ctx;
+};
+
+/* RBTCAPACITY evict: */
+
+#define RBT_EVICT_FIRST   0          /* evict the first node */
+#define RBT_EVICT_LAST    1          /* evict the last node */
+#define RBT_EVICT_VICTIM  2          /* evict the node from victim() */
+
+/* finger for rbt_get_finger (zero it before the first use): */
+
+typedef struct
+{
+    RBT          * rbt;
+    void         * node;             /* last node found (or visited) */
+    unsigned long long del_gen;      /* rbt->del_gen of node */
+}
+RBTFINGER;
+
 /*********************************************************************
 * prototypes:
 *********************************************************************/
@@ -89,17 +222,160 @@ int rbt_insert     ( RBT * rbt, void * node );
 int rbt_insert_keep( RBT * rbt, void * node, void ** old_node );
 /* return: RBT_RC_OK(0), RBT_RC_ERROR(-1) */
 
+void * rbt_insert_absent( RBT * rbt, void * node );
+void * rbt_upsert( RBT * rbt, void * key,
+                   void * (*create)(void*key,void*ctx),
+                   void (*update)(void*node,void*ctx),
+                   void * ctx );
+/* return: node in the tree (inserted or equal), NULL on errors */
+
 /*** Deletion ***/
 
 int rbt_delkey      ( RBT * rbt, void * key );
 int rbt_delkey_keep ( RBT * rbt, void * key, void ** old_node );
 int rbt_delnode     ( RBT * rbt, void * node );
 int rbt_delnode_keep( RBT * rbt, void * node, void ** old_node );
+int rbt_erase       ( RBT * rbt, void * node, void ** next );
+int rbt_erase_keep  ( RBT * rbt, void * node, void ** next );
+int rbt_del_range   ( RBT * rbt,
+                       int (*lo_cmp)(void*,void*), void * lo,
+                       int (*hi_cmp)(void*,void*), void * hi,
+                       void ** keep_list );
 /* return: RBT_RC_OK(0), RBT_RC_NOTFOUND(1), RBT_RC_ERROR(-1) */
 
+void * rbt_pop_first( RBT * rbt );
+void * rbt_pop_last ( RBT * rbt );
+/* return: deleted (not freed) node or NULL (tree is empty) */
+size_t rbt_pop_until( RBT * rbt, int (*cmp)(void*,void*), void * key,
+                      void ** out, size_t max );
+/* return: count of deleted (not freed) nodes in out */
+
+int    rbt_lazy_delete( RBT * rbt, int on, size_t max_tombs );
+size_t rbt_purge      ( RBT * rbt, size_t max );
+/* return: lazy_delete: RBT_RC_OK(0), RBT_RC_ERROR(-1)
+           purge: count of removed tombstones */
+
+/*** Relaxed balance (deferred rebalancing) ***/
+
+int    rbt_relaxed       ( RBT * rbt, int on, size_t max_viol );
+/* return: RBT_RC_OK(0), RBT_RC_ERROR(-1) */
+size_t rbt_rebalance_step( RBT * rbt, size_t budget );
+/* return: count of violations and tombstones left (0: balanced) */
+
+/*** Write buffer ***/
+
+int rbt_buffer      ( RBT * rbt, size_t max );
+int rbt_buffer_merge( RBT * rbt );
+/* return: RBT_RC_OK(0), RBT_RC_ERROR(-1) */
+
+/*** Capacity (size limits, eviction) ***/
+
+int    rbt_capacity( RBT * rbt, RBTCAPACITY * cap );
+/* return: RBT_RC_OK(0), RBT_RC_ERROR(-1) */
+size_t rbt_memory  ( RBT * rbt );
+/* return: bytes used by the tree, its nodes, index, buffer etc. */
+
+/*** Concurrent mode (writers in parallel) ***/
+
+int  rbt_concurrent      ( RBT * rbt, int on );
+/* return: RBT_RC_OK(0), RBT_RC_ERROR(-1) */
+void rbt_quiescent       ( RBT * rbt );
+void rbt_concurrent_leave( RBT * rbt );
+
+/*** Replicas (read-only copies for reader threads) ***/
+
+int          rbt_publish        ( RBT * rbt );
+RBTREPLICA * rbt_replica_new    ( RBT * primary );
+int          rbt_replica_refresh( RBTREPLICA * rep );
+RBT        * rbt_replica_tree   ( RBTREPLICA * rep );
+void         rbt_replica_release( RBTREPLICA * rep, RBT * tree );
+void         rbt_replica_free   ( RBTREPLICA * rep );
+/* return: publish: RBT_RC_OK(0), RBT_RC_ERROR(-1)
+           refresh: RBT_RC_OK(0), RBT_RC_NOTFOUND(1): up to date
+                    or the copy before has readers, RBT_RC_ERROR(-1) */
+
+/*** Split and join ***/
+
+int rbt_split( RBT * rbt, void * key, RBT * left_out, RBT * right_out );
+int rbt_join ( RBT * left, void * pivot, RBT * right );
+/* return: RBT_RC_OK(0), RBT_RC_ERROR(-1) (also with a journal) */
+
+/*** Set operations (rbt2 is left empty) ***/
+
+int rbt_union     ( RBT * rbt, RBT * rbt2, int nthreads );
+int rbt_intersect ( RBT * rbt, RBT * rbt2, int nthreads );
+int rbt_difference( RBT * rbt, RBT * rbt2, int nthreads );
+/* return: RBT_RC_OK(0), RBT_RC_ERROR(-1) (also for multiset trees, or
+   with a journal) */
+
+/*** Parallel traversal (threads with -DRBT_PTHREAD) ***/
+
+int rbt_parallel_for   ( RBT * rbt, int nthreads,
+                         void (*fn)(void*node,void*ctx), void * ctx );
+int rbt_parallel_reduce( RBT * rbt, int nthreads,
+                         void (*fn)(void*node,void*acc,void*ctx),
+                         void (*merge)(void*acc,void*acc2,void*ctx),
+                         void * acc, size_t acc_size, void * ctx );
+/* return: RBT_RC_OK(0), RBT_RC_ERROR(-1) */
+
+/*** Dump and load ***/
+
+int rbt_dump( RBT * rbt, int fd,
+              size_t (*serialize)(void*node,void*buf,size_t size) );
+int rbt_load( RBT * rbt, int fd,
+              void * (*deserialize)(void*buf,size_t size) );
+/* return: RBT_RC_OK(0), RBT_RC_ERROR(-1) */
+
+/*** Write-ahead journal ***/
+
+int rbt_journal_open  ( RBT * rbt, int fd,
+                        size_t (*serialize)(void*node,void*buf,size_t size),
+                        unsigned max_ops, unsigned max_ms );
+int rbt_journal_sync  ( RBT * rbt );
+int rbt_journal_close ( RBT * rbt );
+int rbt_journal_replay( RBT * rbt, int fd,
+                        void * (*deserialize)(void*buf,size_t size) );
+/* return: RBT_RC_OK(0), RBT_RC_ERROR(-1) */
+
+/*** Memory mapped (persistent) tree ***/
+
+RBT  * rbt_open_mapped ( const char * path, RBTDEF * def,
+                         size_t max_size );
+int    rbt_sync_mapped ( RBT * rbt );
+int    rbt_close_mapped( RBT * rbt );
+void * rbt_mapped_alloc( RBT * rbt, size_t size );
+void   rbt_mapped_free ( void * node );
+
+/*** Hash index (def->keyHash and nodeHash) ***/
+
+int rbt_hash_build( RBT * rbt );
+/* return: RBT_RC_OK(0), RBT_RC_ERROR(-1) */
+
+/*** Statistics (counted when build with -DRBT_STATS) ***/
+
+int  rbt_stats      ( RBT * rbt, RBTSTATS * out );
+void rbt_stats_reset( RBT * rbt );
+/* return: RBT_RC_OK(0), RBT_RC_ERROR(-1) (not build with RBT_STATS) */
+
+/*** Profile ***/
+
+int rbt_profile( RBT * rbt, RBTPROFILE * report );
+/* return: RBT_RC_OK(0) */
+
+/*** Latency histograms (recorded when build with -DRBT_LATENCY) ***/
+
+int    rbt_latency_merge ( RBTLATENCY * out );
+void   rbt_latency_add   ( RBTLATENCY * out, RBTLATENCY * in );
+void   rbt_latency_reset ( void );
+double rbt_latency_pct   ( RBTLATENCY * h, int op, double pct );
+int    rbt_latency_export( RBTLATENCY * h, int fd, int json );
+/* return: RBT_RC_OK(0), RBT_RC_ERROR(-1) */
+
 /*** Traversal ***/
 
 void * rbt_get   ( RBT * rbt, void * key );  /* Equal-to */
+void * rbt_get_finger( RBT * rbt, RBTFINGER * finger,
+                    void * key );            /* Equal-to, near finger */
 void * rbt_first ( RBT * rbt );              /* First node */
 void * rbt_next  ( RBT * rbt, void * node ); /* Ascending node */
 void * rbt_last  ( RBT * rbt );              /* Last node */
@@ -110,6 +386,12 @@ void * rbt_feq   ( RBT * rbt,
 void * rbt_leq   ( RBT * rbt,
                     int (*cmp)(void*,void*),
                     void * key );            /* Last Equal-to */
+void * rbt_fge   ( RBT * rbt,
+                    int (*cmp)(void*,void*),
+                    void * key );            /* First Greater-or-equal */
+void * rbt_fgt   ( RBT * rbt,
+                    int (*cmp)(void*,void*),
+                    void * key );            /* First Greater-than */
 
 /*** (validation tests) ***/
 
@@ -120,6 +402,15 @@ int rbttest_last ( RBT * rbt );
 int rbttest_ascending( RBT * rbt );
 int rbttest_all  ( RBT * rbt );
 
+/* behavior tests, on trees of their own (path: a scratch file): */
+int rbttest_split_join( void );
+int rbttest_journal   ( const char * path );
+int rbttest_hash      ( void );
+int rbttest_buffer    ( void );
+int rbttest_concurrent( void );
+int rbttest_mapped    ( const char * path );
+/* return: 0, or the failed step (< 0) */
+
 /********************************************************************/
 #ifdef __cplusplus
 }
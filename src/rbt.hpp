@@ -0,0 +1,334 @@
+/*********************************************************************
+* Red Black Tree functions (threaded)
+*
+* rbt.hpp
+*
+**********************************************************************
+*
+* C++ adaptor for a RBT (header only, the RBT is not owned):
+*
+*   rbt::tree<Node>     begin/end, rbegin/rend, find, lower_bound,
+*                       upper_bound, equal_range, range(cmp,key)
+*   rbt::iterator<Node> bidirectional iterator (Node&)
+*   rbt::range<Node>    [begin,end) of a tree, eg. feq..leq
+*
+* The iterators walk the threads inline (as rbt_next/rbt_prev, incl.
+* skipping lazy deleted nodes, but not recorded in the RBT_LATENCY
+* histograms), so a loop like
+*
+*   for( myNode & n : rbt::tree<myNode>( &tree ) ) ...
+*
+* is the same code as a rbt_first/rbt_next loop. In concurrent mode
+* (rbt_concurrent) they call rbt_first/rbt_next etc. instead, which lock
+* couple. Range is a borrowed view in C++20, for std::ranges algorithms.
+*
+**********************************************************************
+* Copyright (c) 2020 Michael Walsh Pedersen
+*********************************************************************/
+#ifndef RBT_HPP_
+#define RBT_HPP_
+
+#include <cstddef>
+#include <iterator>
+#if __cplusplus >= 202002L
+#include <ranges>
+#endif
+#include "rbt.h"
+
+namespace rbt {
+
+/*********************************************************************
+* threaded walks (the color bits RBT_LEFT_DATA etc. are in rbt.h)
+*********************************************************************/
+
+namespace detail {
+
+inline void * left( const RBTDEF * def, void * n )
+{
+    return *(void**)( (char*)n + def->left_ofs );
+}
+
+inline void * right( const RBTDEF * def, void * n )
+{
+    return *(void**)( (char*)n + def->right_ofs );
+}
+
+inline bool left_data( const RBTDEF * def, void * n )
+{
+    return ( *( (char*)n + def->color_ofs ) & RBT_LEFT_DATA ) != 0;
+}
+
+inline bool right_data( const RBTDEF * def, void * n )
+{
+    return ( *( (char*)n + def->color_ofs ) & RBT_RIGHT_DATA ) != 0;
+}
+
+inline bool tomb( const RBTDEF * def, void * n ) /* lazy deleted */
+{
+    return ( *( (char*)n + def->color_ofs ) & RBT_TOMB ) != 0;
+}
+
+inline void * next_node( const RBTDEF * def, void * n )
+{
+    if( !right_data( def, n ) )
+        return right( def, n );
+    n = right( def, n );
+    while( left_data( def, n ) )
+        n = left( def, n );
+    return n;
+}
+
+inline void * prev_node( const RBTDEF * def, void * n )
+{
+    if( !left_data( def, n ) )
+        return left( def, n );
+    n = left( def, n );
+    while( right_data( def, n ) )
+        n = right( def, n );
+    return n;
+}
+
+inline bool buffered( const RBT * rbt ) /* rbt_buffer has nodes */
+{
+    return rbt->delta && rbt->delta->root;
+}
+
+inline void * next( const RBT * rbt, void * n )
+{
+    if( rbt->conc || buffered( rbt ) ) /* lock coupling, merged cursor */
+        return rbt_next( const_cast<RBT*>( rbt ), n );
+    do
+        n = next_node( rbt->def, n );
+    while( n && rbt->tombs && tomb( rbt->def, n ) );
+    return n;
+}
+
+inline void * prev( const RBT * rbt, void * n )
+{
+    if( rbt->conc || buffered( rbt ) ) /* lock coupling, merged cursor */
+        return rbt_prev( const_cast<RBT*>( rbt ), n );
+    do
+        n = prev_node( rbt->def, n );
+    while( n && rbt->tombs && tomb( rbt->def, n ) );
+    return n;
+}
+
+inline void * first( RBT * rbt )
+{
+    void * n;
+    if( rbt->conc || buffered( rbt ) )
+        return rbt_first( rbt );
+    if( rbt->minmax_gen == rbt->del_gen ) /* cached */
+        n = rbt->first;
+    else if( ( n = rbt->root ) != NULL )
+        while( left_data( rbt->def, n ) )
+            n = left( rbt->def, n );
+    if( n && rbt->tombs && tomb( rbt->def, n ) )
+        n = next( rbt, n );
+    return n;
+}
+
+inline void * last( RBT * rbt )
+{
+    void * n;
+    if( rbt->conc || buffered( rbt ) )
+        return rbt_last( rbt );
+    if( rbt->minmax_gen == rbt->del_gen )
+        n = rbt->last;
+    else if( ( n = rbt->root ) != NULL )
+        while( right_data( rbt->def, n ) )
+            n = right( rbt->def, n );
+    if( n && rbt->tombs && tomb( rbt->def, n ) )
+        n = prev( rbt, n );
+    return n;
+}
+
+template<class Key>
+inline void * key_ptr( const Key * key )
+{
+    return const_cast<void*>( static_cast<const void*>( key ) );
+}
+
+} // namespace detail
+
+/*********************************************************************
+* iterator: end() is a NULL node, --end() is the last node.
+*********************************************************************/
+
+template<class Node>
+class iterator {
+public:
+    typedef std::bidirectional_iterator_tag iterator_category;
+    typedef Node                            value_type;
+    typedef std::ptrdiff_t                  difference_type;
+    typedef Node *                          pointer;
+    typedef Node &                          reference;
+
+    iterator() : rbt_( NULL ), node_( NULL ) {}
+    iterator( RBT * rbt, void * node )
+        : rbt_( rbt ), node_( static_cast<Node*>( node ) ) {}
+
+    Node & operator*() const  { return *node_; }
+    Node * operator->() const { return node_; }
+    Node * get() const        { return node_; } /* NULL at end */
+
+    iterator & operator++()
+    {
+        node_ = static_cast<Node*>( detail::next( rbt_, node_ ) );
+        return *this;
+    }
+    iterator operator++(int) { iterator i = *this; ++*this; return i; }
+
+    iterator & operator--()
+    {
+        node_ = static_cast<Node*>( node_
+            ? detail::prev( rbt_, node_ ) : detail::last( rbt_ ) );
+        return *this;
+    }
+    iterator operator--(int) { iterator i = *this; --*this; return i; }
+
+    friend bool operator==( const iterator & a, const iterator & b )
+    {
+        return a.node_ == b.node_;
+    }
+    friend bool operator!=( const iterator & a, const iterator & b )
+    {
+        return a.node_ != b.node_;
+    }
+
+private:
+    RBT  * rbt_;
+    Node * node_;
+};
+
+/*********************************************************************
+* range: [begin,end) of one tree.
+*********************************************************************/
+
+template<class Node>
+class range {
+public:
+    range() {}
+    range( iterator<Node> b, iterator<Node> e ) : begin_( b ), end_( e ) {}
+
+    iterator<Node> begin() const { return begin_; }
+    iterator<Node> end() const   { return end_; }
+    bool           empty() const { return begin_ == end_; }
+
+private:
+    iterator<Node> begin_;
+    iterator<Node> end_;
+};
+
+/*********************************************************************
+* tree: adaptor for a RBT (init, insert, delete etc. by the rbt_
+* functions). Keys are passed as pointers to keyCmp (or cmp).
+*********************************************************************/
+
+template<class Node>
+class tree {
+public:
+    typedef Node                                  value_type;
+    typedef Node &                                reference;
+    typedef std::size_t                           size_type;
+    typedef std::ptrdiff_t                        difference_type;
+    typedef rbt::iterator<Node>                   iterator;
+    typedef rbt::iterator<Node>                   const_iterator;
+    typedef std::reverse_iterator<iterator>       reverse_iterator;
+    typedef rbt::range<Node>                      range_type;
+
+    explicit tree( RBT * rbt ) : rbt_( rbt ) {}
+
+    RBT *     get() const   { return rbt_; }
+    size_type size() const  { return rbt_size( rbt_ ); }
+    bool      empty() const { return size() == 0; }
+
+    iterator begin() const { return iterator( rbt_, detail::first( rbt_ ) ); }
+    iterator end() const   { return iterator( rbt_, NULL ); }
+    reverse_iterator rbegin() const { return reverse_iterator( end() ); }
+    reverse_iterator rend() const   { return reverse_iterator( begin() ); }
+
+    /* node to iterator, eg. after rbt_get */
+    iterator iter( Node * node ) const { return iterator( rbt_, node ); }
+
+    template<class Key>
+    iterator find( const Key * key ) const
+    {
+        return iterator( rbt_, rbt_get( rbt_, detail::key_ptr( key ) ) );
+    }
+
+    /* by keyCmp */
+
+    template<class Key>
+    iterator lower_bound( const Key * key ) const
+    {
+        return lower_bound( rbt_->def->keyCmp, key );
+    }
+
+    template<class Key>
+    iterator upper_bound( const Key * key ) const
+    {
+        return upper_bound( rbt_->def->keyCmp, key );
+    }
+
+    template<class Key>
+    range_type equal_range( const Key * key ) const
+    {
+        return equal_range( rbt_->def->keyCmp, key );
+    }
+
+    /* by cmp (as for rbt_feq), eg. on a prefix of the key */
+
+    template<class Key>
+    iterator lower_bound( int (*cmp)(void*,void*), const Key * key ) const
+    {
+        return iterator( rbt_, rbt_fge( rbt_, cmp, detail::key_ptr( key ) ) );
+    }
+
+    template<class Key>
+    iterator upper_bound( int (*cmp)(void*,void*), const Key * key ) const
+    {
+        return iterator( rbt_, rbt_fgt( rbt_, cmp, detail::key_ptr( key ) ) );
+    }
+
+    template<class Key>
+    range_type equal_range( int (*cmp)(void*,void*), const Key * key ) const
+    {
+        return range_type( lower_bound( cmp, key ), upper_bound( cmp, key ) );
+    }
+
+    /* rbt_feq .. rbt_leq */
+    template<class Key>
+    range_type range( int (*cmp)(void*,void*), const Key * key ) const
+    {
+        void * f = rbt_feq( rbt_, cmp, detail::key_ptr( key ) );
+        void * l;
+
+        if( f == NULL )
+            return range_type( end(), end() );
+        l = rbt_leq( rbt_, cmp, detail::key_ptr( key ) );
+        return range_type( iterator( rbt_, f ), ++iterator( rbt_, l ) );
+    }
+
+private:
+    RBT * rbt_;
+};
+
+} // namespace rbt
+
+#if __cplusplus >= 202002L
+/* the nodes are not owned by a range or tree */
+template<class Node>
+inline constexpr bool std::ranges::enable_borrowed_range<rbt::range<Node>>
+    = true;
+template<class Node>
+inline constexpr bool std::ranges::enable_borrowed_range<rbt::tree<Node>>
+    = true;
+template<class Node>
+inline constexpr bool std::ranges::enable_view<rbt::range<Node>> = true;
+#endif
+
+#endif//RBT_HPP_
+
+/***[end-of-file]****************************************************/
+/********************************************************************/
@@ -0,0 +1,179 @@
+/*********************************************************************
+* Red Black Tree functions (threaded)
+*
+* rbt_buffer.c
+*
+**********************************************************************
+* functions:
+*
+*   int rbt_buffer      ( RBT * rbt, size_t max )
+*   int rbt_buffer_merge( RBT * rbt )
+*
+* internal:
+*
+*   size_t rbti_buffered_size( RBT * rbt )
+*
+**********************************************************************
+* Write buffer: inserts go to a small delta tree (rbt->delta, same
+* RBTDEF), which stays in the cache, instead of a descent in the large
+* main tree. When the delta tree has max nodes they are inserted into
+* the main tree in ascending order: the descents of neighbouring keys
+* share most of their path, which is then in the cache (and for keys
+* in clusters, most of the leaves too).
+*
+* A delete of a buffered node only marks it as a tombstone in the
+* delta tree, which hides the node with its key in the main tree until
+* the merge deletes that one too (other deletes go to the main tree).
+*
+* The reads never merge: rbt_get looks in both trees (the delta tree
+* first, it has the newest nodes), rbt_first/next etc. and rbt_feq etc.
+* step a merged cursor over both (rbti_buffered_pick in rbt_first.c),
+* and rbt_size counts the keys of the buffer in the main tree. The
+* functions that restructure the main tree, or walk its structure
+* (split, join, union, dump, profile, parallel ...), merge the buffer
+* first.
+**********************************************************************
+* Copyright (c) 2020 Michael Walsh Pedersen
+*********************************************************************/
+
+#include <stdlib.h>
+#include "rbt.h"
+#include "rbt_internal.h"
+
+/*********************************************************************
+* int rbt_buffer( RBT * rbt, size_t max )
+* Buffer up to max inserted nodes before merging them into the tree,
+* or merge and stop buffering (max 0). A node replaced in the main tree
+* by a buffered node is freed by the merge (the _keep functions only
+* return nodes replaced in the buffer). The tombstones (deleted
+* buffered nodes) fill the buffer too. rbt_insert_absent and
+* rbt_upsert check the buffer, but insert into the main tree (or into
+* the buffer, over a tombstone). Not for multiset trees, nor in
+* concurrent mode (see rbt_concurrent).
+* Return: RBT_RC_OK(0), RBT_RC_ERROR(-1)
+*********************************************************************/
+
+int rbt_buffer(
+    RBT    * rbt,
+    size_t   max )
+{
+    int rc;
+
+    if( max == 0 )
+    {
+        rc = rbt_buffer_merge( rbt );
+        if( rc == RBT_RC_OK && rbt->delta )
+        {
+            rbti_hash_drop( rbt->delta );
+            free( rbt->delta );
+            rbt->delta = NULL;
+        }
+        rbt->delta_max = 0;
+        return rc;
+    }
+    if( is_multiset(rbt->def) || rbt->conc )
+        return RBT_RC_ERROR;
+    if( rbt->delta == NULL )
+    {
+        rbt->delta = (RBT*)malloc( sizeof(RBT) );
+        if( rbt->delta == NULL )
+            return RBT_RC_ERROR;
+        rbt_init( rbt->delta, rbt->def );
+    }
+    rbt->delta_max = max;
+    if( rbt->delta->size + rbt->delta->tombs >= max )
+        return rbt_buffer_merge( rbt );
+    return RBT_RC_OK;
+}
+
+/*********************************************************************
+* int rbt_buffer_merge( RBT * rbt )
+* Merge the buffered nodes into the tree now, eg. in idle time, and
+* delete the nodes hidden by tombstones, which are freed.
+* Return: RBT_RC_OK(0), RBT_RC_ERROR(-1)
+*********************************************************************/
+
+int rbt_buffer_merge(
+    RBT    * rbt )
+{
+    RBTDEF     * def;
+    RBT        * delta;
+    RBTJOURNAL * journal;
+    void       * n, * next;
+    int          rc;
+
+    def = rbt->def;
+    delta = rbt->delta;
+    if( delta == NULL || delta->root == NULL )
+        return RBT_RC_OK;
+    n = rbti_min( def, delta->root );
+    rbti_hash_clear( delta );
+    delta->root = NULL;
+    delta->size = 0;
+    delta->tombs = 0;
+    delta->del_gen++;
+    rbti_minmax( delta );
+
+    /* the inserts and deletes are journaled already, and must not be
+       buffered */
+    journal = rbt->journal;
+    rbt->journal = NULL;
+    rbt->delta = NULL;
+    rc = RBT_RC_OK;
+    for( ; n ; n = next )
+    {
+        next = rbti_next( def, n ); /* before n is linked into rbt */
+        if( is_tomb(n) )
+        {
+            if( rbt_delnode( rbt, n ) == RBT_RC_ERROR )
+                rc = RBT_RC_ERROR;
+            def->freeNode( n );
+        }
+        else if( rbt_insert( rbt, n ) != RBT_RC_OK )
+            rc = RBT_RC_ERROR;
+    }
+    rbt->delta = delta;
+    rbt->journal = journal;
+    return rc;
+}
+
+/*********************************************************************
+* size_t rbti_buffered_size( RBT * rbt )
+* The count of nodes of rbt and its write buffer, without merging:
+* each buffered node (or tombstone) is looked for in the tree, in
+* O(d log n) for d buffered nodes.
+* Return: count of nodes
+*********************************************************************/
+
+size_t rbti_buffered_size(
+    RBT    * rbt )
+{
+    RBTDEF * def;
+    void   * x, * n;
+    size_t   size;
+    int      rc;
+
+    def = rbt->def;
+    size = rbt->size;
+    for( x = rbti_min( def, rbt->delta->root ) ; x ; x = rbti_next( def, x ) )
+    {
+        for( n = rbt->root ; n ; )
+        {
+            rc = rbti_nodecmp( def, n, x );
+            if( rc == 0 )
+                break;
+            if( rc > 0 ? is_left_thrd(n) : is_right_thrd(n) )
+                n = NULL;
+            else
+                n = rc > 0 ? child_left(n) : child_right(n);
+        }
+        if( n && !is_tomb(n) ) /* replaced (or deleted) by x */
+            size--;
+        if( !is_tomb(x) )
+            size++;
+    }
+    return size;
+}
+
+/***[end-of-file]****************************************************/
+/********************************************************************/
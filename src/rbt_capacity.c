@@ -0,0 +1,221 @@
+/*********************************************************************
+* Red Black Tree functions (threaded)
+*
+* rbt_capacity.c
+*
+**********************************************************************
+* functions:
+*
+*   int    rbt_capacity( RBT * rbt, RBTCAPACITY * cap )
+*   size_t rbt_memory  ( RBT * rbt )
+*
+* internal:
+*
+*   void   rbti_cap_evict( RBT * rbt, void * keep )
+*
+**********************************************************************
+* Size limits for trees used as caches: when an insert makes the tree
+* hold more than max_nodes nodes, or more than max_bytes node bytes,
+* nodes are evicted (deleted) from the first or last end, or as chosen
+* by a victim callback, until it is within the limits again.
+*
+* The node bytes (cap->nodeBytes, or def->node_size) are kept in
+* rbt->bytes by the inserts and deletes. Operations that move many
+* nodes at once (split, join, set operations, load) make it unknown,
+* and it is counted again, O(n), by the next insert (or rbt_memory).
+**********************************************************************
+* Copyright (c) 2020 Michael Walsh Pedersen
+*********************************************************************/
+
+#include <stdlib.h>
+#include "rbt.h"
+#include "rbt_internal.h"
+
+/*********************************************************************
+* static size_t count_bytes(...)
+* Return: node bytes of all nodes in tree t (also tombstones).
+*********************************************************************/
+
+static size_t count_bytes(
+    RBT    * rbt,
+    RBT    * t)
+{
+    RBTDEF * def;
+    void   * n;
+    size_t   bytes;
+
+    def = t->def;
+    if( rbt->cap->nodeBytes == NULL )
+    {
+        size_count(t);
+        return ( t->size + t->tombs ) * def->node_size;
+    }
+    bytes = 0;
+    for( n = rbti_min( def, t->root ) ; n ; n = rbti_next( def, n ) )
+        bytes += rbt->cap->nodeBytes( n );
+    return bytes;
+}
+
+/*********************************************************************
+* static int over_limit(...)
+* Return: 1: rbt has more nodes or bytes than allowed, 0: no
+*********************************************************************/
+
+static int over_limit(
+    RBT    * rbt)
+{
+    RBTCAPACITY * cap;
+
+    cap = rbt->cap;
+    size_count(rbt);
+    if( cap->max_nodes && rbt->size > cap->max_nodes )
+        return 1;
+    if( cap->max_bytes == 0 )
+        return 0;
+    if( rbt->bytes == RBTI_BYTES_UNKNOWN )
+        rbt->bytes = count_bytes( rbt, rbt );
+    return rbt->bytes > cap->max_bytes;
+}
+
+/*********************************************************************
+* void rbti_cap_evict(...)
+* Evict nodes until rbt is within its limits. The node keep (just
+* inserted) is never evicted.
+*********************************************************************/
+
+void rbti_cap_evict(
+    RBT    * rbt,
+    void   * keep)
+{
+    RBTCAPACITY * cap;
+    void        * v;
+    int           popped;
+
+    cap = rbt->cap;
+    while( over_limit( rbt ) )
+    {
+        popped = 0;
+        switch( cap->evict )
+        {
+        case RBT_EVICT_FIRST:
+            v = rbt_first( rbt );
+            if( v == keep && v )
+                v = rbt_next( rbt, v );
+            else if( v )
+            {
+                v = rbt_pop_first( rbt );   /* no compares */
+                popped = 1;
+            }
+            break;
+        case RBT_EVICT_LAST:
+            v = rbt_last( rbt );
+            if( v == keep && v )
+                v = rbt_prev( rbt, v );
+            else if( v )
+            {
+                v = rbt_pop_last( rbt );
+                popped = 1;
+            }
+            break;
+        default: /* RBT_EVICT_VICTIM */
+            v = cap->victim( rbt, cap->ctx );
+            break;
+        }
+        if( v == NULL || v == keep )
+            break;
+        if( !popped && rbt_erase_keep( rbt, v, NULL ) != RBT_RC_OK )
+            break;
+        if( cap->evicted )
+            cap->evicted( v, cap->ctx );
+        else
+            rbt->def->freeNode( v );
+    }
+}
+
+/*********************************************************************
+* int rbt_capacity( RBT * rbt, RBTCAPACITY * cap )
+* Set size limits (a copy of cap is kept), or remove them (cap NULL).
+* Inserts then evict nodes by cap->evict while the tree has more than
+* max_nodes nodes (not counting lazy deleted nodes), or more than
+* max_bytes node bytes (counting them, until purged). An evicted node
+* is given to cap->evicted, or freed by def->freeNode. If victim()
+* returns NULL (or the inserted node), nothing more is evicted. With
+* a write buffer (rbt_buffer), the limits are kept when it is merged.
+* nodeBytes(node) must not change while the node is in the tree.
+* The tree is evicted down to the new limits at once. Not in
+* concurrent mode (see rbt_concurrent).
+* Return: RBT_RC_OK(0), RBT_RC_ERROR(-1)
+*********************************************************************/
+
+int rbt_capacity(
+    RBT         * rbt,
+    RBTCAPACITY * cap )
+{
+    if( cap == NULL )
+    {
+        free( rbt->cap );
+        rbt->cap = NULL;
+        return RBT_RC_OK;
+    }
+    if( cap->evict < RBT_EVICT_FIRST || cap->evict > RBT_EVICT_VICTIM
+        || ( cap->evict == RBT_EVICT_VICTIM && cap->victim == NULL )
+        || ( cap->max_bytes && cap->nodeBytes == NULL
+             && rbt->def->node_size == 0 ) || rbt->conc )
+        return RBT_RC_ERROR;
+    if( rbt->cap == NULL )
+    {
+        rbt->cap = (RBTCAPACITY*)malloc( sizeof(RBTCAPACITY) );
+        if( rbt->cap == NULL )
+            return RBT_RC_ERROR;
+    }
+    *rbt->cap = *cap;
+    delta_merge(rbt);
+    cap_drop(rbt);
+    rbti_cap_evict( rbt, NULL );
+    return RBT_RC_OK;
+}
+
+/*********************************************************************
+* size_t rbt_memory( RBT * rbt )
+* Memory used by the tree: the RBT, the nodes (cap->nodeBytes each with
+* size limits, else def->node_size each) and tombstones, the hash
+* index, the write buffer with its nodes, the size limits, the journal
+* buffer, the retired nodes and their list (concurrent mode), the
+* recorded nodes of the relaxed balance mode, and the last image
+* published for replicas. Not the memory that the nodes point to.
+* Return: bytes (the nodes count as 0 if no size is known)
+*********************************************************************/
+
+size_t rbt_memory(
+    RBT * rbt )
+{
+    size_t bytes;
+
+    size_count(rbt);
+    if( rbt->cap == NULL )
+        bytes = ( rbt->size + rbt->tombs ) * rbt->def->node_size;
+    else
+    {
+        if( rbt->bytes == RBTI_BYTES_UNKNOWN )
+            rbt->bytes = count_bytes( rbt, rbt );
+        bytes = rbt->bytes + sizeof(RBTCAPACITY);
+    }
+    bytes += sizeof(RBT);
+    bytes += rbti_hash_bytes( rbt );
+    bytes += rbti_journal_bytes( rbt );
+    bytes += rbti_conc_bytes( rbt );
+    bytes += rbti_repl_bytes( rbt );
+    if( rbt->relax )
+        bytes += sizeof(RBTRELAX) + rbt->relax->max * sizeof(void*);
+    if( rbt->delta )
+    {
+        bytes += sizeof(RBT) + rbti_hash_bytes( rbt->delta );
+        bytes += rbt->cap ? count_bytes( rbt, rbt->delta )
+                          : ( rbt->delta->size + rbt->delta->tombs )
+                            * rbt->def->node_size;
+    }
+    return bytes;
+}
+
+/***[end-of-file]****************************************************/
+/********************************************************************/
@@ -0,0 +1,480 @@
+/*********************************************************************
+* Red Black Tree functions (threaded)
+*
+* rbt_concurrent.c
+*
+**********************************************************************
+* functions:
+*
+*   int    rbt_concurrent      ( RBT * rbt, int on )
+*   void   rbt_quiescent       ( RBT * rbt )
+*   void   rbt_concurrent_leave( RBT * rbt )
+*
+* internal:
+*
+*   void   rbti_lock_wait  ( char * c )
+*   void   rbti_lock_shared_wait( char * c )
+*   void   rbti_conc_join  ( RBT * rbt )
+*   void   rbti_conc_replace( RBTDEF * def, RBT * rbt, void * p, int dir,
+*                             void * q, void * n )
+*   int    rbti_conc_reserve( RBT * rbt )
+*   void   rbti_conc_unreserve( RBT * rbt )
+*   void   rbti_conc_retire( RBT * rbt, void * node )
+*   size_t rbti_conc_bytes ( RBT * rbt )
+*
+**********************************************************************
+* Concurrent mode: writers (and readers) in parallel threads, with a
+* lock per node and hand-over-hand locking, always from the top down.
+*
+* The lock of a node is in its color (see rbt_internal.h), so the
+* nodes need no extra field: a writer takes it exclusively, a reader
+* (rbt_get, rbt_next, the range finds ...) shares it with up to two
+* other readers, so readers do not wait for each other at the root. A
+* writer that set the lock bit waits for the readers to leave, and no
+* new reader enters meanwhile. As the lock bits of a node change while
+* another thread holds it, its color is only read and changed by
+* atomic operations.
+*
+* Inserts and deletes are top-down, in one pass: an insert splits
+* 4-nodes on the way down and fixes a red-red at once by a rotation, a
+* delete pushes a red node down by color flips and rotations, so the
+* node it unlinks at the bottom is red (see insert_concurrent in
+* rbt_insert.c and delete_concurrent in rbt_del.c). Only a window of a
+* few nodes is locked, and the locks above it are released during the
+* descent: writers with keys in different subtrees then only meet near
+* the root.
+*
+* A node deleted, or replaced by an insert of an equal key, is marked
+* as replaced and kept (retired), as other threads may still be
+* reading it: rbt_next etc. from it then search for the neighbour by
+* nodeCmp. Room for it in the list of retired nodes is reserved before
+* it is unlinked (else the insert or delete fails), so it is never
+* freed while other threads may have it. With lazy delete on (see
+* rbt_lazy_delete) a delete only marks the node deleted.
+*
+* Retired nodes are freed by quiescent states (QSBR): each thread that
+* uses the tree gets a slot at its first call (by the address of a
+* thread local), and calls rbt_quiescent when it holds no nodes of the
+* tree. A node retired in epoch e is freed when every thread with a
+* slot has been quiescent after the epoch was advanced past e; the
+* epoch is advanced when all of them have seen it. A thread done with
+* the tree gives back its slot by rbt_concurrent_leave. If more than
+* RBTI_CONC_THREADS threads use the tree, the nodes are kept until the
+* mode is turned off (as when no thread calls rbt_quiescent).
+**********************************************************************
+* Copyright (c) 2020 Michael Walsh Pedersen
+*********************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include "rbt.h"
+#include "rbt_internal.h"
+
+#define SPINS_BEFORE_YIELD  64
+#define QUIESCENT_FREE      32  /* rbt_quiescent calls per free try */
+
+static _Thread_local char       my_id;      /* its address: the thread */
+static _Thread_local RBTCONC  * my_conc;    /* my_slot is in my_conc */
+static _Thread_local RBTISLOT * my_slot;
+static _Thread_local unsigned   my_calls;
+
+/*********************************************************************
+* void rbti_lock_wait(...)
+* Wait for the lock bit of *c, and take it; then wait for the readers
+* that share the lock to leave.
+*********************************************************************/
+
+void rbti_lock_wait(
+    char   * c)
+{
+    char old;
+    int  spins;
+
+    for( spins = 0 ; ; spins++ )
+    {
+        old = __atomic_load_n( c, __ATOMIC_RELAXED );
+        if( ( old & NODE_LOCK ) == 0
+            && __atomic_compare_exchange_n( c, &old, old | NODE_LOCK, 0,
+                __ATOMIC_ACQUIRE, __ATOMIC_RELAXED ) )
+            break;
+        if( spins >= SPINS_BEFORE_YIELD )
+            sched_yield();
+    }
+    for( spins = 0 ; __atomic_load_n( c, __ATOMIC_ACQUIRE ) & NODE_READERS ;
+         spins++ )
+        if( spins >= SPINS_BEFORE_YIELD )
+            sched_yield();
+}
+
+/*********************************************************************
+* void rbti_lock_shared_wait(...)
+* Wait until *c is not locked by a writer (nor shared by 3 readers),
+* and share its lock.
+*********************************************************************/
+
+void rbti_lock_shared_wait(
+    char   * c)
+{
+    char old;
+    int  spins;
+
+    for( spins = 0 ; ; spins++ )
+    {
+        old = __atomic_load_n( c, __ATOMIC_RELAXED );
+        if( ( old & NODE_LOCK ) == 0 && ( old & NODE_READERS ) != NODE_READERS
+            && __atomic_compare_exchange_n( c, &old,
+                (char)( old + NODE_READER ), 0,
+                __ATOMIC_ACQUIRE, __ATOMIC_RELAXED ) )
+            return;
+        if( spins >= SPINS_BEFORE_YIELD )
+            sched_yield();
+    }
+}
+
+/*********************************************************************
+* static RBTISLOT * find_slot(...)
+* The slot of this thread, or a free one if add (its epoch is then the
+* current one): the slots change under the retire lock. A cached slot
+* of a RBTCONC since freed (and another at the same address) is found
+* by its id.
+* Return: slot or NULL.
+*********************************************************************/
+
+static RBTISLOT * find_slot(
+    RBTCONC * c,
+    int       add)
+{
+    RBTISLOT * s;
+    int        i;
+
+    if( my_conc == c && my_slot->id == &my_id )
+        return my_slot;
+    if( __atomic_load_n( &c->no_free, __ATOMIC_RELAXED ) && add )
+        return NULL;
+    s = NULL;
+    rbti_lock( &c->retire_lock );
+    for( i = 0 ; i < RBTI_CONC_THREADS && s == NULL ; i++ )
+        if( c->slot[i].id == &my_id )
+            s = &c->slot[i];
+    for( i = 0 ; i < RBTI_CONC_THREADS && s == NULL && add ; i++ )
+        if( c->slot[i].id == NULL )
+        {
+            s = &c->slot[i];
+            s->id = &my_id;
+            __atomic_store_n( &s->seen, c->epoch, __ATOMIC_RELAXED );
+        }
+    if( s == NULL && add )
+        c->no_free = 1;
+    rbti_unlock( &c->retire_lock );
+    if( s )
+    {
+        my_conc = c;
+        my_slot = s;
+    }
+    return s;
+}
+
+/*********************************************************************
+* static void free_retired(...)
+* Advance the epoch if all threads have seen it, and free the retired
+* nodes that no thread may have any more.
+*********************************************************************/
+
+static void free_retired(
+    RBT     * rbt)
+{
+    RBTCONC     * c;
+    RBTIRETIRED * r;
+    unsigned long min, seen;
+    size_t        i;
+    int           k;
+
+    c = rbt->conc;
+    rbti_lock( &c->retire_lock );
+    if( c->no_free )
+    {
+        rbti_unlock( &c->retire_lock );
+        return;
+    }
+    min = (unsigned long)-1; /* no thread: all nodes */
+    for( k = 0 ; k < RBTI_CONC_THREADS ; k++ )
+        if( c->slot[k].id )
+        {
+            seen = __atomic_load_n( &c->slot[k].seen, __ATOMIC_ACQUIRE );
+            if( seen < min )
+                min = seen;
+        }
+    if( min >= c->epoch && c->n_retired )
+        __atomic_store_n( &c->epoch, c->epoch + 1, __ATOMIC_RELEASE );
+    r = c->retired;
+    for( i = 0 ; i < c->n_retired && r[i].epoch < min ; i++ )
+        rbt->def->freeNode( r[i].node );
+    if( i )
+    {
+        memmove( r, r + i, ( c->n_retired - i ) * sizeof(RBTIRETIRED) );
+        __atomic_store_n( &c->n_retired, c->n_retired - i,
+            __ATOMIC_RELAXED ); /* read unlocked by rbt_quiescent */
+    }
+    rbti_unlock( &c->retire_lock );
+}
+
+/*********************************************************************
+* void rbti_conc_join(...)
+* Give the calling thread a slot, before it gets any node of the tree.
+*********************************************************************/
+
+void rbti_conc_join(
+    RBT    * rbt)
+{
+    find_slot( rbt->conc, 1 );
+}
+
+/*********************************************************************
+* void rbti_conc_replace(...)
+* Replace node q (locked, child dir of locked p, or the root) by n
+* (locked, stays locked): the threads to q are in the subtrees of q,
+* locked top-down. q is marked as replaced.
+*********************************************************************/
+
+void rbti_conc_replace(
+    RBTDEF * def,
+    RBT    * rbt,
+    void   * p,
+    int      dir,
+    void   * q,
+    void   * n)
+{
+    void * x, * y;
+    int    d;
+
+    child_left(n)  = child_left(q);
+    child_right(n) = child_right(q);
+    __atomic_store_n( &node_color(n), (char)( ( conc_color(q) & 7 )
+        | NODE_LOCK ), __ATOMIC_RELAXED );
+    for( d = 0 ; d < 2 ; d++ )
+    {
+        if( !conc_is_data(q,d) )
+            continue;
+        x = child(q,d); /* to the last (d 0) or first (d 1) node */
+        lock_node(x);
+        while( conc_is_data(x,!d) )
+        {
+            y = child(x,!d);
+            lock_node(y);
+            unlock_node(x);
+            x = y;
+        }
+        child(x,!d) = n;
+        unlock_node(x);
+    }
+    if( p )
+        child(p,dir) = n;
+    else
+        rbt->root = n;
+    set_replaced(q);
+}
+
+/*********************************************************************
+* int rbti_conc_reserve(...)
+* Reserve room for one more node to retire (see rbti_conc_retire).
+* Return: RBT_RC_OK(0), RBT_RC_ERROR(-1): no memory
+*********************************************************************/
+
+int rbti_conc_reserve(
+    RBT    * rbt)
+{
+    RBTCONC     * c;
+    RBTIRETIRED * r;
+    size_t        max;
+    int           rc;
+
+    c = rbt->conc;
+    rc = RBT_RC_OK;
+    rbti_lock( &c->retire_lock );
+    if( c->n_retired + c->reserved == c->max_retired )
+    {
+        max = c->max_retired ? c->max_retired * 2 : 64;
+        r = (RBTIRETIRED*)realloc( c->retired, max * sizeof(RBTIRETIRED) );
+        if( r == NULL )
+            rc = RBT_RC_ERROR;
+        else
+        {
+            c->retired = r;
+            c->max_retired = max;
+        }
+    }
+    if( rc == RBT_RC_OK )
+        c->reserved++;
+    rbti_unlock( &c->retire_lock );
+    return rc;
+}
+
+/*********************************************************************
+* void rbti_conc_unreserve(...)
+* Give back room reserved by rbti_conc_reserve (no node to retire).
+*********************************************************************/
+
+void rbti_conc_unreserve(
+    RBT    * rbt)
+{
+    RBTCONC * c;
+
+    c = rbt->conc;
+    rbti_lock( &c->retire_lock );
+    c->reserved--;
+    rbti_unlock( &c->retire_lock );
+}
+
+/*********************************************************************
+* void rbti_conc_retire(...)
+* Keep a node just unlinked from the tree until no thread may have it,
+* in the room reserved for it by rbti_conc_reserve.
+*********************************************************************/
+
+void rbti_conc_retire(
+    RBT    * rbt,
+    void   * node)
+{
+    RBTCONC * c;
+
+    c = rbt->conc;
+    rbti_lock( &c->retire_lock );
+    c->reserved--;
+    c->retired[c->n_retired].node = node;
+    c->retired[c->n_retired].epoch = c->epoch;
+    __atomic_store_n( &c->n_retired, c->n_retired + 1, __ATOMIC_RELAXED );
+    rbti_unlock( &c->retire_lock );
+}
+
+/*********************************************************************
+* size_t rbti_conc_bytes(...)
+* Return: bytes of the concurrent mode: its struct, the list of retired
+*         nodes and the retired nodes not freed yet (0: mode off).
+*********************************************************************/
+
+size_t rbti_conc_bytes(
+    RBT    * rbt)
+{
+    RBTCONC * c;
+    size_t    bytes;
+
+    c = rbt->conc;
+    if( c == NULL )
+        return 0;
+    rbti_lock( &c->retire_lock );
+    bytes = sizeof(RBTCONC) + c->max_retired * sizeof(RBTIRETIRED)
+        + c->n_retired * rbt->def->node_size;
+    rbti_unlock( &c->retire_lock );
+    return bytes;
+}
+
+/*********************************************************************
+* int rbt_concurrent( RBT * rbt, int on )
+* Concurrent mode on/off. When on, rbt_insert, rbt_insert_keep,
+* rbt_insert_absent, rbt_upsert, rbt_delkey, rbt_delnode, rbt_erase,
+* rbt_get, rbt_get_finger, rbt_feq/leq/fge/fgt, rbt_first/next/last/
+* prev and rbt_size may be called from parallel threads, and
+* rbt_quiescent and rbt_concurrent_leave; no other function may be used
+* on the tree. A node replaced by rbt_insert_keep (returned with its
+* links) must not be freed before the mode is off. Turn it off when no
+* other thread uses the tree: the retired nodes are freed, and the
+* deleted nodes too, unless lazy delete is on (see rbt_lazy_delete).
+* Not for multiset trees, and not with a journal, a write buffer, size
+* limits or the relaxed balance mode; the hash index is dropped (and
+* rebuilt when the mode is turned off).
+* Return: RBT_RC_OK(0), RBT_RC_ERROR(-1)
+*********************************************************************/
+
+int rbt_concurrent(
+    RBT    * rbt,
+    int      on )
+{
+    RBTCONC * c;
+    size_t    i;
+
+    if( on )
+    {
+        if( rbt->conc )
+            return RBT_RC_OK;
+        if( is_multiset(rbt->def) || rbt->journal || rbt->delta
+            || rbt->cap || rbt->relax )
+            return RBT_RC_ERROR;
+        c = (RBTCONC*)calloc( 1, sizeof(RBTCONC) );
+        if( c == NULL )
+            return RBT_RC_ERROR;
+        rbti_hash_drop( rbt );
+        size_count(rbt);
+        rbt->conc = c;
+        return RBT_RC_OK;
+    }
+    c = rbt->conc;
+    if( c == NULL )
+        return RBT_RC_OK;
+    rbt->conc = NULL;
+    for( i = 0 ; i < c->n_retired ; i++ )
+        rbt->def->freeNode( c->retired[i].node );
+    free( c->retired );
+    free( c );
+    rbt->del_gen++;   /* the first/last cache, fingers etc. */
+    rbti_minmax( rbt );
+    if( !rbt->lazy && rbt->tombs )
+        rbt_purge( rbt, 0 );
+    if( rbt->def->keyHash && rbt->def->nodeHash )
+        rbt_hash_build( rbt ); /* dropped when turned on */
+    return RBT_RC_OK;
+}
+
+/*********************************************************************
+* void rbt_quiescent( RBT * rbt )
+* Concurrent mode: the calling thread holds no nodes of the tree (from
+* rbt_get, rbt_next etc.) now. Nodes deleted or replaced before are
+* freed when all threads that use the tree have been here since; call
+* it between operations (eg. per request or per batch) to keep the
+* memory bounded.
+*********************************************************************/
+
+void rbt_quiescent(
+    RBT    * rbt)
+{
+    RBTCONC  * c;
+    RBTISLOT * s;
+    unsigned long e;
+
+    c = rbt->conc;
+    if( c == NULL || ( s = find_slot( c, 1 ) ) == NULL )
+        return;
+    e = __atomic_load_n( &c->epoch, __ATOMIC_ACQUIRE );
+    if( s->seen != e )
+        __atomic_store_n( &s->seen, e, __ATOMIC_RELEASE );
+    else if( ++my_calls % QUIESCENT_FREE )
+        return;
+    if( __atomic_load_n( &c->n_retired, __ATOMIC_RELAXED ) )
+        free_retired( rbt );
+}
+
+/*********************************************************************
+* void rbt_concurrent_leave( RBT * rbt )
+* Concurrent mode: the calling thread holds no nodes of the tree, and
+* is done with it: its slot is free (until its next call), so it no
+* longer keeps retired nodes from being freed.
+*********************************************************************/
+
+void rbt_concurrent_leave(
+    RBT    * rbt)
+{
+    RBTCONC  * c;
+    RBTISLOT * s;
+
+    c = rbt->conc;
+    if( c == NULL || ( s = find_slot( c, 0 ) ) == NULL )
+        return;
+    rbti_lock( &c->retire_lock );
+    s->id = NULL;
+    rbti_unlock( &c->retire_lock );
+    my_conc = NULL;
+    free_retired( rbt );
+}
+
+/***[end-of-file]****************************************************/
+/********************************************************************/
@@ -16,10 +16,34 @@
 *   int rbt_delnode     ( RBT * rbt, void * node )
 *   int rbt_delnode_keep( RBT * rbt, void * node, void ** old_node )
 *
+* delete by node pointer (no compares):
+*
+*   int rbt_erase       ( RBT * rbt, void * node, void ** next )
+*   int rbt_erase_keep  ( RBT * rbt, void * node, void ** next )
+*
+* lazy delete (tombstones):
+*
+*   int    rbt_lazy_delete( RBT * rbt, int on, size_t max_tombs )
+*   size_t rbt_purge      ( RBT * rbt, size_t max )
+*
+* delete first/last (priority queue):
+*
+*   void * rbt_pop_first( RBT * rbt )
+*   void * rbt_pop_last ( RBT * rbt )
+*   size_t rbt_pop_until( RBT * rbt, int (*cmp)(void*,void*), void * key,
+*                         void ** out, size_t max )
+*
+* delete by range:
+*
+*   int rbt_del_range( RBT * rbt, int (*lo_cmp)(void*,void*), void * lo,
+*                      int (*hi_cmp)(void*,void*), void * hi,
+*                      void ** keep_list )
+*
 **********************************************************************
 * Copyright (c) 2020 Michael Walsh Pedersen
 *********************************************************************/
 
+#include <stdlib.h>
 #include "rbt.h"
 #include "rbt_internal.h"
 
@@ -35,6 +59,11 @@
 #define DELMODE_SEARCH   0
 #define DELMODE_GO_LEFT  1
 #define DELMODE_GO_RIGHT 2
+#define DELMODE_PATH     3
+
+#define MAX_PATH         128  /* > max height of any tree */
+
+#define PURGE_REBUILD    8    /* rebuild if > 1/8 of the nodes are tombs */
 
 /*********************************************************************
 *
@@ -46,6 +75,10 @@ typedef struct {
     void     * old_node;
     int        delmode;
     int        ajust_thread;
+    int        by_addr;    /* multiset: equal nodes by address */
+    signed char path[MAX_PATH]; /* DELMODE_PATH: 1: left, -1: right */
+    int        depth;      /*   (path[depth-1] is the root step) */
+    int        purge;      /* rbt_purge: node is a tombstone */
     RBT      * rbt;
 } VAR;
 
@@ -58,6 +91,7 @@ static int find_unlink_fix( RBTDEF * def, VAR * var, void**p );
 
 static int balance_black_left(
     RBTDEF    * def,
+    VAR       * var,
     void     ** p)
 {
     /* child_left(*p) is one level black short */
@@ -75,6 +109,8 @@ static int balance_black_left(
         child_left(s) = (*p);
         (*p) = s;
         /* left rotate done. */
+        stat_inc(var->rbt, rotations);
+        stat_inc(var->rbt, recolors);
         /* change p ! */
         p = &child_left(*p);
         s = child_right(*p);
@@ -85,6 +121,7 @@ static int balance_black_left(
     {
         if( is_left_thrd(s) || is_black(child_left(s)) )
         {
+            stat_inc(var->rbt, recolors);
             if( is_black(*p) ) /**/
             {
                 set_red(s);
@@ -115,6 +152,8 @@ static int balance_black_left(
         set_black(c);
         child_right(*p) = s = c;    /* c is now out of scope ! */
         /* right rotate done. */
+        stat_inc(var->rbt, rotations);
+        stat_inc(var->rbt, recolors);
     }
 
     /* REMOVAL Case 6. */
@@ -136,6 +175,8 @@ static int balance_black_left(
     child_left(s) = (*p);
     (*p) = s;
     /* left rotate done. */
+    stat_inc(var->rbt, rotations);
+    stat_inc(var->rbt, recolors);
     return 0; /* COMPLETED */
 }
 
@@ -146,6 +187,7 @@ static int balance_black_left(
 
 static int balance_black_right(
     RBTDEF    * def,
+    VAR       * var,
     void     ** p)
 {
     /* child_right(*p) is one level black short */
@@ -163,6 +205,8 @@ static int balance_black_right(
         child_right(s) = (*p);
         (*p) = s;
         /* right rotate done. */
+        stat_inc(var->rbt, rotations);
+        stat_inc(var->rbt, recolors);
         /* change p ! */
         p = &child_right(*p);
         s = child_left(*p);
@@ -173,6 +217,7 @@ static int balance_black_right(
     {
         if( is_right_thrd(s) || is_black(child_right(s)) )
         {
+            stat_inc(var->rbt, recolors);
             if( is_black(*p) ) /**/
             {
                 set_red(s);
@@ -203,6 +248,8 @@ static int balance_black_right(
         set_black(c);
         child_left(*p) = s = c;    /* c is now out of scope ! */
         /* left rotate done. */
+        stat_inc(var->rbt, rotations);
+        stat_inc(var->rbt, recolors);
     }
 
     /* REMOVAL Case 6. */
@@ -224,6 +271,8 @@ static int balance_black_right(
     child_right(s) = (*p);
     (*p) = s;
     /* right rotate done. */
+    stat_inc(var->rbt, rotations);
+    stat_inc(var->rbt, recolors);
     return 0; /* COMPLETED */
 }
 
@@ -259,7 +308,7 @@ static int unlink_from_tree(
     int    action;
     void * a; /* RBT_NODE */
 
-    switch( node_color(*p) ) /**/
+    switch( node_links(*p) ) /**/
     {
     case 0: /* black, no kid */
         var->old_node = (*p);
@@ -299,18 +348,18 @@ static int unlink_from_tree(
             *p = child_right(*p);
 
             child_left(*p) = child_left(var->old_node);
-            node_color(*p) = node_color(var->old_node) ;
+            node_color(*p) = node_links(var->old_node) | ( node_color(*p) & 8 );
             set_right_thrd(*p);
             child_right(prev_node( def,  *p )) = *p; /* thread ptr */
 
-            return balance_black_right( def, p ) ?
+            return balance_black_right( def, var, p ) ?
                 A_D_MIS_ONE_BLACK_LEVEL : A_D_DELETE_COMPLETED;
         case A_D_RED_NO_KID:
             var->old_node = (*p);
             *p = child_right(*p);
 
             child_left(*p) = child_left(var->old_node);
-            node_color(*p) = node_color(var->old_node);
+            node_color(*p) = node_links(var->old_node) | ( node_color(*p) & 8 );
             set_right_thrd(*p);
             child_right(prev_node( def,  *p )) = *p; /* thread ptr */
 
@@ -322,7 +371,7 @@ static int unlink_from_tree(
 
             child_left(*p)  = child_left(var->old_node);
             child_right(*p) = child_right(var->old_node);
-            node_color(*p)  = node_color(var->old_node);
+            node_color(*p)  = node_links(var->old_node) | ( node_color(*p) & 8 );
             child_right(prev_node( def,  *p )) = *p; /* thread ptr */
 
             return A_D_DELETE_COMPLETED;
@@ -333,10 +382,10 @@ static int unlink_from_tree(
 
             child_left(*p)  = child_left(var->old_node);
             child_right(*p) = child_right(var->old_node);
-            node_color(*p)  = node_color(var->old_node);
+            node_color(*p)  = node_links(var->old_node) | ( node_color(*p) & 8 );
             child_right(prev_node( def,  *p )) = *p; /* thread ptr */
 
-            return balance_black_right( def, p ) ?
+            return balance_black_right( def, var, p ) ?
                 A_D_MIS_ONE_BLACK_LEVEL : A_D_DELETE_COMPLETED;
         }
         return A_D_INVALID_TREE;
@@ -363,10 +412,20 @@ static int find_unlink_fix(
     int action;
 
     rc = 0;
+    stat_inc(var->rbt, visits);
     switch( var->delmode )
     {
     case DELMODE_SEARCH:
-        rc = var->deleteCmp( *p, var->node_arg );
+#ifdef RBT_STATS
+        if( var->deleteCmp == def->keyCmp )
+            stat_inc(var->rbt, key_cmp);
+        else
+            stat_inc(var->rbt, node_cmp);
+#endif
+        rc = rbti_cmp( def, var->deleteCmp, *p, var->node_arg );
+        if( rc == 0 && var->by_addr )
+            rc = (char*)*p < (char*)var->node_arg ? -1
+                : (char*)*p > (char*)var->node_arg;
         break;
     case DELMODE_GO_LEFT:
         rc = is_left_thrd(*p) ? 0 : 1;
@@ -374,6 +433,9 @@ static int find_unlink_fix(
     case DELMODE_GO_RIGHT:
         rc = is_right_thrd(*p) ? 0 : -1;
         break;
+    case DELMODE_PATH:
+        rc = var->depth ? var->path[--var->depth] : 0;
+        break;
     }
     if( rc == 0 ) /* node found - delete it; */
     {
@@ -401,10 +463,10 @@ static int find_unlink_fix(
                 child_left(*p) = child_left(child_left(*p)); /* thread ptr */
             set_left_thrd(*p);
             /* we are starting on case 2 now ... */
-            return balance_black_left( def, p ) ?
+            return balance_black_left( def, var, p ) ?
                 A_D_MIS_ONE_BLACK_LEVEL : A_D_DELETE_COMPLETED;
         case A_D_MIS_ONE_BLACK_LEVEL:
-            return balance_black_left( def, p ) ?
+            return balance_black_left( def, var, p ) ?
                 A_D_MIS_ONE_BLACK_LEVEL : A_D_DELETE_COMPLETED;
         }
     }
@@ -430,10 +492,10 @@ static int find_unlink_fix(
                 child_right(*p) = child_right(child_right(*p)); /* thread ptr */
             set_right_thrd(*p);
             /* we are starting on case 2 now ... */
-            return balance_black_right( def, p ) ?
+            return balance_black_right( def, var, p ) ?
                 A_D_MIS_ONE_BLACK_LEVEL : A_D_DELETE_COMPLETED;
         case A_D_MIS_ONE_BLACK_LEVEL:
-            return balance_black_right( def, p ) ?
+            return balance_black_right( def, var, p ) ?
                 A_D_MIS_ONE_BLACK_LEVEL : A_D_DELETE_COMPLETED;
         }
     }
@@ -441,28 +503,92 @@ static int find_unlink_fix(
 }
 
 /*********************************************************************
-* static int delete_node(...)
+* static void * find_node(...)
+* Return: node equal to node_arg (by deleteCmp), or NULL.
+*********************************************************************/
+
+static void * find_node(
+    RBTDEF    * def,
+    VAR       * var)
+{
+    void * n;
+    int    rc;
+
+    for( n = var->rbt->root ; ; )
+    {
+        stat_inc(var->rbt, visits);
+        rc = rbti_cmp( def, var->deleteCmp, n, var->node_arg );
+        if( rc == 0 )
+            return n;
+        if( rc > 0 ? is_left_thrd(n) : is_right_thrd(n) )
+            return NULL;
+        n = rc > 0 ? child_left(n) : child_right(n);
+    }
+}
+
+/*********************************************************************
+* static int mark_deleted(...)
+* Lazy delete: node stays in the tree as a tombstone.
+* Return: RBT_RC_OK(0)
+*********************************************************************/
+
+static int mark_deleted(
+    RBTDEF    * def,
+    RBT       * rbt,
+    void      * node)
+{
+    set_tomb(node);
+    rbt->size--;
+    rbt->tombs++;
+    if( rbt->hash )
+        rbti_hash_delete( rbt, node );
+    if( rbt->journal )
+        rbti_journal( rbt, RBTI_J_DELETE, node );
+    if( rbt->max_tombs && rbt->tombs > rbt->max_tombs )
+        rbt_purge( rbt, 0 );
+    return RBT_RC_OK;
+}
+
+/*********************************************************************
+* static int delete_tree(...)
 * Return: RBT_RC_OK(0), RBT_RC_NOTFOUND(1), RBT_RC_ERROR(-1)
 *********************************************************************/
 
-static int delete_node(
+static int delete_tree(
     RBTDEF    * def,
     VAR       * var,
     void      * node,
     void     ** old_node)
 {
-    int action;
+    int    action;
+    void * n;
 
     if( old_node )
         *old_node = NULL;
     if( node == NULL )
         return RBT_RC_ERROR;
     if( var->rbt->root == NULL )
+    {
+        stat_inc(var->rbt, del_notfound);
         return RBT_RC_NOTFOUND; /* notfound */
+    }
+    if( var->delmode == DELMODE_SEARCH
+        && ( var->rbt->tombs || lazy_delete(var->rbt) ) )
+    {
+        var->node_arg = node;
+        n = find_node( def, var );
+        if( n == NULL || is_tomb(n) )
+        {
+            stat_inc(var->rbt, del_notfound);
+            return RBT_RC_NOTFOUND; /* notfound (or deleted) */
+        }
+        if( lazy_delete(var->rbt) && old_node == NULL )
+            return mark_deleted( def, var->rbt, n );
+    }
+    relax_fix(var->rbt); /* the delete rebalances */
 
     var->old_node = NULL;
     var->node_arg = node;
-    var->delmode = DELMODE_SEARCH;
     var->ajust_thread = 1;
 
     action = find_unlink_fix( def, var, &var->rbt->root );
@@ -470,6 +596,7 @@ static int delete_node(
     switch (action)
     {
     case A_D_NODE_NOT_FOUND:
+        stat_inc(var->rbt, del_notfound);
         return RBT_RC_NOTFOUND; /* notfound */
     case A_D_INVALID_TREE:
         return RBT_RC_ERROR; /* error */
@@ -484,7 +611,26 @@ static int delete_node(
         break;
     }
     /* action is A_D_DELETE_COMPLETED */
-    var->rbt->size--;
+    if( var->rbt->minmax_gen == var->rbt->del_gen )
+    {   /* the first (last) node has no left (right) child */
+        if( var->old_node == var->rbt->first )
+            var->rbt->first = child_right(var->old_node);
+        if( var->old_node == var->rbt->last )
+            var->rbt->last = child_left(var->old_node);
+        var->rbt->minmax_gen++;
+    }
+    var->rbt->del_gen++;
+    cap_sub(var->rbt, var->old_node);
+    if( var->purge ) /* size, hash and journal done by mark_deleted */
+        var->rbt->tombs--;
+    else
+    {
+        var->rbt->size--;
+        if( var->rbt->hash )
+            rbti_hash_delete( var->rbt, var->old_node );
+        if( var->rbt->journal )
+            rbti_journal( var->rbt, RBTI_J_DELETE, var->old_node );
+    }
 
     if( old_node )
     {
@@ -503,6 +649,313 @@ static int delete_node(
     return RBT_RC_OK; /* ok */
 }
 
+/*********************************************************************
+* static int mark_concurrent(...)
+* Concurrent mode with lazy delete: find the node by cmp with
+* hand-over-hand locks, and mark it deleted (a tombstone). If node is
+* not NULL, it is this very node.
+* Return: RBT_RC_OK(0), RBT_RC_NOTFOUND(1)
+*********************************************************************/
+
+static int mark_concurrent(
+    RBT       * rbt,
+    int      (*cmp)(void*,void*),
+    void      * key,
+    void      * node)
+{
+    RBTDEF * def;
+    void   * n, * c;
+    int      rc;
+
+    def = rbt->def;
+    rbti_conc_join( rbt );
+    n = node;
+    if( n )
+        lock_node(n);
+    else
+    {
+        rbti_lock( &rbt->conc->root_lock );
+        n = rbt->root;
+        if( n )
+            lock_node(n);
+        rbti_unlock( &rbt->conc->root_lock );
+        while( n && ( rc = rbti_cmp( def, cmp, n, key ) ) != 0 )
+        {
+            c = NULL;
+            if( conc_is_data(n,rc < 0) )
+            {
+                c = rc > 0 ? child_left(n) : child_right(n);
+                lock_node(c);
+            }
+            unlock_node(n);
+            n = c;
+        }
+        if( n == NULL )
+            return RBT_RC_NOTFOUND;
+    }
+    rc = RBT_RC_NOTFOUND;
+    if( !conc_is_tomb(n) && !is_replaced(n) )
+    {
+        conc_set_tomb(n);
+        __atomic_sub_fetch( &rbt->size, 1, __ATOMIC_RELAXED );
+        __atomic_add_fetch( &rbt->tombs, 1, __ATOMIC_RELAXED );
+        rc = RBT_RC_OK;
+    }
+    unlock_node(n);
+    return rc;
+}
+
+/*********************************************************************
+* static int keep_held(...)
+* Unlock the nodes in held, but a, b, c, d and e (NULL: none).
+* Return: count of nodes still held (now first in held).
+*********************************************************************/
+
+static int keep_held(
+    RBTDEF    * def,
+    void     ** held,
+    int         n_held,
+    void      * a,
+    void      * b,
+    void      * c,
+    void      * d,
+    void      * e)
+{
+    void * x;
+    int    i, k;
+
+    for( i = k = 0 ; i < n_held ; i++ )
+    {
+        x = held[i];
+        if( x == a || x == b || x == c || x == d || x == e )
+            held[k++] = x;
+        else
+            unlock_node(x);
+    }
+    return k;
+}
+
+/*********************************************************************
+* static int delete_concurrent(...)
+* Concurrent mode (see rbt_concurrent.c): delete by cmp in one top-down
+* pass, with hand-over-hand locks (lazy delete: see mark_concurrent).
+* A red node is pushed down on the way, by a rotation at q or p or a
+* color flip, so the last node q on the path (the predecessor of the
+* found node f, or f) is a red leaf, or the only node, and is just
+* unlinked; then q takes the place of f. Locked are the grandparent g,
+* parent p and node q (head: the root lock, while g is not known or f
+* is the root), f and its parent fp, and the nodes of a rotation. If
+* node is not NULL, it is this very node. f is kept until no thread
+* may have it (see rbti_conc_retire).
+* Return: RBT_RC_OK(0), RBT_RC_NOTFOUND(1), RBT_RC_ERROR(-1): no memory
+*********************************************************************/
+
+#define HELD_MAX 8  /* g, p, q, f, fp, sibling and its child, next q */
+
+static int delete_concurrent(
+    RBT       * rbt,
+    int      (*cmp)(void*,void*),
+    void      * key,
+    void      * node)
+{
+    RBTDEF * def;
+    void   * held[HELD_MAX];
+    void   * g, * p, * q, * f, * fp, * s, * c, * top;
+    int      n_held, head, dir, last, dir2, rc;
+
+    def = rbt->def;
+    if( rbt->lazy )
+        return mark_concurrent( rbt, cmp, key, node );
+    rbti_conc_join( rbt );
+    if( rbti_conc_reserve( rbt ) != RBT_RC_OK )
+        return RBT_RC_ERROR;
+    rbti_lock( &rbt->conc->root_lock );
+    head = 1;
+    n_held = 0;
+    g = p = f = fp = NULL;
+    dir = last = 0;
+    q = rbt->root;
+    if( q )
+    {
+        lock_node(q);
+        held[n_held++] = q;
+    }
+    while( q )
+    {
+        rc = rbti_cmp( def, cmp, q, key );
+        if( rc == 0 )
+        {
+            f = q;
+            fp = p;
+        }
+        dir = rc < 0; /* equal: on to the predecessor */
+        if( conc_is_black(q) && !conc_red_child(q,dir) ) /* push red down */
+        {
+            if( conc_red_child(q,!dir) ) /* rotate it up over q */
+            {
+                c = child(q,!dir);
+                lock_node(c);
+                held[n_held++] = c;
+                rbti_rotate_conc( def, q, dir );
+                if( p )
+                    child(p,last) = c;
+                else
+                    rbt->root = c;
+                if( f == q )
+                    fp = c;
+                p = c;
+            }
+            else if( p && conc_is_data(p,!last) ) /* by the sibling s of q */
+            {
+                s = child(p,!last);
+                lock_node(s);
+                held[n_held++] = s;
+                if( !conc_red_child(s,0) && !conc_red_child(s,1) ) /* flip */
+                {
+                    conc_set_black(p);
+                    conc_set_red(s);
+                    conc_set_red(q);
+                }
+                else /* rotate s, or its red child c, up over p */
+                {
+                    dir2 = g && conc_is_data(g,1) && child_right(g) == p;
+                    c = child(s, conc_red_child(s,last) ? last : !last);
+                    lock_node(c);
+                    held[n_held++] = c;
+                    if( c == child(s,last) )
+                        child(p,!last) = rbti_rotate_conc( def, s, !last );
+                    top = rbti_rotate_conc( def, p, last );
+                    if( g )
+                        child(g,dir2) = top;
+                    else
+                        rbt->root = top;
+                    conc_set_red(q);
+                    conc_set_black(child_left(top));
+                    conc_set_black(child_right(top));
+                    if( g ) /* the root stays black */
+                        conc_set_red(top);
+                    if( f == p )
+                        fp = top;
+                }
+            }
+        }
+        if( !conc_is_data(q,dir) )
+            break;
+
+        /* one level down, release the nodes above the window */
+        last = dir;
+        g = p;
+        p = q;
+        q = child(q,dir);
+        lock_node(q);
+        held[n_held++] = q;
+        n_held = keep_held( def, held, n_held, g, p, q, f, fp );
+        if( head && g && ( f == NULL || fp ) )
+        {
+            rbti_unlock( &rbt->conc->root_lock );
+            head = 0;
+        }
+    }
+
+    rc = RBT_RC_NOTFOUND;
+    if( f && ( node == NULL || f == node ) )
+    {
+        if( p ) /* unlink the leaf q */
+        {
+            dir2 = conc_is_data(p,1) && child_right(p) == q;
+            child(p,dir2) = child(q,dir2);
+            conc_set_thrd(p,dir2);
+        }
+        else
+            rbt->root = NULL;
+        if( f != q ) /* q takes the place of f */
+        {
+            n_held = keep_held( def, held, n_held, f, fp, q, NULL, NULL );
+            dir2 = fp && conc_is_data(fp,1) && child_right(fp) == f;
+            rbti_conc_replace( def, rbt, fp, dir2, f, q );
+        }
+        else
+            set_replaced(q);
+        if( conc_is_tomb(f) ) /* was deleted */
+            __atomic_sub_fetch( &rbt->tombs, 1, __ATOMIC_RELAXED );
+        else
+        {
+            __atomic_sub_fetch( &rbt->size, 1, __ATOMIC_RELAXED );
+            rc = RBT_RC_OK;
+        }
+        rbti_conc_retire( rbt, f );
+    }
+    else
+        rbti_conc_unreserve( rbt );
+
+    /* release the window */
+    while( n_held )
+        unlock_node(held[--n_held]);
+    if( head )
+        rbti_unlock( &rbt->conc->root_lock );
+    return rc;
+}
+
+/*********************************************************************
+* static int delete_node(...)
+* Delete from the tree, and from its write buffer (see rbt_buffer):
+* the node in the buffer is the newest one, a node in the tree with
+* its key was replaced by it. The buffered node is only marked as a
+* tombstone, which hides the node in the tree until the merge deletes
+* it there; the _keep functions delete in both trees at once.
+* Return: RBT_RC_OK(0), RBT_RC_NOTFOUND(1), RBT_RC_ERROR(-1)
+*********************************************************************/
+
+static int delete_node(
+    RBTDEF    * def,
+    VAR       * var,
+    void      * node,
+    void     ** old_node)
+{
+    RBT  * rbt;
+    void * d;
+    int    rc;
+
+    rbt = var->rbt;
+    if( rbt->conc ) /* not the _keep functions */
+        return old_node ? RBT_RC_ERROR
+            : delete_concurrent( rbt, var->deleteCmp, node, NULL );
+    if( !delta_used(rbt) || var->delmode != DELMODE_SEARCH )
+        return delete_tree( def, var, node, old_node );
+    var->rbt = rbt->delta;
+    var->node_arg = node;
+    d = find_node( def, var );
+    var->rbt = rbt;
+    if( d == NULL )
+        return delete_tree( def, var, node, old_node );
+    if( is_tomb(d) ) /* deleted in the buffer */
+    {
+        if( old_node )
+            *old_node = NULL;
+        stat_inc(rbt, del_notfound);
+        return RBT_RC_NOTFOUND;
+    }
+    if( old_node == NULL )
+    {
+        mark_deleted( def, rbt->delta, d );
+        if( rbt->journal )
+            rbti_journal( rbt, RBTI_J_DELETE, d );
+        return RBT_RC_OK;
+    }
+    var->rbt = rbt->delta;
+    rc = delete_tree( def, var, node, &d );
+    var->rbt = rbt;
+    if( rc == RBT_RC_ERROR )
+        return rc;
+    rc = delete_tree( def, var, node, NULL );
+    if( rc == RBT_RC_ERROR )
+        return rc;
+    if( rc == RBT_RC_NOTFOUND && rbt->journal )
+        rbti_journal( rbt, RBTI_J_DELETE, d );
+    *old_node = d;
+    return RBT_RC_OK;
+}
+
 /*********************************************************************
 * int rbt_delkey      ( RBT * rbt, void * key )
 * Delete by key.
@@ -514,9 +967,17 @@ int rbt_delkey(
     void      * key )
 {
     VAR Var;
+    int rc;
+
+    lat_begin();
     Var.deleteCmp = rbt->def->keyCmp; /* delete by key */
+    Var.by_addr = 0;
+    Var.delmode = DELMODE_SEARCH;
+    Var.purge = 0;
     Var.rbt = rbt;
-    return delete_node( rbt->def, &Var, key, NULL );
+    rc = delete_node( rbt->def, &Var, key, NULL );
+    lat_end( RBT_LAT_DELETE );
+    return rc;
 }
 
 /*********************************************************************
@@ -531,14 +992,22 @@ int rbt_delkey_keep(
     void     ** old_node )
 {
     VAR Var;
+    int rc;
+
+    lat_begin();
     Var.deleteCmp = rbt->def->keyCmp; /* delete by key */
+    Var.by_addr = 0;
+    Var.delmode = DELMODE_SEARCH;
+    Var.purge = 0;
     Var.rbt = rbt;
-    return delete_node( rbt->def, &Var, key, old_node );
+    rc = delete_node( rbt->def, &Var, key, old_node );
+    lat_end( RBT_LAT_DELETE );
+    return rc;
 }
 
 /*********************************************************************
 * int rbt_delnode     ( RBT * rbt, void * node )
-* Delete by node.
+* Delete by node (multiset mode: this very node).
 * Return: RBT_RC_OK(0), RBT_RC_NOTFOUND(1), RBT_RC_ERROR(-1)
 *********************************************************************/
 
@@ -547,9 +1016,17 @@ int rbt_delnode(
     void      * node )
 {
     VAR Var;
+    int rc;
+
+    lat_begin();
     Var.deleteCmp = rbt->def->nodeCmp; /* delete by node */
+    Var.by_addr = is_multiset(rbt->def);
+    Var.delmode = DELMODE_SEARCH;
+    Var.purge = 0;
     Var.rbt = rbt;
-    return delete_node( rbt->def, &Var, node, NULL );
+    rc = delete_node( rbt->def, &Var, node, NULL );
+    lat_end( RBT_LAT_DELETE );
+    return rc;
 }
 
 /*********************************************************************
@@ -564,9 +1041,560 @@ int rbt_delnode_keep(
     void     ** old_node )
 {
     VAR Var;
+    int rc;
+
+    lat_begin();
     Var.deleteCmp = rbt->def->nodeCmp; /* delete by node */
+    Var.by_addr = is_multiset(rbt->def);
+    Var.delmode = DELMODE_SEARCH;
+    Var.purge = 0;
+    Var.rbt = rbt;
+    rc = delete_node( rbt->def, &Var, node, old_node );
+    lat_end( RBT_LAT_DELETE );
+    return rc;
+}
+
+/*********************************************************************
+* static int node_path(...)
+* Find the path from the root to node by climbing the threads, without
+* any compares: the parent of a subtree x is the node the left thread
+* of its first node or the right thread of its last node points to.
+* Finding the first or last node walks down the spine of x, so the
+* climb visits O(log^2 n) nodes (there are no parent pointers to keep
+* a stack of). The path is stored in var->path (from node up to the
+* root).
+* Return: RBT_RC_OK(0), RBT_RC_NOTFOUND(1): node is not in the tree
+*********************************************************************/
+
+static int node_path(
+    RBTDEF    * def,
+    VAR       * var,
+    void      * node)
+{
+    void * x;
+    void * lo, * hi;   /* left thread of first, right thread of last */
+    int    lo_ok, hi_ok;
+
+    x = node;
+    lo = hi = NULL;
+    lo_ok = hi_ok = 0;
+    var->depth = 0;
+    while( x != var->rbt->root )
+    {
+        if( var->depth == MAX_PATH )
+            return RBT_RC_NOTFOUND;
+        stat_inc(var->rbt, visits);
+        if( lo_ok && lo && is_right_data(lo) && child_right(lo) == x )
+        {
+            /* x is a right child, the last node stays the same */
+            var->path[var->depth++] = -1;
+            x = lo;
+            lo_ok = 0;
+        }
+        else if( hi_ok && hi && is_left_data(hi) && child_left(hi) == x )
+        {
+            /* x is a left child, the first node stays the same */
+            var->path[var->depth++] = 1;
+            x = hi;
+            hi_ok = 0;
+        }
+        else if( !lo_ok )
+        {
+            lo = child_left(rbti_min( def, x ));
+            lo_ok = 1;
+        }
+        else if( !hi_ok )
+        {
+            hi = child_right(rbti_max( def, x ));
+            hi_ok = 1;
+        }
+        else
+            return RBT_RC_NOTFOUND;
+    }
+    return RBT_RC_OK;
+}
+
+/*********************************************************************
+* static int erase_node(...)
+* purge: node is a tombstone to remove, next may be a tombstone.
+* Return: RBT_RC_OK(0), RBT_RC_NOTFOUND(1), RBT_RC_ERROR(-1)
+*********************************************************************/
+
+static int erase_node(
+    RBT       * rbt,
+    void      * node,
+    void     ** next,
+    void     ** old_node,
+    int         purge)
+{
+    RBTDEF * def;
+    VAR      Var;
+    void   * n;
+    int      rc;
+
+    def = rbt->def;
+    if( next )
+        *next = NULL;
+    if( old_node )
+        *old_node = NULL;
+    if( node == NULL )
+        return RBT_RC_ERROR;
+    if( rbt->conc ) /* not rbt_erase_keep */
+    {
+        if( old_node || purge )
+            return RBT_RC_ERROR;
+        rc = delete_concurrent( rbt, def->nodeCmp, node, node );
+        if( next && rc == RBT_RC_OK )
+            *next = rbt_next( rbt, node );
+        return rc;
+    }
+    if( !purge )
+        delta_merge(rbt);
+    if( old_node || purge || !lazy_delete(rbt) )
+        relax_fix(rbt); /* before node_path: the delete rebalances */
+    Var.rbt = rbt;
+    if( rbt->root == NULL || is_tomb(node) != purge
+        || node_path( def, &Var, node ) != RBT_RC_OK )
+    {
+        stat_inc(rbt, del_notfound);
+        return RBT_RC_NOTFOUND; /* notfound */
+    }
+    /* the successor is moved, but not changed, by the delete */
+    n = rbti_next( def, node );
+    if( !purge && rbt->tombs )
+        while( n && is_tomb(n) )
+            n = rbti_next( def, n );
+    if( lazy_delete(rbt) && old_node == NULL && !purge )
+    {
+        mark_deleted( def, rbt, node );
+        if( next )
+            *next = n;
+        return RBT_RC_OK;
+    }
+    Var.deleteCmp = NULL;
+    Var.by_addr = 0;
+    Var.delmode = DELMODE_PATH;
+    Var.purge = purge;
+    if( delete_node( def, &Var, node, old_node ) != RBT_RC_OK )
+        return RBT_RC_ERROR;
+    if( next )
+        *next = n;
+    return RBT_RC_OK;
+}
+
+/*********************************************************************
+* int rbt_erase       ( RBT * rbt, void * node, void ** next )
+* Delete this very node (which must be in rbt, or in no tree), found
+* by the threads and not by nodeCmp. The node is freed, and *next (if
+* not NULL) is set to its successor, to continue an iteration.
+* Return: RBT_RC_OK(0), RBT_RC_NOTFOUND(1), RBT_RC_ERROR(-1)
+*********************************************************************/
+
+int rbt_erase(
+    RBT       * rbt,
+    void      * node,
+    void     ** next )
+{
+    int rc;
+
+    lat_begin();
+    rc = erase_node( rbt, node, next, NULL, 0 );
+    lat_end( RBT_LAT_DELETE );
+    return rc;
+}
+
+/*********************************************************************
+* int rbt_erase_keep  ( RBT * rbt, void * node, void ** next )
+* As rbt_erase, but the node is not freed (eg. to erase a node from
+* all its trees before freeing it).
+* Return: RBT_RC_OK(0), RBT_RC_NOTFOUND(1), RBT_RC_ERROR(-1)
+*********************************************************************/
+
+int rbt_erase_keep(
+    RBT       * rbt,
+    void      * node,
+    void     ** next )
+{
+    void * old_node;
+    int    rc;
+
+    lat_begin();
+    rc = erase_node( rbt, node, next, &old_node, 0 );
+    lat_end( RBT_LAT_DELETE );
+    return rc;
+}
+
+/*********************************************************************
+* static void * pop_node(...)
+* Delete the first (DELMODE_GO_LEFT) or last (DELMODE_GO_RIGHT) node,
+* found without compares. Tombstones on the way are freed.
+* Return: deleted node or NULL (tree is empty)
+*********************************************************************/
+
+static void * pop_node(
+    RBT       * rbt,
+    int         delmode)
+{
+    VAR    Var;
+    void * n;
+    void * old_node;
+
+    delta_merge(rbt);
+    rbti_minmax( rbt );
+    Var.deleteCmp = NULL;
+    Var.by_addr = 0;
     Var.rbt = rbt;
-    return delete_node( rbt->def, &Var, node, old_node );
+    old_node = NULL;
+    while( old_node == NULL )
+    {
+        n = delmode == DELMODE_GO_LEFT ? rbt->first : rbt->last;
+        if( n == NULL )
+            break;
+        Var.delmode = delmode;
+        Var.purge = is_tomb_node( rbt, n );
+        if( delete_tree( rbt->def, &Var, n,
+            Var.purge ? NULL : &old_node ) != RBT_RC_OK )
+            break;
+    }
+    return old_node;
+}
+
+/*********************************************************************
+* void * rbt_pop_first( RBT * rbt )
+* Delete the first node, in O(log n) without compares (the first node
+* is cached in the RBT), and keep it (eg. the next timer to expire).
+* Return: the deleted node, or NULL if the tree is empty.
+*********************************************************************/
+
+void * rbt_pop_first(
+    RBT       * rbt )
+{
+    void * n;
+
+    lat_begin();
+    n = pop_node( rbt, DELMODE_GO_LEFT );
+    lat_end( RBT_LAT_DELETE );
+    return n;
+}
+
+/*********************************************************************
+* void * rbt_pop_last( RBT * rbt )
+* As rbt_pop_first, for the last node.
+* Return: the deleted node, or NULL if the tree is empty.
+*********************************************************************/
+
+void * rbt_pop_last(
+    RBT       * rbt )
+{
+    void * n;
+
+    lat_begin();
+    n = pop_node( rbt, DELMODE_GO_RIGHT );
+    lat_end( RBT_LAT_DELETE );
+    return n;
+}
+
+/*********************************************************************
+* size_t rbt_pop_until( RBT * rbt, int (*cmp)(void*,void*), void * key,
+*                       void ** out, size_t max )
+* Delete the first nodes with cmp(node,key) <= 0, max max nodes, and
+* keep them in out[] in ascending order (eg. all expired timers). The
+* nodes are cut off with one split, O(k + log n) for k nodes.
+* Return: count of nodes in out[]
+*********************************************************************/
+
+size_t rbt_pop_until(
+    RBT       * rbt,
+    int      (*cmp)(void*,void*),
+    void      * key,
+    void     ** out,
+    size_t      max )
+{
+    RBTDEF * def;
+    void   * n, * next, * stop, * last;
+    void   * l, * r;
+    int      bhl, bhr;
+    size_t   cnt;
+
+    def = rbt->def;
+    if( max == 0 || cmp == NULL || out == NULL )
+        return 0;
+    lat_begin();
+    delta_merge(rbt);
+    relax_fix(rbt);
+    rbti_minmax( rbt );
+
+    /* stop: first node not to pop */
+    cnt = 0;
+    for( stop = rbt->first ; stop ; stop = rbti_next( def, stop ) )
+    {
+        if( is_tomb(stop) ) /* lazy deleted */
+            continue;
+        if( cnt == max || rbti_cmp( def, cmp, stop, key ) > 0 )
+            break;
+        cnt++;
+    }
+    if( cnt == 0 )
+    {
+        lat_end( RBT_LAT_DELETE );
+        return 0;
+    }
+
+    /* cut the tree into l < stop <= r (multiset: also equal nodes) */
+    if( stop )
+    {
+        rbti_split( def, rbt->root, rbti_black_height( def, rbt->root ),
+            NULL, stop, 0, &l, &bhl, &r, &bhr, NULL );
+        child_left(rbti_min( def, r )) = NULL; /* thread ptr */
+        set_black(r);
+    }
+    else
+    {
+        l = rbt->root;
+        r = NULL;
+    }
+    rbt->root = r;
+
+    /* keep the nodes in l (and free the tombstones) */
+    cnt = 0;
+    last = rbti_max( def, l );
+    for( n = rbti_min( def, l ) ; n ; n = next )
+    {
+        next = n == last ? NULL : rbti_next( def, n );
+        cap_sub(rbt, n);
+        if( is_tomb(n) )
+        {
+            def->freeNode( n );
+            rbt->tombs--;
+            continue;
+        }
+        if( rbt->hash )
+            rbti_hash_delete( rbt, n );
+        if( rbt->journal )
+            rbti_journal( rbt, RBTI_J_DELETE, n );
+        child_left(n)  = NULL;
+        child_right(n) = NULL;
+        node_color(n)  = 0;
+        out[cnt++] = n;
+    }
+    rbt->size -= cnt;
+    rbt->del_gen++;
+    rbt->first = r ? rbti_min( def, r ) : NULL;
+    rbt->last = r ? rbt->last : NULL;
+    rbt->minmax_gen = rbt->del_gen;
+    lat_end( RBT_LAT_DELETE );
+    return cnt;
+}
+
+/*********************************************************************
+* int rbt_del_range( ... )
+* Delete all nodes with lo_cmp(node,lo) >= 0 and hi_cmp(node,hi) <= 0
+* (a NULL lo_cmp/hi_cmp means no lower/upper limit). The range is cut
+* out with two splits and one join, O(k + log n) for k nodes.
+* The deleted nodes are freed, or if keep_list is not NULL, returned
+* as a list in ascending order, linked by the right pointer.
+* Return: RBT_RC_OK(0), RBT_RC_NOTFOUND(1), RBT_RC_ERROR(-1)
+*********************************************************************/
+
+int rbt_del_range(
+    RBT       * rbt,
+    int      (*lo_cmp)(void*,void*),
+    void      * lo,
+    int      (*hi_cmp)(void*,void*),
+    void      * hi,
+    void     ** keep_list )
+{
+    RBTDEF * def;
+    void   * l, * m, * r;
+    void   * n, * next, * last, * tail;
+    int      bh, bhl, bhm, bhr;
+    size_t   cnt;
+
+    def = rbt->def;
+    if( keep_list )
+        *keep_list = NULL;
+    delta_merge(rbt);
+    relax_fix(rbt);
+    if( rbt->tombs )
+        rbt_purge( rbt, 0 );
+    if( rbt->root == NULL )
+    {
+        stat_inc(rbt, del_notfound);
+        return RBT_RC_NOTFOUND; /* notfound */
+    }
+
+    /* cut the tree into l < m < r */
+    bh = rbti_black_height( def, rbt->root );
+    l = NULL;
+    bhl = 0;
+    m = rbt->root;
+    bhm = bh;
+    if( lo_cmp )
+        rbti_split( def, m, bhm, lo_cmp, lo, 0,
+            &l, &bhl, &m, &bhm, NULL );
+    r = NULL;
+    bhr = 0;
+    if( hi_cmp )
+        rbti_split( def, m, bhm, hi_cmp, hi, 1,
+            &m, &bhm, &r, &bhr, NULL );
+
+    /* join l and r again */
+    rbt->del_gen++;
+    rbt->root = rbti_join2( def, l, bhl, r, bhr, &bh );
+    if( rbt->root )
+        set_black(rbt->root);
+    rbti_minmax( rbt );
+
+    /* free (or keep) the nodes in m */
+    cnt = 0;
+    last = rbti_max( def, m );
+    tail = NULL;
+    for( n = rbti_min( def, m ) ; n ; n = next )
+    {
+        if( n == last )
+            next = NULL;
+        else if( is_right_thrd(n) )
+            next = child_right(n);
+        else
+            next = rbti_min( def, child_right(n) );
+        cnt++;
+        cap_sub(rbt, n);
+        if( rbt->hash )
+            rbti_hash_delete( rbt, n );
+        if( rbt->journal )
+            rbti_journal( rbt, RBTI_J_DELETE, n );
+        if( keep_list )
+        {
+            child_left(n)  = NULL;
+            child_right(n) = NULL;
+            node_color(n)  = 0;
+            if( tail )
+                child_right(tail) = n;
+            else
+                *keep_list = n;
+            tail = n;
+        }
+        else
+            def->freeNode( n );
+    }
+    rbt->size -= cnt;
+    if( cnt == 0 )
+    {
+        stat_inc(rbt, del_notfound);
+        return RBT_RC_NOTFOUND; /* notfound */
+    }
+    return RBT_RC_OK;
+}
+
+/*********************************************************************
+* static size_t rebuild(...)
+* Free all tombstones and build the tree again from the other nodes.
+* Return: count of freed tombstones
+*********************************************************************/
+
+static size_t rebuild(
+    RBT       * rbt)
+{
+    RBTDEF * def;
+    void   * n, * next, * list, * tail;
+    size_t   cnt;
+
+    def = rbt->def;
+    cnt = 0;
+    list = tail = NULL;
+    for( n = rbti_min( def, rbt->root ) ; n ; n = next )
+    {
+        next = rbti_next( def, n ); /* the left threads are not used */
+        if( is_tomb(n) )
+        {
+            cap_sub(rbt, n);
+            def->freeNode( n );
+            cnt++;
+            continue;
+        }
+        if( tail )
+            child_right(tail) = n;
+        else
+            list = n;
+        tail = n;
+    }
+    rbt->root = rbti_build( def, list, rbt->size );
+    rbt->tombs = 0;
+    rbt->del_gen++;
+    rbti_minmax( rbt );
+    return cnt;
+}
+
+/*********************************************************************
+* size_t rbt_purge( RBT * rbt, size_t max )
+* Remove tombstones (see rbt_lazy_delete) from the tree, visiting at
+* most max nodes (0: all tombstones), eg. in idle time. Each call
+* continues where the last one stopped, if no node was deleted since.
+* If more than 1/8 of the nodes are tombstones, max 0 rebuilds the
+* tree in O(n), else each tombstone is erased in O(log^2 n) (see
+* node_path).
+* Return: count of removed tombstones
+*********************************************************************/
+
+size_t rbt_purge(
+    RBT       * rbt,
+    size_t      max )
+{
+    RBTDEF * def;
+    void   * n, * next;
+    size_t   cnt, visits;
+
+    def = rbt->def;
+    if( rbt->tombs == 0 )
+        return 0;
+    relax_fix(rbt);
+    size_count(rbt);
+    if( max == 0 && rbt->tombs * PURGE_REBUILD > rbt->size + rbt->tombs )
+        return rebuild( rbt );
+    n = rbt->purge_gen == rbt->del_gen ? rbt->purge_pos : NULL;
+    cnt = 0;
+    for( visits = 0 ; rbt->tombs && ( max == 0 || visits < max ) ; visits++ )
+    {
+        if( n == NULL ) /* from the start (again) */
+            n = rbti_min( def, rbt->root );
+        if( !is_tomb(n) )
+            next = rbti_next( def, n );
+        else if( erase_node( rbt, n, &next, NULL, 1 ) == RBT_RC_OK )
+            cnt++;
+        else
+            break;
+        n = next;
+    }
+    rbt->purge_pos = n;
+    rbt->purge_gen = rbt->del_gen;
+    return cnt;
+}
+
+/*********************************************************************
+* int rbt_lazy_delete( RBT * rbt, int on, size_t max_tombs )
+* Lazy delete on/off. When on, rbt_delkey, rbt_delnode and rbt_erase
+* (not the _keep variants, nor rbt_del_range) only mark the node as a
+* tombstone, in O(log n) without rebalancing. Tombstones are skipped
+* by rbt_get, rbt_first/next etc. and rbt_feq etc., are not counted in
+* rbt_size, and are replaced by an insert of the same key. They are
+* removed by rbt_purge, or all at once when there are more than
+* max_tombs (0: no limit), or when lazy delete is turned off.
+* Not for multiset trees (RBT_MULTISET).
+* Return: RBT_RC_OK(0), RBT_RC_ERROR(-1)
+*********************************************************************/
+
+int rbt_lazy_delete(
+    RBT       * rbt,
+    int         on,
+    size_t      max_tombs )
+{
+    if( on && is_multiset(rbt->def) )
+        return RBT_RC_ERROR;
+    rbt->lazy = on != 0;
+    rbt->max_tombs = max_tombs;
+    if( !on || ( max_tombs && rbt->tombs > max_tombs ) )
+        rbt_purge( rbt, 0 );
+    return RBT_RC_OK;
 }
 
 /***[end-of-file]****************************************************/
@@ -0,0 +1,456 @@
+/*********************************************************************
+* Red Black Tree functions (threaded)
+*
+* rbt_dump.c
+*
+**********************************************************************
+* functions:
+*
+*   int rbt_dump( RBT * rbt, int fd,
+*                 size_t (*serialize)(void*node,void*buf,size_t size) )
+*   int rbt_load( RBT * rbt, int fd,
+*                 void * (*deserialize)(void*buf,size_t size) )
+*
+**********************************************************************
+* Binary dump of all nodes in ascending order, and load of a dump
+* in O(n) without compares.
+*
+* Format (integers are little endian, 'varint' is LEB128):
+*
+*   header : "RBTD", version (1 byte), flags (1 byte), count (8 bytes)
+*   records: count times:
+*            prefix (varint) : bytes shared with the previous record
+*            length (varint) : bytes following
+*            bytes
+*   trailer: checksum (8 bytes) of all record bytes
+*
+**********************************************************************
+* Copyright (c) 2020 Michael Walsh Pedersen
+*********************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include "rbt.h"
+#include "rbt_internal.h"
+
+#define DUMP_VERSION     1
+#define DUMP_F_PREFIX    1      /* records are prefix compressed */
+#define DUMP_HEADER_SIZE 14
+#define DUMP_IOBUF_SIZE  65536
+
+/*********************************************************************
+*
+*********************************************************************/
+
+typedef struct {
+    int             fd;
+    unsigned char * io;       /* io buffer */
+    size_t          io_pos;
+    size_t          io_len;
+    unsigned char * rec[2];   /* current and previous record */
+    size_t          rec_size[2];
+    size_t          rec_len[2];
+    unsigned long long sum[2]; /* checksum */
+} VAR;
+
+/*********************************************************************
+* void rbti_checksum(...)
+* Fletcher style checksum of len bytes, added to sum[0] (start with 1)
+* and sum[1] (start with 0). Also used by rbt_journal.c.
+*********************************************************************/
+
+void rbti_checksum(
+    unsigned long long   sum[2],
+    const void         * buf,
+    size_t               len)
+{
+    const unsigned char * p;
+    unsigned long long    a, b;
+
+    p = (const unsigned char *)buf;
+    a = sum[0];
+    b = sum[1];
+    while( len-- )
+    {
+        a += *p++;
+        b += a;
+    }
+    sum[0] = a;
+    sum[1] = b;
+}
+
+/*********************************************************************
+* static int flush_out(...), put_bytes(...), put_varint(...)
+* Return: 0: ok, -1: error
+*********************************************************************/
+
+static int flush_out(
+    VAR * var)
+{
+    size_t  pos;
+    ssize_t rc;
+
+    for( pos = 0 ; pos < var->io_pos ; pos += rc )
+    {
+        rc = write( var->fd, var->io + pos, var->io_pos - pos );
+        if( rc < 0 && errno == EINTR )
+            rc = 0;
+        else if( rc <= 0 )
+            return -1;
+    }
+    var->io_pos = 0;
+    return 0;
+}
+
+static int put_bytes(
+    VAR        * var,
+    const void * buf,
+    size_t       len,
+    int          sum)
+{
+    const unsigned char * p;
+    size_t                n;
+
+    p = (const unsigned char *)buf;
+    if( sum )
+        rbti_checksum( var->sum, p, len );
+    while( len )
+    {
+        if( var->io_pos == DUMP_IOBUF_SIZE && flush_out( var ) )
+            return -1;
+        n = DUMP_IOBUF_SIZE - var->io_pos;
+        if( n > len )
+            n = len;
+        memcpy( var->io + var->io_pos, p, n );
+        var->io_pos += n;
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static int put_varint(
+    VAR                * var,
+    unsigned long long   v)
+{
+    unsigned char buf[10];
+    int           n;
+
+    for( n = 0 ; v >= 0x80 ; v >>= 7 )
+        buf[n++] = (unsigned char)(v | 0x80);
+    buf[n++] = (unsigned char)v;
+    return put_bytes( var, buf, n, 1 );
+}
+
+static void put_u64(
+    unsigned char      * buf,
+    unsigned long long   v)
+{
+    int i;
+
+    for( i = 0 ; i < 8 ; i++, v >>= 8 )
+        buf[i] = (unsigned char)v;
+}
+
+/*********************************************************************
+* static int get_bytes(...), get_varint(...)
+* Return: 0: ok, -1: error or end of file
+*********************************************************************/
+
+static int get_bytes(
+    VAR    * var,
+    void   * buf,
+    size_t   len,
+    int      sum)
+{
+    unsigned char * p;
+    size_t          n;
+    ssize_t         rc;
+
+    p = (unsigned char *)buf;
+    while( len )
+    {
+        if( var->io_pos == var->io_len )
+        {
+            rc = read( var->fd, var->io, DUMP_IOBUF_SIZE );
+            if( rc < 0 && errno == EINTR )
+                continue;
+            if( rc <= 0 )
+                return -1;
+            var->io_pos = 0;
+            var->io_len = rc;
+        }
+        n = var->io_len - var->io_pos;
+        if( n > len )
+            n = len;
+        memcpy( p, var->io + var->io_pos, n );
+        if( sum )
+            rbti_checksum( var->sum, p, n );
+        var->io_pos += n;
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static int get_varint(
+    VAR                * var,
+    unsigned long long * v)
+{
+    unsigned char c;
+    int           shift;
+
+    *v = 0;
+    for( shift = 0 ; shift < 64 ; shift += 7 )
+    {
+        if( get_bytes( var, &c, 1, 1 ) )
+            return -1;
+        *v |= (unsigned long long)(c & 0x7f) << shift;
+        if( ( c & 0x80 ) == 0 )
+            return 0;
+    }
+    return -1;
+}
+
+static unsigned long long get_u64(
+    const unsigned char * buf)
+{
+    unsigned long long v;
+    int                i;
+
+    for( v = 0, i = 7 ; i >= 0 ; i-- )
+        v = ( v << 8 ) | buf[i];
+    return v;
+}
+
+/*********************************************************************
+* static int rec_size(...)
+* Make room for at least size bytes in record buffer i.
+* Return: 0: ok, -1: out of memory
+*********************************************************************/
+
+static int rec_size(
+    VAR    * var,
+    int      i,
+    size_t   size)
+{
+    unsigned char * p;
+
+    if( size <= var->rec_size[i] )
+        return 0;
+    if( size < 2 * var->rec_size[i] )
+        size = 2 * var->rec_size[i];
+    p = (unsigned char *)realloc( var->rec[i], size );
+    if( p == NULL )
+        return -1;
+    var->rec[i] = p;
+    var->rec_size[i] = size;
+    return 0;
+}
+
+/*********************************************************************
+* static void init_var(...), free_var(...)
+*********************************************************************/
+
+static int init_var(
+    VAR * var,
+    int   fd)
+{
+    memset( var, 0, sizeof(*var) );
+    var->fd = fd;
+    var->sum[0] = 1;
+    var->io = (unsigned char *)malloc( DUMP_IOBUF_SIZE );
+    if( var->io == NULL
+        || rec_size( var, 0, 256 ) || rec_size( var, 1, 256 ) )
+        return -1;
+    return 0;
+}
+
+static void free_var(
+    VAR * var)
+{
+    free( var->io );
+    free( var->rec[0] );
+    free( var->rec[1] );
+}
+
+/*********************************************************************
+* int rbt_dump(...)
+* Write all nodes in ascending order to fd. serialize(node,buf,size)
+* must write the node to buf and return its length. If the length is
+* > size, serialize is called again with a larger buf.
+* Nodes serialized with the key first gets the best compression.
+* Return: RBT_RC_OK(0), RBT_RC_ERROR(-1)
+*********************************************************************/
+
+int rbt_dump(
+    RBT    * rbt,
+    int      fd,
+    size_t (*serialize)(void*node,void*buf,size_t size) )
+{
+    VAR             Var;
+    unsigned char   header[DUMP_HEADER_SIZE];
+    unsigned char * cur;
+    unsigned char * prv;
+    size_t          len, plen, pre;
+    void          * node;
+    int             i, rc;
+
+    delta_merge(rbt);
+    if( init_var( &Var, fd ) )
+    {
+        free_var( &Var );
+        return RBT_RC_ERROR;
+    }
+    memcpy( header, "RBTD", 4 );
+    header[4] = DUMP_VERSION;
+    header[5] = DUMP_F_PREFIX;
+    size_count(rbt);
+    put_u64( header + 6, rbt->size );
+    rc = put_bytes( &Var, header, DUMP_HEADER_SIZE, 0 );
+
+    i = 0;
+    plen = 0;
+    node = rbt_first( rbt );
+    for( ; node && rc == 0 ; node = rbt_next( rbt, node ) )
+    {
+        len = serialize( node, Var.rec[i], Var.rec_size[i] );
+        if( len > Var.rec_size[i] )
+        {
+            if( rec_size( &Var, i, len ) )
+            {
+                rc = -1;
+                break;
+            }
+            len = serialize( node, Var.rec[i], Var.rec_size[i] );
+        }
+        cur = Var.rec[i];
+        prv = Var.rec[1-i];
+        for( pre = 0 ; pre < len && pre < plen ; pre++ )
+            if( cur[pre] != prv[pre] )
+                break;
+        rc = put_varint( &Var, pre )
+            || put_varint( &Var, len - pre )
+            || put_bytes( &Var, cur + pre, len - pre, 1 );
+        plen = len;
+        i = 1 - i;
+    }
+    if( rc == 0 )
+    {
+        put_u64( header, ( Var.sum[1] << 32 ) ^ Var.sum[0] );
+        rc = put_bytes( &Var, header, 8, 0 ) || flush_out( &Var );
+    }
+    free_var( &Var );
+    return rc ? RBT_RC_ERROR : RBT_RC_OK;
+}
+
+/*********************************************************************
+* int rbt_load(...)
+* Load nodes written by rbt_dump into the empty tree rbt, in O(n) and
+* without calling nodeCmp (multiset: O(n log n) inserts).
+* deserialize(buf,size) must return a new node (or NULL on errors).
+* On errors all loaded nodes are freed. Not journaled: an error while
+* rbt has a journal (open it after the load).
+* Return: RBT_RC_OK(0), RBT_RC_ERROR(-1)
+*********************************************************************/
+
+int rbt_load(
+    RBT    * rbt,
+    int      fd,
+    void * (*deserialize)(void*buf,size_t size) )
+{
+    RBTDEF            * def;
+    VAR                 Var;
+    unsigned char       header[DUMP_HEADER_SIZE];
+    unsigned long long  count, n, pre, len;
+    void              * list, * tail, * node;
+    int                 i, rc;
+
+    def = rbt->def;
+    if( rbt->journal )
+        return RBT_RC_ERROR;
+    delta_merge(rbt);
+    if( rbt->root != NULL )
+        return RBT_RC_ERROR;
+    if( init_var( &Var, fd ) )
+    {
+        free_var( &Var );
+        return RBT_RC_ERROR;
+    }
+    rc = get_bytes( &Var, header, DUMP_HEADER_SIZE, 0 );
+    if( rc == 0 && ( memcmp( header, "RBTD", 4 ) != 0
+        || header[4] != DUMP_VERSION ) )
+        rc = -1;
+    count = rc == 0 ? get_u64( header + 6 ) : 0;
+
+    list = tail = NULL;
+    i = 0;
+    Var.rec_len[1] = 0;
+    for( n = 0 ; n < count && rc == 0 ; n++ )
+    {
+        if( get_varint( &Var, &pre ) || get_varint( &Var, &len )
+            || pre > Var.rec_len[1-i] || rec_size( &Var, i, pre + len + 1 ) )
+        {
+            rc = -1;
+            break;
+        }
+        memcpy( Var.rec[i], Var.rec[1-i], pre );
+        if( get_bytes( &Var, Var.rec[i] + pre, len, 1 ) )
+        {
+            rc = -1;
+            break;
+        }
+        Var.rec_len[i] = pre + len;
+        node = deserialize( Var.rec[i], Var.rec_len[i] );
+        if( node == NULL )
+        {
+            rc = -1;
+            break;
+        }
+        child_right(node) = NULL;
+        if( tail )
+            child_right(tail) = node;
+        else
+            list = node;
+        tail = node;
+        i = 1 - i;
+    }
+    if( rc == 0 && ( get_bytes( &Var, header, 8, 0 )
+        || get_u64( header ) != ( ( Var.sum[1] << 32 ) ^ Var.sum[0] ) ) )
+        rc = -1;
+    free_var( &Var );
+
+    if( rc )
+    {
+        for( ; list ; list = node )
+        {
+            node = child_right(list);
+            def->freeNode( list );
+        }
+        return RBT_RC_ERROR;
+    }
+    if( is_multiset(def) ) /* equal nodes must be ordered by address */
+    {
+        for( ; list ; list = node )
+        {
+            node = child_right(list);
+            rbt_insert( rbt, list );
+        }
+        return RBT_RC_OK;
+    }
+    rbti_hash_drop( rbt );
+    cap_drop(rbt);
+    rbt->root = rbti_build( def, list, count );
+    rbt->size = count;
+    rbt->size_unknown = 0;
+    minmax_reset(rbt);
+    rbti_minmax( rbt );
+    if( def->keyHash && def->nodeHash )
+        rbt_hash_build( rbt ); /* O(n), as the load */
+    return RBT_RC_OK;
+}
+
+/***[end-of-file]****************************************************/
+/********************************************************************/
@@ -8,8 +8,15 @@
 *
 *   void * rbt_feq( RBT * rbt, int (*cmp)(void*,void*), void * key)
 *   void * rbt_leq( RBT * rbt, int (*cmp)(void*,void*), void * key)
+*   void * rbt_fge( RBT * rbt, int (*cmp)(void*,void*), void * key)
+*   void * rbt_fgt( RBT * rbt, int (*cmp)(void*,void*), void * key)
 *
 **********************************************************************
+* In concurrent mode (rbt_concurrent) the searches go by lock coupling,
+* as rbt_next does (rbti_find_concurrent in rbt_first.c). With a write
+* buffer (rbt_buffer) both trees are searched, and the closer node is
+* taken by the merged cursor (rbti_buffered_pick in rbt_first.c).
+**********************************************************************
 * Copyright (c) 2020 Michael Walsh Pedersen
 *********************************************************************/
 
@@ -17,12 +24,12 @@
 #include "rbt_internal.h"
 
 /*********************************************************************
-* void * rbt_feq(...)
+* static void * feq_node(...)
 * First Equal-to
 * Return: node or NULL.
 *********************************************************************/
 
-void * rbt_feq(
+static void * feq_node(
     RBT  * rbt,
     int  (*cmp)(void*,void*),
     void * key)
@@ -40,7 +47,7 @@ void * rbt_feq(
     for( ; ; )
     {
         /* test if p is a candidate */
-        rc = cmp( p, key );
+        rc = rbti_cmp( def, cmp, p, key );
         if( rc >= 0 )
             break;
         /* p is to low */
@@ -56,7 +63,7 @@ void * rbt_feq(
         p2 = child_left(p);
         for( ; ; )
         {
-            rc2 = cmp( p2, key );
+            rc2 = rbti_cmp( def, cmp, p2, key );
             if( rc2 >= 0 )
                 break;
             /* p2 is to low - seek one higher */
@@ -71,12 +78,12 @@ void * rbt_feq(
 }
 
 /*********************************************************************
-* void * rbt_leq(...)
+* static void * leq_node(...)
 * Find Last Equal-to
 * Return: node or NULL.
 *********************************************************************/
 
-void * rbt_leq(
+static void * leq_node(
     RBT  * rbt,
     int  (*cmp)(void*,void*),
     void * key)
@@ -94,7 +101,7 @@ void * rbt_leq(
     for( ; ; )
     {
         /* test if p is a candidate */
-        rc = cmp( p, key );
+        rc = rbti_cmp( def, cmp, p, key );
         if( rc <= 0 )
             break;
         /* p is to high */
@@ -110,7 +117,7 @@ void * rbt_leq(
         p2 = child_right(p);
         for( ; ; )
         {
-            rc2 = cmp( p2, key );
+            rc2 = rbti_cmp( def, cmp, p2, key );
             if( rc2 <= 0 )
                 break;
             /* p2 is to high - seek one lower */
@@ -124,5 +131,204 @@ void * rbt_leq(
     }
 }
 
+/*********************************************************************
+* static void * fgx_node(...)
+* First Greater (or equal if eq) - lower_bound/upper_bound.
+* Return: node or NULL.
+*********************************************************************/
+
+static void * fgx_node(
+    RBT  * rbt,
+    int  (*cmp)(void*,void*),
+    void * key,
+    int    eq)
+{
+    void * p;
+    void * found;
+    RBTDEF * def;
+
+    def = rbt->def;
+    p = rbt->root;
+    found = NULL;
+    while( p )
+    {
+        if( rbti_cmp( def, cmp, p, key ) >= eq ) /* candidate, seek lower */
+        {
+            found = p;
+            if( is_left_thrd(p) )
+                break;
+            p = child_left(p);
+        }
+        else /* p is to low */
+        {
+            if( is_right_thrd(p) )
+                break;
+            p = child_right(p);
+        }
+    }
+    return found;
+}
+
+/*********************************************************************
+* static void * find_concurrent(...)
+* The range finds in concurrent mode (see rbti_find_concurrent), eq: the
+* node must be equal to key.
+* Return: node or NULL.
+*********************************************************************/
+
+static void * find_concurrent(
+    RBT  * rbt,
+    int  (*cmp)(void*,void*),
+    void * key,
+    int    dir,
+    int    gt,
+    int    eq)
+{
+    void * n;
+
+    lat_begin();
+    n = rbti_find_concurrent( rbt, cmp, key, dir, gt );
+    if( n && eq && rbti_cmp( rbt->def, cmp, n, key ) != 0 )
+        n = NULL;
+    lat_end( RBT_LAT_RANGE );
+    return n;
+}
+
+/*********************************************************************
+* void * rbt_feq(...)
+* First Equal-to
+* Return: node or NULL.
+*********************************************************************/
+
+void * rbt_feq(
+    RBT  * rbt,
+    int  (*cmp)(void*,void*),
+    void * key)
+{
+    void * n;
+
+    if( rbt->conc )
+        return find_concurrent( rbt, cmp, key, 1, 0, 1 );
+    lat_begin();
+    if( delta_used(rbt) ) /* write buffer */
+    {
+        n = rbti_buffered_pick( rbt, feq_node( rbt, cmp, key ),
+                                feq_node( rbt->delta, cmp, key ), 1 );
+        if( n && rbti_cmp( rbt->def, cmp, n, key ) != 0 )
+            n = NULL;
+    }
+    else
+    {
+        n = feq_node( rbt, cmp, key );
+        if( n && rbt->tombs ) /* first equal, not deleted */
+        {
+            while( n && is_tomb_node( rbt, n ) )
+                n = rbti_next( rbt->def, n );
+            if( n && rbti_cmp( rbt->def, cmp, n, key ) != 0 )
+                n = NULL;
+        }
+    }
+    lat_end( RBT_LAT_RANGE );
+    return n;
+}
+
+/*********************************************************************
+* void * rbt_leq(...)
+* Find Last Equal-to
+* Return: node or NULL.
+*********************************************************************/
+
+void * rbt_leq(
+    RBT  * rbt,
+    int  (*cmp)(void*,void*),
+    void * key)
+{
+    void * n;
+
+    if( rbt->conc )
+        return find_concurrent( rbt, cmp, key, 0, 0, 1 );
+    lat_begin();
+    if( delta_used(rbt) )
+    {
+        n = rbti_buffered_pick( rbt, leq_node( rbt, cmp, key ),
+                                leq_node( rbt->delta, cmp, key ), 0 );
+        if( n && rbti_cmp( rbt->def, cmp, n, key ) != 0 )
+            n = NULL;
+    }
+    else
+    {
+        n = leq_node( rbt, cmp, key );
+        if( n && rbt->tombs ) /* last equal, not deleted */
+        {
+            while( n && is_tomb_node( rbt, n ) )
+                n = rbti_prev( rbt->def, n );
+            if( n && rbti_cmp( rbt->def, cmp, n, key ) != 0 )
+                n = NULL;
+        }
+    }
+    lat_end( RBT_LAT_RANGE );
+    return n;
+}
+
+/*********************************************************************
+* void * rbt_fge(...)
+* First Greater-or-equal (lower bound)
+* Return: node or NULL.
+*********************************************************************/
+
+void * rbt_fge(
+    RBT  * rbt,
+    int  (*cmp)(void*,void*),
+    void * key)
+{
+    void * n;
+
+    if( rbt->conc )
+        return find_concurrent( rbt, cmp, key, 1, 0, 0 );
+    lat_begin();
+    if( delta_used(rbt) )
+        n = rbti_buffered_pick( rbt, fgx_node( rbt, cmp, key, 0 ),
+                                fgx_node( rbt->delta, cmp, key, 0 ), 1 );
+    else
+    {
+        n = fgx_node( rbt, cmp, key, 0 );
+        if( rbt->tombs )
+            while( n && is_tomb_node( rbt, n ) )
+                n = rbti_next( rbt->def, n );
+    }
+    lat_end( RBT_LAT_RANGE );
+    return n;
+}
+
+/*********************************************************************
+* void * rbt_fgt(...)
+* First Greater-than (upper bound)
+* Return: node or NULL.
+*********************************************************************/
+
+void * rbt_fgt(
+    RBT  * rbt,
+    int  (*cmp)(void*,void*),
+    void * key)
+{
+    void * n;
+
+    if( rbt->conc )
+        return find_concurrent( rbt, cmp, key, 1, 1, 0 );
+    lat_begin();
+    if( delta_used(rbt) )
+        n = rbti_buffered_pick( rbt, fgx_node( rbt, cmp, key, 1 ),
+                                fgx_node( rbt->delta, cmp, key, 1 ), 1 );
+    else
+    {
+        n = fgx_node( rbt, cmp, key, 1 );
+        if( rbt->tombs )
+            while( n && is_tomb_node( rbt, n ) )
+                n = rbti_next( rbt->def, n );
+    }
+    lat_end( RBT_LAT_RANGE );
+    return n;
+}
+
 /***[end-of-file]****************************************************/
 /********************************************************************/
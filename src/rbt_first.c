@@ -11,6 +11,27 @@
 *   void * rbt_last( RBT * rbt)
 *   void * rbt_prev( RBT * rbt, void * node )
 *
+* internal:
+*
+*   void   rbti_minmax( RBT * rbt )
+*   void * rbti_find_concurrent( RBT * rbt, int (*cmp)(void*,void*),
+*                                void * key, int dir, int gt )
+*   void * rbti_buffered_pick( RBT * rbt, void * n, void * x, int dir )
+*
+**********************************************************************
+* The first and last node are cached in the RBT (rbt->first and
+* rbt->last), valid while rbt->minmax_gen == rbt->del_gen: inserts
+* keep them up to date, and so do deletes (the neighbour of a deleted
+* first or last node is linked by its thread), and operations that
+* move many nodes (split, join, load ...) find them again at the end
+* (rbti_minmax). Only the writers store them: rbt_first and rbt_last
+* read the cache, or walk down the tree when it is invalid, and never
+* write the RBT.
+*
+* With a write buffer (see rbt_buffer) the tree and its buffer are
+* read as one, by a merged cursor: the next node is the closer of the
+* next nodes in both trees, a buffered node hides the node with its
+* key in the tree (a tombstone hides it as deleted).
 **********************************************************************
 * Copyright (c) 2020 Michael Walsh Pedersen
 *********************************************************************/
@@ -19,12 +40,12 @@
 #include "rbt_internal.h"
 
 /*********************************************************************
-* void * rbt_first(...)
+* static void * first_node(...)
 *
 * Return: first node or NULL (if tree is empty).
 *********************************************************************/
 
-void * rbt_first(
+static void * first_node(
     RBT  * rbt)
 {
     void * node;
@@ -40,11 +61,11 @@ void * rbt_first(
 }
 
 /*********************************************************************
-* void * rbt_next(...)
+* static void * next_node(...)
 * Return: next node (relative to node) or NULL (=no more).
 *********************************************************************/
 
-void * rbt_next(
+static void * next_node(
     RBT  * rbt,
     void * node)
 {
@@ -62,11 +83,11 @@ void * rbt_next(
 }
 
 /*********************************************************************
-* void * rbt_last(...)
+* static void * last_node(...)
 * Return: last node or NULL (if tree is empty).
 *********************************************************************/
 
-void * rbt_last(
+static void * last_node(
     RBT  * rbt)
 {
     void * node;
@@ -82,11 +103,11 @@ void * rbt_last(
 }
 
 /*********************************************************************
-* void * rbt_prev(...)
+* static void * prev_node(...)
 * Return: previous node (relative to node) or NULL (=no more).
 *********************************************************************/
 
-void * rbt_prev(
+static void * prev_node(
     RBT  * rbt,
     void * node)
 {
@@ -103,5 +124,455 @@ void * rbt_prev(
     return node;
 }
 
+/*********************************************************************
+* static void * end_node(...)
+* Return: first (dir 1) or last (dir 0) node or NULL (tree is empty).
+*********************************************************************/
+
+static void * end_node(
+    RBT  * rbt,
+    int    dir)
+{
+    if( rbt->minmax_gen == rbt->del_gen ) /* cached */
+        return dir ? rbt->first : rbt->last;
+    return dir ? first_node( rbt ) : last_node( rbt );
+}
+
+/*********************************************************************
+* static void * search_node(...)
+* Search from the root for the first node after (dir 1) or before
+* (dir 0) node by nodeCmp, or equal to it too if incl (tombstones
+* too).
+* Return: the node or NULL (=no more).
+*********************************************************************/
+
+static void * search_node(
+    RBT    * rbt,
+    void   * node,
+    int      dir,
+    int      incl)
+{
+    RBTDEF * def;
+    void   * n, * found;
+    int      rc, go;
+
+    def = rbt->def;
+    found = NULL;
+    for( n = rbt->root ; n ; n = go ? child_right(n) : child_left(n) )
+    {
+        rc = rbti_nodecmp( def, n, node );
+        if( rc == 0 && incl )
+            return n;
+        go = dir ? rc <= 0 : rc < 0; /* 1: right */
+        if( go != dir )
+            found = n; /* on side dir of node */
+        if( go ? is_right_thrd(n) : is_left_thrd(n) )
+            break;
+    }
+    return found;
+}
+
+/*********************************************************************
+* void * rbti_buffered_pick(...)
+* Merged cursor over rbt and its write buffer: n is the next candidate
+* in rbt, x the next one in rbt->delta, in direction dir (1: next,
+* 0: previous), tombstones included.
+* Return: the next node or NULL (=no more).
+*********************************************************************/
+
+void * rbti_buffered_pick(
+    RBT    * rbt,
+    void   * n,
+    void   * x,
+    int      dir)
+{
+    RBT    * delta;
+    int      rc;
+
+    delta = rbt->delta;
+    for( ; ; )
+    {
+        if( rbt->tombs )
+            while( n && is_tomb_node( rbt, n ) )
+                n = dir ? next_node( rbt, n ) : prev_node( rbt, n );
+        if( x == NULL )
+            return n;
+        rc = n ? rbti_nodecmp( rbt->def, n, x ) : 0;
+        if( n && ( dir ? rc < 0 : rc > 0 ) ) /* n comes first */
+            return n;
+        if( n && rc == 0 ) /* hidden by x */
+            n = dir ? next_node( rbt, n ) : prev_node( rbt, n );
+        if( !is_tomb_node( delta, x ) )
+            return x;
+        x = dir ? next_node( delta, x ) : prev_node( delta, x );
+    }
+}
+
+/*********************************************************************
+* static void * step_buffered(...)
+* Return: next (dir 1) or previous (dir 0) node of node in rbt or its
+* write buffer, or the first (last) node if node is NULL, or NULL
+* (=no more).
+*********************************************************************/
+
+static void * step_buffered(
+    RBT    * rbt,
+    void   * node,
+    int      dir)
+{
+    RBT    * delta;
+    void   * n, * x;
+    int      in_delta;
+
+    delta = rbt->delta;
+    if( node == NULL )
+        return rbti_buffered_pick( rbt, end_node( rbt, dir ),
+                                   end_node( delta, dir ), dir );
+    in_delta = 0;
+    x = search_node( delta, node, dir, 1 );
+    if( x && rbti_nodecmp( rbt->def, x, node ) == 0 )
+    {
+        in_delta = x == node;
+        x = dir ? next_node( delta, x ) : prev_node( delta, x );
+    }
+    if( in_delta ) /* the neighbour in rbt by a search */
+        n = search_node( rbt, node, dir, 0 );
+    else
+        n = dir ? next_node( rbt, node ) : prev_node( rbt, node );
+    return rbti_buffered_pick( rbt, n, x, dir );
+}
+
+/*********************************************************************
+* concurrent mode (see rbt_concurrent.c): the locks are shared (the
+* readers do not wait for each other), taken top-down only, a thread
+* (up) is followed after the node is unlocked. A node that was deleted
+* or replaced (marked replaced) is no longer in the tree, the neighbour
+* is then searched from the root by nodeCmp.
+*********************************************************************/
+
+/*********************************************************************
+* static void * lock_down(...)
+* Return: last node on side dir of the subtree of (locked) n, locked.
+*********************************************************************/
+
+static void * lock_down(
+    RBTDEF * def,
+    void   * n,
+    int      dir)
+{
+    void * c;
+
+    while( conc_is_data(n,dir) )
+    {
+        c = dir ? child_right(n) : child_left(n);
+        lock_shared(c);
+        unlock_shared(n);
+        n = c;
+    }
+    return n;
+}
+
+/*********************************************************************
+* static void * lock_step(...)
+* Return: next (dir 1) or previous (dir 0) node of (locked) n, locked,
+* or NULL (=no more).
+*********************************************************************/
+
+static void * lock_step(
+    RBTDEF * def,
+    void   * n,
+    int      dir)
+{
+    void * c;
+
+    c = dir ? child_right(n) : child_left(n);
+    if( !conc_is_data(n,dir) )
+    {
+        unlock_shared(n);
+        if( c )
+            lock_shared(c);
+        return c;
+    }
+    lock_shared(c);
+    unlock_shared(n);
+    return lock_down( def, c, !dir );
+}
+
+/*********************************************************************
+* static void * lock_search(...)
+* Search from the root for the first node after (dir 1) or before
+* (dir 0) node by nodeCmp, or equal to it too if incl.
+* Return: the node, locked, or NULL (=no more).
+*********************************************************************/
+
+static void * lock_search(
+    RBT    * rbt,
+    void   * node,
+    int      dir,
+    int      incl)
+{
+    RBTDEF * def;
+    void   * n, * c, * found;
+    int      rc, go;
+
+    def = rbt->def;
+    rbti_lock_shared( &rbt->conc->root_lock );
+    n = rbt->root;
+    if( n )
+        lock_shared(n);
+    rbti_unlock_shared( &rbt->conc->root_lock );
+    found = NULL;
+    while( n )
+    {
+        rc = rbti_nodecmp( def, n, node );
+        if( rc == 0 && incl )
+            return n;
+        go = dir ? rc <= 0 : rc < 0; /* 1: right */
+        if( go != dir )
+            found = n; /* on side dir of node */
+        c = NULL;
+        if( conc_is_data(n,go) )
+        {
+            c = go ? child_right(n) : child_left(n);
+            lock_shared(c);
+        }
+        unlock_shared(n);
+        n = c;
+    }
+    if( found )
+        lock_shared(found); /* may be replaced since, see the caller */
+    return found;
+}
+
+/*********************************************************************
+* static void * step_concurrent(...)
+* Return: next (dir 1) or previous (dir 0) node of node, or the first
+* (last) node if node is NULL, or NULL (=no more).
+*********************************************************************/
+
+static void * step_concurrent(
+    RBT    * rbt,
+    void   * node,
+    int      dir)
+{
+    RBTDEF * def;
+    void   * n;
+
+    def = rbt->def;
+    rbti_conc_join( rbt );
+    if( node == NULL )
+    {
+        rbti_lock_shared( &rbt->conc->root_lock );
+        n = rbt->root;
+        if( n )
+            lock_shared(n);
+        rbti_unlock_shared( &rbt->conc->root_lock );
+        if( n )
+            n = lock_down( def, n, !dir );
+    }
+    else
+    {
+        lock_shared(node);
+        if( is_replaced(node) )
+        {
+            unlock_shared(node);
+            n = lock_search( rbt, node, dir, 0 );
+        }
+        else
+            n = lock_step( def, node, dir );
+    }
+    while( n && ( conc_is_tomb(n) || is_replaced(n) ) )
+    {
+        if( is_replaced(n) ) /* deleted, or by a node with the same key */
+        {
+            unlock_shared(n);
+            n = lock_search( rbt, n, dir, 1 );
+        }
+        else
+            n = lock_step( def, n, dir );
+    }
+    if( n )
+        unlock_shared(n);
+    return n;
+}
+
+/*********************************************************************
+* void * rbti_find_concurrent(...)
+* The range finds in concurrent mode: search by cmp from the root, by
+* lock coupling, for the first node >= key (dir 1), > key (dir 1, gt)
+* or the last node <= key (dir 0), skipping deleted nodes. A found node
+* deleted or replaced meanwhile is searched for again.
+* Return: node or NULL.
+*********************************************************************/
+
+void * rbti_find_concurrent(
+    RBT    * rbt,
+    int    (*cmp)(void*,void*),
+    void   * key,
+    int      dir,
+    int      gt)
+{
+    RBTDEF * def;
+    void   * n, * c, * found;
+    int      rc, go;
+
+    def = rbt->def;
+    rbti_conc_join( rbt );
+    do
+    {
+        rbti_lock_shared( &rbt->conc->root_lock );
+        n = rbt->root;
+        if( n )
+            lock_shared(n);
+        rbti_unlock_shared( &rbt->conc->root_lock );
+        found = NULL;
+        while( n )
+        {
+            rc = rbti_cmp( def, cmp, n, key );
+            go = dir ? rc < gt : rc <= 0; /* 1: right */
+            if( go != dir )
+                found = n; /* a candidate, look for a closer one */
+            c = NULL;
+            if( conc_is_data(n,go) )
+            {
+                c = go ? child_right(n) : child_left(n);
+                lock_shared(c);
+            }
+            unlock_shared(n);
+            n = c;
+        }
+        if( found == NULL )
+            return NULL;
+        lock_shared(found);
+        while( found && conc_is_tomb(found) && !is_replaced(found) )
+            found = lock_step( def, found, dir );
+        if( found )
+            unlock_shared(found);
+    } while( found && is_replaced(found) );
+    return found;
+}
+
+/*********************************************************************
+* void rbti_minmax(...)
+* Make rbt->first and rbt->last valid (by a writer of rbt).
+*********************************************************************/
+
+void rbti_minmax(
+    RBT  * rbt)
+{
+    if( rbt->minmax_gen != rbt->del_gen )
+    {
+        rbt->first = first_node( rbt );
+        rbt->last = last_node( rbt );
+        rbt->minmax_gen = rbt->del_gen;
+    }
+}
+
+/*********************************************************************
+* void * rbt_first(...)
+* Return: first node or NULL (if tree is empty).
+*********************************************************************/
+
+void * rbt_first(
+    RBT  * rbt)
+{
+    void * n;
+
+    if( rbt->conc )
+        return step_concurrent( rbt, NULL, 1 );
+    lat_begin();
+    if( delta_used(rbt) ) /* write buffer */
+        n = step_buffered( rbt, NULL, 1 );
+    else
+    {
+        n = end_node( rbt, 1 );
+        if( rbt->tombs ) /* skip deleted nodes */
+            while( n && is_tomb_node( rbt, n ) )
+                n = next_node( rbt, n );
+    }
+    lat_end( RBT_LAT_ITER );
+    return n;
+}
+
+/*********************************************************************
+* void * rbt_next(...)
+* Return: next node (relative to node) or NULL (=no more).
+*********************************************************************/
+
+void * rbt_next(
+    RBT  * rbt,
+    void * node)
+{
+    void * n;
+
+    if( rbt->conc )
+        return step_concurrent( rbt, node, 1 );
+    lat_begin();
+    if( node && delta_used(rbt) )
+        n = step_buffered( rbt, node, 1 );
+    else
+    {
+        n = next_node( rbt, node );
+        if( rbt->tombs )
+            while( n && is_tomb_node( rbt, n ) )
+                n = next_node( rbt, n );
+    }
+    lat_end( RBT_LAT_ITER );
+    return n;
+}
+
+/*********************************************************************
+* void * rbt_last(...)
+* Return: last node or NULL (if tree is empty).
+*********************************************************************/
+
+void * rbt_last(
+    RBT  * rbt)
+{
+    void * n;
+
+    if( rbt->conc )
+        return step_concurrent( rbt, NULL, 0 );
+    lat_begin();
+    if( delta_used(rbt) )
+        n = step_buffered( rbt, NULL, 0 );
+    else
+    {
+        n = end_node( rbt, 0 );
+        if( rbt->tombs )
+            while( n && is_tomb_node( rbt, n ) )
+                n = prev_node( rbt, n );
+    }
+    lat_end( RBT_LAT_ITER );
+    return n;
+}
+
+/*********************************************************************
+* void * rbt_prev(...)
+* Return: previous node (relative to node) or NULL (=no more).
+*********************************************************************/
+
+void * rbt_prev(
+    RBT  * rbt,
+    void * node)
+{
+    void * n;
+
+    if( rbt->conc )
+        return step_concurrent( rbt, node, 0 );
+    lat_begin();
+    if( node && delta_used(rbt) )
+        n = step_buffered( rbt, node, 0 );
+    else
+    {
+        n = prev_node( rbt, node );
+        if( rbt->tombs )
+            while( n && is_tomb_node( rbt, n ) )
+                n = prev_node( rbt, n );
+    }
+    lat_end( RBT_LAT_ITER );
+    return n;
+}
+
 /***[end-of-file]****************************************************/
 /********************************************************************/
@@ -7,8 +7,18 @@
 * function:
 *
 *   void * rbt_get   ( RBT * rbt, void * key ) // Find node
+*   void * rbt_get_finger( RBT * rbt, RBTFINGER * finger, void * key )
 *
 **********************************************************************
+* Finger search: a RBTFINGER (one per thread or handle) remembers the
+* last node found (or visited). The next search climbs from there to
+* the first subtree that holds the key, by the thread of its last (or
+* first) node, which is the ancestor bounding the subtree, and then
+* descends. For a key d nodes away this takes about O(log d) compares,
+* but O(log^2 d) node visits: each step up walks down the spine of the
+* subtree to its last (or first) node, as there are no parent pointers.
+* A finger is invalid after a node left the tree (RBT del_gen).
+**********************************************************************
 * Copyright (c) 2020 Michael Walsh Pedersen
 *********************************************************************/
 
@@ -16,40 +26,213 @@
 #include "rbt_internal.h"
 
 /*********************************************************************
-* void * rbt_get(...)
+* static void * get_node(...)
 * Return found node (by key) or NULL if not found.
 *********************************************************************/
 
-void * rbt_get(
+static void * get_node(
     RBT      * rbt,
-    void     * key)
+    void     * node,
+    void     * key,
+    void    ** last)
 {
     int    rc;
-    void * node;
     RBTDEF * def;
 
     def = rbt->def;
-    node = rbt->root;
     if( node == NULL )
         return NULL;
     for( ; ; )
     {
-        rc = def->keyCmp( node, key );
+        stat_inc(rbt, visits);
+        stat_inc(rbt, key_cmp);
+        rc = rbti_keycmp( def, node, key );
         if( rc == 0 ) /* node found */
             return node;
         else if( rc > 0 ) /* data < (*node)->data ) */
         {
             if( is_left_thrd(node) )
-                return NULL;
+                break;
             node = child_left(node);
         }
         else
         {
             if( is_right_thrd(node) )
-                return NULL;
+                break;
             node = child_right(node);
         }
     }
+    if( last )
+        *last = node;
+    return NULL;
+}
+
+/*********************************************************************
+* static void * get_concurrent(...)
+* Concurrent mode (see rbt_concurrent.c): search with hand-over-hand
+* shared locks.
+* Return found node (by key) or NULL if not found (or deleted).
+*********************************************************************/
+
+static void * get_concurrent(
+    RBT      * rbt,
+    void     * key)
+{
+    RBTDEF * def;
+    void   * n, * c;
+    int      rc;
+
+    def = rbt->def;
+    rbti_conc_join( rbt );
+    rbti_lock_shared( &rbt->conc->root_lock );
+    n = rbt->root;
+    if( n )
+        lock_shared(n);
+    rbti_unlock_shared( &rbt->conc->root_lock );
+    while( n && ( rc = rbti_keycmp( def, n, key ) ) != 0 )
+    {
+        c = NULL;
+        if( conc_is_data(n,rc < 0) )
+        {
+            c = rc > 0 ? child_left(n) : child_right(n);
+            lock_shared(c);
+        }
+        unlock_shared(n);
+        n = c;
+    }
+    if( n == NULL )
+        return NULL;
+    c = conc_is_tomb(n) ? NULL : n;
+    unlock_shared(n);
+    return c;
+}
+
+/*********************************************************************
+* static int get_buffered(...)
+* Find by key in the write buffer (see rbt_buffer), which has the
+* newest nodes: *node is the node, or NULL if it is a tombstone there.
+* Return: 1: found in the buffer, 0: not there (look in the tree)
+*********************************************************************/
+
+static int get_buffered(
+    RBT      * rbt,
+    void     * key,
+    void    ** node)
+{
+    RBT  * delta;
+    void * n;
+
+    delta = rbt->delta;
+    n = delta->hash ? rbti_hash_get( delta, key ) : NULL;
+    if( n == NULL && ( delta->hash == NULL || delta->tombs ) )
+        n = get_node( delta, delta->root, key, NULL ); /* or tombstone */
+    if( n == NULL )
+        return 0;
+    *node = is_tomb_node( delta, n ) ? NULL : n;
+    return 1;
+}
+
+/*********************************************************************
+* void * rbt_get(...)
+* Find by key, in the hash index if there is one (see rbt_hash.c).
+* Return found node (by key) or NULL if not found.
+*********************************************************************/
+
+void * rbt_get(
+    RBT      * rbt,
+    void     * key)
+{
+    void * node;
+
+    lat_begin();
+    if( rbt->conc )
+    {
+        node = get_concurrent( rbt, key );
+        lat_end( RBT_LAT_GET );
+        return node;
+    }
+    if( !delta_used(rbt) || !get_buffered( rbt, key, &node ) )
+    {
+        if( rbt->hash )
+            node = rbti_hash_get( rbt, key );
+        else
+            node = get_node( rbt, rbt->root, key, NULL );
+        if( node && rbt->tombs && is_tomb_node( rbt, node ) )
+            node = NULL; /* deleted */
+    }
+    lat_end( RBT_LAT_GET );
+    return node;
+}
+
+/*********************************************************************
+* void * rbt_get_finger( RBT * rbt, RBTFINGER * finger, void * key )
+* Find by key, starting at the finger (zero it before the first use),
+* which is then set to the found node, or the last node visited.
+* In concurrent mode the finger is not used (set to NULL): as rbt_get.
+* Return found node (by key) or NULL if not found.
+*********************************************************************/
+
+void * rbt_get_finger(
+    RBT       * rbt,
+    RBTFINGER * finger,
+    void      * key)
+{
+    RBTDEF * def;
+    void   * x;
+    void   * bound;
+    void   * last;
+    int      rc, rc2;
+
+    if( rbt->conc ) /* a finger node may be deleted meanwhile */
+    {
+        finger->node = NULL;
+        return rbt_get( rbt, key );
+    }
+    if( delta_used(rbt) && get_buffered( rbt, key, &x ) ) /* write buffer */
+        return x;
+    lat_begin();
+    def = rbt->def;
+    last = NULL;
+    x = finger->node;
+    if( x == NULL || finger->rbt != rbt || finger->del_gen != rbt->del_gen )
+        x = get_node( rbt, rbt->root, key, &last ); /* from the root */
+    else
+    {
+        stat_inc(rbt, key_cmp);
+        rc = rbti_keycmp( def, x, key );
+        /* climb while the key is beyond the bound of subtree x */
+        while( rc != 0 )
+        {
+            if( rc < 0 ) /* key > x: bound is the node after subtree x */
+                bound = child_right(rbti_max( def, x ));
+            else         /* key < x: bound is the node before subtree x */
+                bound = child_left(rbti_min( def, x ));
+            if( bound == NULL )
+                break;
+            stat_inc(rbt, visits);
+            stat_inc(rbt, key_cmp);
+            rc2 = rbti_keycmp( def, bound, key );
+            if( rc2 != 0 && ( rc < 0 ) != ( rc2 < 0 ) )
+                break;  /* key is in subtree x (or not in the tree) */
+            x = bound;  /* bound is an ancestor of x */
+            rc = rc2;
+        }
+        /* descend from the child of x towards the key */
+        last = x;
+        if( rc > 0 )
+            x = is_left_thrd(x) ? NULL
+                : get_node( rbt, child_left(x), key, &last );
+        else if( rc < 0 )
+            x = is_right_thrd(x) ? NULL
+                : get_node( rbt, child_right(x), key, &last );
+    }
+    finger->rbt = rbt;
+    finger->node = x ? x : last;
+    finger->del_gen = rbt->del_gen;
+    if( x && rbt->tombs && is_tomb(x) )
+        x = NULL; /* deleted */
+    lat_end( RBT_LAT_GET );
+    return x;
 }
 
 /***[end-of-file]****************************************************/
@@ -0,0 +1,334 @@
+/*********************************************************************
+* Red Black Tree functions (threaded)
+*
+* rbt_hash.c
+*
+**********************************************************************
+* functions:
+*
+*   int    rbt_hash_build ( RBT * rbt )
+*
+* internal:
+*
+*   void   rbti_hash_insert( RBT * rbt, void * node, void * old_node )
+*   void   rbti_hash_delete( RBT * rbt, void * node )
+*   void   rbti_hash_drop  ( RBT * rbt )
+*   void   rbti_hash_clear ( RBT * rbt )
+*   void * rbti_hash_get   ( RBT * rbt, void * key )
+*   size_t rbti_hash_bytes ( RBT * rbt )
+*
+**********************************************************************
+* Hash index of the nodes by key, for rbt_get in O(1), when keyHash and
+* nodeHash are set in RBTDEF (not for RBT_MULTISET). The tree is still
+* used for everything else.
+*
+* Open addressing with linear probing, max 3/4 full, and deletion by
+* moving the following entries back (no tombstones). Each slot keeps
+* the (mixed) hash, so keyCmp is only called on a full hash match.
+*
+* Inserts and deletes keep the index in sync, and rbt_clr empties it.
+* The first insert into an empty tree builds it. Operations that move
+* many nodes at once (split, join, set operations) drop it, as does a
+* failed resize (no memory), and it is rebuilt, O(n), only by
+* rbt_hash_build: never by an insert, so no single insert pays O(n),
+* and an insert after a failed resize does not try again. rbt_load and
+* the end of the concurrent mode rebuild it, being O(n) anyway.
+**********************************************************************
+* Copyright (c) 2020 Michael Walsh Pedersen
+*********************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include "rbt.h"
+#include "rbt_internal.h"
+
+#define HASH_MIN_SLOTS  16
+
+/*********************************************************************
+*
+*********************************************************************/
+
+typedef struct {
+    void               * node;    /* NULL: free */
+    unsigned long long   h;
+} HSLOT;
+
+struct RBTHASH {
+    size_t     mask;              /* slots - 1 (power of 2) */
+    size_t     used;
+    HSLOT    * slots;
+};
+
+#define is_full(t,n)  ( ( (n) + 1 ) * 4 > ( (t)->mask + 1 ) * 3 )
+
+/*********************************************************************
+* static unsigned long long mix(...)
+* Return: h with all bits mixed (the user hash may be weak, eg. an int).
+*********************************************************************/
+
+static unsigned long long mix(
+    unsigned long long h)
+{
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+/*********************************************************************
+* static void put(...)
+* Add node (not in the table) to a free slot.
+*********************************************************************/
+
+static void put(
+    RBTHASH            * t,
+    void               * node,
+    unsigned long long   h)
+{
+    size_t i;
+
+    for( i = h & t->mask ; t->slots[i].node ; i = ( i + 1 ) & t->mask )
+        ;
+    t->slots[i].node = node;
+    t->slots[i].h = h;
+    t->used++;
+}
+
+/*********************************************************************
+* static int resize(...)
+* Move all entries to a new table of nslots.
+* Return: 0: ok, -1: no memory
+*********************************************************************/
+
+static int resize(
+    RBTHASH * t,
+    size_t    nslots)
+{
+    HSLOT * old;
+    size_t  i, n;
+
+    old = t->slots;
+    n = old ? t->mask + 1 : 0;
+    t->slots = (HSLOT*)calloc( nslots, sizeof(HSLOT) );
+    if( t->slots == NULL )
+    {
+        t->slots = old;
+        return -1;
+    }
+    t->mask = nslots - 1;
+    t->used = 0;
+    for( i = 0 ; i < n ; i++ )
+        if( old[i].node )
+            put( t, old[i].node, old[i].h );
+    free( old );
+    return 0;
+}
+
+/*********************************************************************
+* static size_t find(...)
+* Return: slot of node (by address), or mask + 1 if not found.
+*********************************************************************/
+
+static size_t find(
+    RBTHASH            * t,
+    void               * node,
+    unsigned long long   h)
+{
+    size_t i;
+
+    for( i = h & t->mask ; t->slots[i].node ; i = ( i + 1 ) & t->mask )
+        if( t->slots[i].node == node )
+            return i;
+    return t->mask + 1;
+}
+
+/*********************************************************************
+* int rbt_hash_build( RBT * rbt )
+* (Re)build the hash index from the tree, O(n): after split, join, the
+* set operations, or a failed resize (the first insert into an empty
+* tree builds it, rbt_load and rbt_concurrent off rebuild it).
+* Return: RBT_RC_OK(0), RBT_RC_ERROR(-1) (no keyHash/nodeHash in def,
+*         multiset, or no memory)
+*********************************************************************/
+
+int rbt_hash_build(
+    RBT * rbt )
+{
+    RBTDEF  * def;
+    RBTHASH * t;
+    void    * n;
+    size_t    nslots;
+
+    def = rbt->def;
+    rbti_hash_drop( rbt );
+    if( def->keyHash == NULL || def->nodeHash == NULL || is_multiset(def) )
+        return RBT_RC_ERROR;
+    t = (RBTHASH*)calloc( 1, sizeof(RBTHASH) );
+    if( t == NULL )
+        return RBT_RC_ERROR;
+    size_count(rbt);
+    for( nslots = HASH_MIN_SLOTS ; nslots / 4 * 3 <= rbt->size ; )
+        nslots *= 2;
+    if( resize( t, nslots ) != 0 )
+    {
+        free( t );
+        return RBT_RC_ERROR;
+    }
+    for( n = rbti_min( def, rbt->root ) ; n ; n = rbti_next( def, n ) )
+        if( !is_tomb(n) ) /* lazy deleted */
+            put( t, n, mix( def->nodeHash( n ) ) );
+    rbt->hash = t;
+    return RBT_RC_OK;
+}
+
+/*********************************************************************
+* void rbti_hash_insert(...)
+* node is inserted in the tree (old_node: replaced by node, or NULL).
+*********************************************************************/
+
+void rbti_hash_insert(
+    RBT    * rbt,
+    void   * node,
+    void   * old_node)
+{
+    RBTDEF           * def;
+    RBTHASH          * t;
+    unsigned long long h;
+    size_t             i;
+
+    t = rbt->hash;
+    if( t == NULL ) /* dropped: off until rbt_hash_build */
+    {
+        def = rbt->def;
+        if( rbt->root == node && is_left_thrd(node) && is_right_thrd(node) )
+            rbt_hash_build( rbt ); /* a new tree, O(1) */
+        return;
+    }
+    h = mix( rbt->def->nodeHash( node ) );
+    if( old_node ) /* same key, same slot chain */
+    {
+        i = find( t, old_node, h );
+        if( i <= t->mask )
+        {
+            t->slots[i].node = node;
+            return;
+        }
+    }
+    if( is_full( t, t->used ) && resize( t, ( t->mask + 1 ) * 2 ) != 0 )
+    {
+        rbti_hash_drop( rbt ); /* rbt_get uses the tree, until
+                                  rbt_hash_build */
+        return;
+    }
+    put( t, node, h );
+}
+
+/*********************************************************************
+* void rbti_hash_delete(...)
+* node is deleted from the tree (and not freed yet).
+*********************************************************************/
+
+void rbti_hash_delete(
+    RBT    * rbt,
+    void   * node)
+{
+    RBTHASH * t;
+    size_t    i, j, home;
+
+    t = rbt->hash;
+    i = find( t, node, mix( rbt->def->nodeHash( node ) ) );
+    if( i > t->mask )
+        return;
+    /* move back the following entries that may not pass slot i */
+    for( j = ( i + 1 ) & t->mask ; t->slots[j].node ; j = ( j + 1 ) & t->mask )
+    {
+        home = t->slots[j].h & t->mask;
+        if( ( ( j - home ) & t->mask ) >= ( ( j - i ) & t->mask ) )
+        {
+            t->slots[i] = t->slots[j];
+            i = j;
+        }
+    }
+    t->slots[i].node = NULL;
+    t->used--;
+}
+
+/*********************************************************************
+* void rbti_hash_drop(...)
+* Free the hash index.
+*********************************************************************/
+
+void rbti_hash_drop(
+    RBT    * rbt)
+{
+    if( rbt->hash )
+    {
+        free( rbt->hash->slots );
+        free( rbt->hash );
+        rbt->hash = NULL;
+    }
+}
+
+/*********************************************************************
+* void rbti_hash_clear(...)
+* All nodes are removed from the tree: empty the index (keep its slots).
+*********************************************************************/
+
+void rbti_hash_clear(
+    RBT    * rbt)
+{
+    RBTHASH * t;
+
+    t = rbt->hash;
+    if( t )
+    {
+        memset( t->slots, 0, ( t->mask + 1 ) * sizeof(HSLOT) );
+        t->used = 0;
+    }
+}
+
+/*********************************************************************
+* void * rbti_hash_get(...)
+* Return: node with key, or NULL.
+*********************************************************************/
+
+void * rbti_hash_get(
+    RBT    * rbt,
+    void   * key)
+{
+    RBTHASH          * t;
+    unsigned long long h;
+    size_t             i;
+
+    t = rbt->hash;
+    h = mix( rbt->def->keyHash( key ) );
+    for( i = h & t->mask ; t->slots[i].node ; i = ( i + 1 ) & t->mask )
+    {
+        stat_inc(rbt, visits);
+        if( t->slots[i].h == h )
+        {
+            stat_inc(rbt, key_cmp);
+            if( rbti_keycmp( rbt->def, t->slots[i].node, key ) == 0 )
+                return t->slots[i].node;
+        }
+    }
+    return NULL;
+}
+
+/*********************************************************************
+* size_t rbti_hash_bytes(...)
+* Return: bytes allocated for the hash index (0: no index).
+*********************************************************************/
+
+size_t rbti_hash_bytes(
+    RBT    * rbt)
+{
+    if( rbt->hash == NULL )
+        return 0;
+    return sizeof(RBTHASH) + ( rbt->hash->mask + 1 ) * sizeof(HSLOT);
+}
+
+/***[end-of-file]****************************************************/
+/********************************************************************/
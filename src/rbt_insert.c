@@ -8,6 +8,10 @@
 *
 *  int rbt_insert_keep( RBT * rbt, void * node, void ** old_node )
 *  int rbt_insert     ( RBT * rbt, void * node )
+*  void * rbt_insert_absent( RBT * rbt, void * node )
+*  void * rbt_upsert  ( RBT * rbt, void * key,
+*                       void * (*create)(void*key,void*ctx),
+*                       void (*update)(void*node,void*ctx), void * ctx )
 *
 **********************************************************************
 * Copyright (c) 2020 Michael Walsh Pedersen
@@ -26,11 +30,24 @@
 #define ACTION_RED_LEFT_RED   2
 #define ACTION_RED_RIGHT_RED  3
 #define ACTION_DUPLICATE      4
+#define ACTION_FOUND          5  /* equal node kept (absent, upsert) */
+#define ACTION_ERROR          6  /* create failed */
+
+/* insert modes: */
+#define MODE_INSERT           0  /* insert or replace */
+#define MODE_ABSENT           1  /* insert if no equal node */
+#define MODE_UPSERT           2  /* update, or create and insert */
 
 typedef struct {
     void  * node_arg;
     void  * old_node;
     RBT   * rbt;
+    int     mode;
+    void  * found;       /* equal node (ACTION_FOUND) */
+    void  * key;         /* MODE_UPSERT: */
+    void *(*create)(void*key,void*ctx);
+    void  (*update)(void*node,void*ctx);
+    void  * ctx;
 } VAR;
 
 /*********************************************************************
@@ -49,6 +66,12 @@ static int insert_node (
 
     if ( *node == NULL )
     {
+        if( var->mode == MODE_UPSERT )
+        {
+            var->node_arg = var->create( var->key, var->ctx );
+            if( var->node_arg == NULL )
+                return ACTION_ERROR;
+        }
         *node = var->node_arg;
         child_left(*node) = NULL;
         child_right(*node) = NULL;
@@ -56,15 +79,46 @@ static int insert_node (
         set_red(*node);
         return ACTION_RED;
     }
-    rc = def->nodeCmp( *node, var->node_arg );
+    stat_inc(var->rbt, visits);
+    switch( var->mode )
+    {
+    case MODE_UPSERT:
+        stat_inc(var->rbt, key_cmp);
+        rc = rbti_keycmp( def, *node, var->key );
+        break;
+    case MODE_ABSENT:
+        stat_inc(var->rbt, node_cmp);
+        rc = rbti_nodecmp( def, *node, var->node_arg ); /* no multiset order */
+        break;
+    default:
+        stat_inc(var->rbt, node_cmp);
+        rc = rbti_node_cmp( def, *node, var->node_arg );
+        break;
+    }
+    if( rc == 0 && var->mode != MODE_INSERT && !is_tomb(*node) )
+    {   /* keep the equal node */
+        var->found = *node;
+        if( var->mode == MODE_UPSERT && var->update )
+            var->update( *node, var->ctx );
+        return ACTION_FOUND;
+    }
+    if( rc == 0 && var->mode == MODE_UPSERT ) /* replace a deleted node */
+    {
+        var->node_arg = var->create( var->key, var->ctx );
+        if( var->node_arg == NULL )
+            return ACTION_ERROR;
+    }
+    if( rc == 0 && *node == var->node_arg )
+        return ACTION_DUPLICATE; /* already in the tree */
     if( rc == 0 )  /* node replacement */
     {
         void * n;
 
+        stat_inc(var->rbt, duplicates);
         var->old_node = *node;
         child_left(var->node_arg)  = child_left(*node);
         child_right(var->node_arg) = child_right(*node);
-        node_color(var->node_arg)  = node_color(*node);
+        node_color(var->node_arg)  = node_links(*node);
 
         n = *node;
         if( is_right_data(n) ) /**/
@@ -108,8 +162,15 @@ static int insert_node (
         {
         case ACTION_DUPLICATE:
         case ACTION_BLACK:
+        case ACTION_FOUND:
+        case ACTION_ERROR:
             return action;
         case ACTION_RED:
+            if( is_red(*node) && var->rbt->relax ) /* repaired later */
+            {
+                relax_add(var->rbt, child_left(*node));
+                return ACTION_BLACK;
+            }
             return is_red(*node) ? ACTION_RED_LEFT_RED : ACTION_BLACK ;
         }
         /* ACTION_RED_LEFT_RED */
@@ -120,6 +181,7 @@ static int insert_node (
             set_black(child_left(*node));
             set_black(child_right(*node));
             set_red((*node));
+            stat_inc(var->rbt, recolors);
             return ACTION_RED;
         }
         /* case 4 - left rotation */
@@ -136,6 +198,7 @@ static int insert_node (
                 child_right(child_left(*node)) = child_left(c);
             child_left(c) = child_left(*node);
             child_left(*node) = c;
+            stat_inc(var->rbt, rotations);
             /* lr-done. */
             /* case 4 is now case 5 */
         }
@@ -154,6 +217,8 @@ static int insert_node (
         /* rr-done. */
         set_black(*node);
         set_red(child_right(*node));
+        stat_inc(var->rbt, rotations);
+        stat_inc(var->rbt, recolors);
         return ACTION_BLACK;
     }
     else  /* data > (*node)->data */
@@ -178,8 +243,15 @@ static int insert_node (
         {
         case ACTION_DUPLICATE:
         case ACTION_BLACK:
+        case ACTION_FOUND:
+        case ACTION_ERROR:
             return action;
         case ACTION_RED:
+            if( is_red(*node) && var->rbt->relax ) /* repaired later */
+            {
+                relax_add(var->rbt, child_right(*node));
+                return ACTION_BLACK;
+            }
             return is_red(*node) ? ACTION_RED_RIGHT_RED : ACTION_BLACK ;
         }
         /* ACTION_RED_LEFT_RED */
@@ -190,6 +262,7 @@ static int insert_node (
             set_black(child_right(*node));
             set_black(child_left(*node));
             set_red((*node));
+            stat_inc(var->rbt, recolors);
             return ACTION_RED;
         }
         /* case 4 - right rotation */
@@ -206,6 +279,7 @@ static int insert_node (
                 child_left(child_right(*node)) = child_right(c);
             child_right(c) = child_right(*node);
             child_right(*node) = c;
+            stat_inc(var->rbt, rotations);
             /* case 4 is now case 5 */
         }
         /* case 5 - left rotation */
@@ -223,14 +297,265 @@ static int insert_node (
         /* lr-done. */
         set_black(*node);
         set_red(child_left(*node));
+        stat_inc(var->rbt, rotations);
+        stat_inc(var->rbt, recolors);
         return ACTION_BLACK;
     }
 }
 
+/*********************************************************************
+* concurrent mode (see rbt_concurrent.c): top-down insert
+*********************************************************************/
+
+/*********************************************************************
+* static void * insert_concurrent(...)
+* Insert by var->mode in one top-down pass, with hand-over-hand locks:
+* a 4-node (black, two red children) is split on the way down, and if
+* that gives a red-red the grandparent is rotated at once. Only the
+* great-grandparent t, grandparent g, parent p and node q are locked
+* (head: the root lock, above the root; t NULL: not known, for one
+* level after a rotation). A replaced node is kept (see
+* rbti_conc_retire), or returned in var->old_node (MODE_INSERT, keep).
+* Return: the new or equal node, or NULL (create failed, or no memory
+*         to keep the replaced node).
+*********************************************************************/
+
+static void * insert_concurrent(
+    RBT   * rbt,
+    VAR   * var,
+    int     keep )
+{
+    RBTDEF * def;
+    void   * t, * g, * p, * q, * s;
+    void   * ret;
+    int      dir, last, dir2, rc, head, inserted;
+
+    def = rbt->def;
+    var->old_node = NULL;
+    ret = NULL;
+    rbti_conc_join( rbt );
+    rbti_lock( &rbt->conc->root_lock );
+    head = 1;
+    t = g = p = NULL;
+    q = rbt->root;
+    if( q )
+        lock_node(q);
+    dir = last = rc = inserted = 0;
+    for( ; ; )
+    {
+        if( q == NULL ) /* new red node at the thread of p */
+        {
+            if( var->mode == MODE_UPSERT )
+                var->node_arg = var->create( var->key, var->ctx );
+            if( var->node_arg == NULL )
+                break;
+            q = var->node_arg;
+            node_color(q) = NODE_LOCK | ( p ? 1 : 0 ); /* locked */
+            if( p )
+            {
+                child(q,dir) = child(p,dir);
+                child(q,!dir) = p;
+                child(p,dir) = q;
+                conc_set_data(p,dir);
+            }
+            else
+            {
+                child_left(q) = child_right(q) = NULL;
+                rbt->root = q;
+            }
+            __atomic_add_fetch( &rbt->size, 1, __ATOMIC_RELAXED );
+            ret = q;
+            inserted = 1;
+        }
+        else
+        {
+            rc = var->mode == MODE_UPSERT ? rbti_keycmp( def, q, var->key )
+                : rbti_nodecmp( def, q, var->node_arg );
+            if( rc == 0 )
+                break;
+            if( conc_red_child(q,0) && conc_red_child(q,1) ) /* split a 4-node */
+            {
+                lock_node(child_left(q));
+                lock_node(child_right(q));
+                conc_set_black(child_left(q));
+                conc_set_black(child_right(q));
+                unlock_node(child_left(q));
+                unlock_node(child_right(q));
+                if( p ) /* the root stays black */
+                    conc_set_red(q);
+            }
+        }
+        if( p && conc_is_red(q) && conc_is_red(p) ) /* g black, t known */
+        {
+            dir2 = t && conc_is_data(t,1) && child_right(t) == g;
+            if( q == child(p,last) )
+                s = rbti_rotate_conc( def, g, !last );
+            else
+            {
+                child(g,last) = rbti_rotate_conc( def, p, last );
+                s = rbti_rotate_conc( def, g, !last );
+            }
+            if( t )
+                child(t,dir2) = s;
+            else
+                rbt->root = s;
+            if( inserted )
+                break;
+            /* the window is now t, s, ..: keep the path to q */
+            last = dir2;
+            if( s == p ) /* q is still the child dir of p */
+            {
+                unlock_node(g);
+                g = t;
+                t = NULL;
+            }
+            else /* s == q, continue with its child p or g */
+            {
+                dir = rc < 0;
+                if( child(q,dir) == p )
+                    unlock_node(g);
+                else
+                    unlock_node(p);
+                g = t;
+                t = NULL;
+                p = q;
+                q = child(p,dir);
+                continue;
+            }
+        }
+        if( inserted )
+            break;
+
+        /* one level down, release the node above the window */
+        last = dir;
+        dir = rc < 0;
+        if( g )
+        {
+            if( t )
+                unlock_node(t);
+            else if( head )
+                rbti_unlock( &rbt->conc->root_lock );
+            head = 0;
+            t = g;
+        }
+        g = p;
+        p = q;
+        if( conc_is_data(q,dir) )
+        {
+            q = child(q,dir);
+            lock_node(q);
+        }
+        else
+            q = NULL;
+    }
+
+    if( q && !inserted ) /* equal node */
+    {
+        if( var->mode != MODE_INSERT && !conc_is_tomb(q) )
+        {
+            if( var->mode == MODE_UPSERT && var->update )
+                var->update( q, var->ctx );
+            ret = q;
+        }
+        else if( q != var->node_arg && ( conc_is_tomb(q) || !keep )
+            && rbti_conc_reserve( rbt ) != RBT_RC_OK )
+            ret = NULL; /* no room to keep q: not replaced */
+        else if( var->mode != MODE_UPSERT
+            || ( var->node_arg = var->create( var->key, var->ctx ) ) )
+        {
+            if( q != var->node_arg )
+            {
+                rbti_conc_replace( def, rbt, p, dir, q, var->node_arg );
+                unlock_node(var->node_arg);
+                if( conc_is_tomb(q) )
+                {
+                    __atomic_add_fetch( &rbt->size, 1, __ATOMIC_RELAXED );
+                    __atomic_sub_fetch( &rbt->tombs, 1, __ATOMIC_RELAXED );
+                    rbti_conc_retire( rbt, q );
+                }
+                else if( keep )
+                    var->old_node = q;
+                else
+                    rbti_conc_retire( rbt, q );
+            }
+            ret = var->node_arg;
+        }
+        else if( conc_is_tomb(q) || !keep ) /* create failed */
+            rbti_conc_unreserve( rbt );
+    }
+
+    /* release the window */
+    if( q )
+        unlock_node(q);
+    if( p )
+        unlock_node(p);
+    if( g )
+        unlock_node(g);
+    if( t )
+        unlock_node(t);
+    if( head )
+        rbti_unlock( &rbt->conc->root_lock );
+    return ret;
+}
+
+/*********************************************************************
+* static int undelete(...)
+* A duplicate replaced a deleted node (lazy delete), which is freed, or
+* node itself was a deleted node in the tree.
+* Return: 1: node is a new node in the tree, 0: no
+*********************************************************************/
+
+static int undelete(
+    RBTDEF * def,
+    RBT    * rbt,
+    void   * node,
+    void  ** old_node)
+{
+    if( *old_node ? !is_tomb(*old_node) : !is_tomb(node) )
+        return 0;
+    if( *old_node )
+    {
+        rbti_minmax_replace( rbt, *old_node, node );
+        cap_sub(rbt, *old_node);
+        def->freeNode( *old_node );
+        *old_node = NULL;
+    }
+    else
+    {
+        node_color(node) &= ~8;
+        cap_sub(rbt, node); /* counted again as a new node */
+    }
+    rbt->tombs--;
+    return 1;
+}
+
+/*********************************************************************
+* static int insert_buffered(...)
+* Insert into the write buffer (see rbt_buffer), merge it when full.
+* Return: RBT_RC_OK(0), RBT_RC_ERROR(-1)
+*********************************************************************/
+
+static int insert_buffered(
+    RBT   * rbt,
+    void  * node,
+    void ** old_node)
+{
+    int rc;
+
+    rc = rbt_insert_keep( rbt->delta, node, old_node );
+    if( rc == RBT_RC_OK && rbt->journal )
+        rbti_journal( rbt, RBTI_J_INSERT, node );
+    if( rc == RBT_RC_OK
+        && rbt->delta->size + rbt->delta->tombs >= rbt->delta_max )
+        rc = rbt_buffer_merge( rbt );
+    return rc;
+}
+
 /*********************************************************************
 * int rbt_insert_keep(...)
 * Insert a new node, keep old replaced node (if it exist). The replaced
-* old node must then be freed separatly.
+* old node must then be freed separatly. In multiset mode (RBT_MULTISET)
+* nodes are never replaced, equal nodes are ordered by address.
 * Return: RBT_RC_OK(0), RBT_RC_ERROR(-1)
 *********************************************************************/
 
@@ -244,26 +569,48 @@ int rbt_insert_keep(
     RBTDEF * def;
     VAR  Var;
 
+    if( rbt->delta && node ) /* write buffer */
+        return insert_buffered( rbt, node, old_node );
+    lat_begin();
     Var.rbt = rbt;
     def = rbt->def;
 
     if( node == NULL )
         return RBT_RC_ERROR;
+    if( rbt->conc ) /* concurrent mode */
+    {
+        Var.mode = MODE_INSERT;
+        Var.node_arg = node;
+        rc = insert_concurrent( rbt, &Var, old_node != NULL ) ? RBT_RC_OK
+            : RBT_RC_ERROR;
+        if( old_node )
+            *old_node = Var.old_node;
+        lat_end( RBT_LAT_INSERT );
+        return rc;
+    }
     if( old_node )
         *old_node = NULL;
     Var.node_arg = node;
     Var.old_node = NULL;
+    Var.mode = MODE_INSERT;
 
+    relax_room(rbt);
     action = insert_node( def, &Var, &rbt->root );
+    if( Var.old_node && rbt->relax )
+        rbti_relax_replace( rbt, Var.old_node, node );
 
     if( action == ACTION_RED )
     {
         set_black(rbt->root);
         action = ACTION_BLACK;
     }
+    if( action == ACTION_DUPLICATE && rbt->tombs
+        && undelete( def, rbt, node, &Var.old_node ) )
+        action = ACTION_BLACK;
     if( action == ACTION_BLACK )
     {
         rbt->size++;
+        rbti_minmax_insert( def, rbt, node );
         rc = RBT_RC_OK; /* ok */
     }
     else if( action == ACTION_DUPLICATE )
@@ -271,8 +618,14 @@ int rbt_insert_keep(
     else
         rc = RBT_RC_ERROR;  /* error */
 
+    if( def->keyHash && ( action == ACTION_BLACK || Var.old_node ) )
+        rbti_hash_insert( rbt, node, Var.old_node );
+    if( action == ACTION_BLACK || Var.old_node )
+        cap_add(rbt, node);
     if( Var.old_node )
     {
+        rbti_minmax_replace( rbt, Var.old_node, node );
+        cap_sub(rbt, Var.old_node);
         if( old_node )
         {
             child_left(Var.old_node) = NULL;
@@ -284,6 +637,11 @@ int rbt_insert_keep(
             def->freeNode( Var.old_node );
         rc = RBT_RC_OK; /* ok */
     }
+    if( rc == RBT_RC_OK && rbt->journal )
+        rbti_journal( rbt, RBTI_J_INSERT, node );
+    if( rc == RBT_RC_OK )
+        cap_evict(rbt, node);
+    lat_end( RBT_LAT_INSERT );
     return rc;
 }
 
@@ -300,5 +658,160 @@ int rbt_insert(
     return rbt_insert_keep( rbt, node, NULL );
 }
 
+/*********************************************************************
+* static void * find_buffered(...)
+* Return: equal node (or tombstone) in the write buffer, or NULL.
+*********************************************************************/
+
+static void * find_buffered(
+    RBTDEF * def,
+    RBT    * delta,
+    VAR    * var )
+{
+    void * n;
+    int    rc;
+
+    if( var->mode == MODE_UPSERT && delta->tombs == 0 )
+        return rbt_get( delta, var->key );
+    for( n = delta->root ; n ; )
+    {
+        rc = var->mode == MODE_UPSERT ? rbti_keycmp( def, n, var->key )
+                                      : rbti_nodecmp( def, n, var->node_arg );
+        if( rc == 0 )
+            return n;
+        if( rc > 0 ? is_left_thrd(n) : is_right_thrd(n) )
+            return NULL;
+        n = rc > 0 ? child_left(n) : child_right(n);
+    }
+    return NULL;
+}
+
+/*********************************************************************
+* static void * insert_mode(...)
+* Insert by MODE_ABSENT or MODE_UPSERT, in one descent.
+* Return: the new or equal node, or NULL (create failed).
+*********************************************************************/
+
+static void * insert_mode(
+    RBT   * rbt,
+    VAR   * var )
+{
+    RBTDEF * def;
+    int      action;
+
+    if( rbt->conc )
+        return insert_concurrent( rbt, var, 0 );
+    def = rbt->def;
+    var->rbt = rbt;
+    var->old_node = NULL;
+    var->found = NULL;
+
+    if( delta_used(rbt) ) /* the newest node may be there */
+        var->found = find_buffered( def, rbt->delta, var );
+    if( var->found && is_tomb(var->found) ) /* deleted in the buffer */
+    {
+        if( var->mode == MODE_UPSERT )
+            var->node_arg = var->create( var->key, var->ctx );
+        if( var->node_arg == NULL
+            || insert_buffered( rbt, var->node_arg, NULL ) != RBT_RC_OK )
+            return NULL;
+        return var->node_arg;
+    }
+    if( var->found )
+    {
+        if( var->mode == MODE_UPSERT && var->update )
+            var->update( var->found, var->ctx );
+        action = ACTION_FOUND;
+    }
+    else
+    {
+        relax_room(rbt);
+        action = insert_node( def, var, &rbt->root );
+    }
+
+    switch( action )
+    {
+    case ACTION_DUPLICATE: /* replaced a deleted node */
+        if( rbt->relax )
+            rbti_relax_replace( rbt, var->old_node, var->node_arg );
+        undelete( def, rbt, var->node_arg, &var->old_node );
+        /* fall through */
+    case ACTION_RED:
+        set_black(rbt->root);
+        /* fall through */
+    case ACTION_BLACK:
+        rbt->size++;
+        rbti_minmax_insert( def, rbt, var->node_arg );
+        if( def->keyHash )
+            rbti_hash_insert( rbt, var->node_arg, NULL );
+        cap_add(rbt, var->node_arg);
+        if( rbt->journal )
+            rbti_journal( rbt, RBTI_J_INSERT, var->node_arg );
+        cap_evict(rbt, var->node_arg);
+        return var->node_arg;
+    case ACTION_FOUND:
+        if( var->mode == MODE_UPSERT && var->update && rbt->journal )
+            rbti_journal( rbt, RBTI_J_INSERT, var->found );
+        return var->found;
+    default: /* ACTION_ERROR */
+        return NULL;
+    }
+}
+
+/*********************************************************************
+* void * rbt_insert_absent( RBT * rbt, void * node )
+* Insert node if there is no equal node (by nodeCmp, also in multiset
+* mode). If there is, node is not inserted (and not freed).
+* Return: node if inserted, else the equal node in the tree.
+*********************************************************************/
+
+void * rbt_insert_absent(
+    RBT   * rbt,
+    void  * node )
+{
+    VAR     Var;
+    void  * n;
+
+    lat_begin();
+    if( node == NULL )
+        return NULL;
+    Var.mode = MODE_ABSENT;
+    Var.node_arg = node;
+    n = insert_mode( rbt, &Var );
+    lat_end( RBT_LAT_INSERT );
+    return n;
+}
+
+/*********************************************************************
+* void * rbt_upsert(...)
+* Find the node with key (keyCmp) in one descent: if found, call
+* update(node,ctx) (may be NULL) which must not change the key, else
+* call create(key,ctx) for a new node, which is inserted at once (and
+* the tree rebalanced). Eg. for counters keyed in the tree.
+* Return: the updated or new node, or NULL if create returned NULL.
+*********************************************************************/
+
+void * rbt_upsert(
+    RBT   * rbt,
+    void  * key,
+    void *(*create)(void*key,void*ctx),
+    void  (*update)(void*node,void*ctx),
+    void  * ctx )
+{
+    VAR     Var;
+    void  * n;
+
+    lat_begin();
+    Var.mode = MODE_UPSERT;
+    Var.node_arg = NULL;
+    Var.key = key;
+    Var.create = create;
+    Var.update = update;
+    Var.ctx = ctx;
+    n = insert_mode( rbt, &Var );
+    lat_end( RBT_LAT_INSERT );
+    return n;
+}
+
 /***[end-of-file]****************************************************/
 /********************************************************************/
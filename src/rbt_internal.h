@@ -17,10 +17,15 @@
 /*********************************************************************
 *
 * bitmap for color attribute:
-* 00000cba
+* hgfedcba
 *  a: 1=red, 0=black,
 *  b: 1=left data, 0=left thrd
 *  c: 1=right data, 0=right thrd
+*  d: 1=tombstone (lazy delete, see rbt_lazy_delete)
+*  (b, c, d: RBT_LEFT_DATA, RBT_RIGHT_DATA, RBT_TOMB in rbt.h)
+*  e: 1=locked    (concurrent mode, see rbt_concurrent.c)
+*  f: 1=replaced  (concurrent mode, no longer in the tree)
+*  g,h: readers   (concurrent mode, count of shared locks)
 *
 *********************************************************************/
 
@@ -33,15 +38,485 @@
 #define is_red(n)           ((node_color(n)&1)==1)
 #define is_black(n)         ((node_color(n)&1)!=1)
 
-#define set_left_thrd(n)    (node_color(n)&=~2)
-#define set_left_data(n)    (node_color(n)|=2)
-#define is_left_thrd(n)     ((node_color(n)&2)!=2)
-#define is_left_data(n)     ((node_color(n)&2)==2)
+#define set_left_thrd(n)    (node_color(n)&=~RBT_LEFT_DATA)
+#define set_left_data(n)    (node_color(n)|=RBT_LEFT_DATA)
+#define is_left_thrd(n)     ((node_color(n)&RBT_LEFT_DATA)==0)
+#define is_left_data(n)     ((node_color(n)&RBT_LEFT_DATA)!=0)
 
-#define set_right_thrd(n)   (node_color(n)&=~4)
-#define set_right_data(n)   (node_color(n)|=4)
-#define is_right_thrd(n)    ((node_color(n)&4)!=4)
-#define is_right_data(n)    ((node_color(n)&4)==4)
+#define set_right_thrd(n)   (node_color(n)&=~RBT_RIGHT_DATA)
+#define set_right_data(n)   (node_color(n)|=RBT_RIGHT_DATA)
+#define is_right_thrd(n)    ((node_color(n)&RBT_RIGHT_DATA)==0)
+#define is_right_data(n)    ((node_color(n)&RBT_RIGHT_DATA)!=0)
+
+/* by direction d (0: left, 1: right): */
+#define child(n,d)          (*(void**)((char*)(n)+((d)?def->right_ofs:def->left_ofs)))
+#define is_data(n,d)        ((node_color(n)&((d)?RBT_RIGHT_DATA:RBT_LEFT_DATA))!=0)
+#define set_data(n,d)       (node_color(n)|=((d)?RBT_RIGHT_DATA:RBT_LEFT_DATA))
+#define set_thrd(n,d)       (node_color(n)&=~((d)?RBT_RIGHT_DATA:RBT_LEFT_DATA))
+#define red_child(n,d)      (is_data(n,d) && is_red(child(n,d)))
+
+#define set_tomb(n)         (node_color(n)|=RBT_TOMB)
+#define is_tomb(n)          ((node_color(n)&RBT_TOMB)!=0)
+#define node_links(n)       (node_color(n)&7)  /* color without tombstone */
+#define is_tomb_node(r,n)   ((*((char*)(n)+(r)->def->color_ofs)&RBT_TOMB)!=0)
+
+/* write buffer (see rbt_buffer): it has nodes (or tombstones), which
+   the reads see by a merged cursor; merge it before using the main
+   tree otherwise: */
+#define delta_used(r)       ((r)->delta && (r)->delta->root)
+#define delta_merge(r)      do{ if( delta_used(r) ) \
+                                rbt_buffer_merge( r ); }while(0)
+
+/* relaxed balance (see rbt_rebalance.c): the inserts record the new
+   red nodes with a red parent, repaired later (some may be fixed by
+   then); the deletes are lazy. Repair all before a delete that
+   rebalances, or an operation that moves many nodes: */
+struct RBTRELAX {
+    size_t     max;               /* max recorded nodes */
+    size_t     n;                 /* recorded nodes */
+    void    ** viol;              /* the recorded nodes */
+};
+
+#define lazy_delete(r)      ((r)->lazy || (r)->relax)
+#define relax_fix(r)        do{ if( (r)->relax && (r)->relax->n ) \
+                                rbti_relax_fix( r ); }while(0)
+#define relax_add(r,x)      ((r)->relax->viol[(r)->relax->n++] = (x))
+#define relax_room(r)       do{ if( (r)->relax && (r)->relax->n == \
+                                (r)->relax->max ) \
+                                rbt_rebalance_step( r, 1 ); }while(0)
+
+/* the size of a tree from rbt_split is counted when needed, before
+   rbt->size is used as a count (see rbti_size_count in rbt_join.c): */
+#define size_count(r)       do{ if( (r)->size_unknown ) \
+                                rbti_size_count( r ); }while(0)
+
+/* cached first and last node (see rbt_first.c), kept by the writers
+   only: */
+#define minmax_reset(r)     ((r)->minmax_gen = (r)->del_gen - 1)
+
+void   rbti_minmax( RBT * rbt );
+
+static inline void rbti_minmax_insert( RBTDEF * def, RBT * rbt, void * n )
+{
+    if( rbt->minmax_gen != rbt->del_gen )
+    {
+        rbti_minmax( rbt ); /* eg. after a split, O(log n) */
+        return;
+    }
+    if( is_left_thrd(n) && child_left(n) == NULL )
+        rbt->first = n;
+    if( is_right_thrd(n) && child_right(n) == NULL )
+        rbt->last = n;
+}
+
+/* node n took the place of old_node, which leaves the tree: */
+static inline void rbti_minmax_replace( RBT * rbt, void * old_node,
+    void * n )
+{
+    if( rbt->minmax_gen == rbt->del_gen )
+    {
+        if( rbt->first == old_node )
+            rbt->first = n;
+        if( rbt->last == old_node )
+            rbt->last = n;
+        rbt->minmax_gen++;
+    }
+    rbt->del_gen++;
+}
+
+/* node bytes of a tree with size limits (see rbt_capacity.c), kept up
+   to date while rbt->cap is set, or unknown (recounted when needed): */
+#define RBTI_BYTES_UNKNOWN  ((size_t)-1)
+#define cap_add(r,n)        do{ if( (r)->cap && (r)->bytes != \
+                                RBTI_BYTES_UNKNOWN ) (r)->bytes += \
+                                rbti_node_bytes( r, n ); }while(0)
+#define cap_sub(r,n)        do{ if( (r)->cap && (r)->bytes != \
+                                RBTI_BYTES_UNKNOWN ) (r)->bytes -= \
+                                rbti_node_bytes( r, n ); }while(0)
+#define cap_drop(r)         ((r)->bytes = RBTI_BYTES_UNKNOWN)
+#define cap_evict(r,n)      do{ if( (r)->cap ) \
+                                rbti_cap_evict( r, n ); }while(0)
+
+static inline size_t rbti_node_bytes( RBT * rbt, void * n )
+{
+    return rbt->cap->nodeBytes ? rbt->cap->nodeBytes( n )
+                               : rbt->def->node_size;
+}
+
+/* concurrent mode (see rbt_concurrent.c): a spin lock per node in the
+   upper bits of its color (c points to the color, or a root lock),
+   taken top-down only: exclusive by a writer (the lock bit), or shared
+   by up to 3 readers (a count). Colors and links of a node change only
+   while it is locked exclusively; other threads meanwhile test and set
+   its lock bits, and read the color of a child they do not hold, so in
+   this mode the color is read and changed by atomic operations only
+   (the conc_ macros). */
+#define NODE_LOCK           16
+#define NODE_REPLACED       32
+#define NODE_READER         64      /* one shared lock, */
+#define NODE_READERS        192     /*   the count of them */
+#define conc_color(n)       __atomic_load_n( &node_color(n), __ATOMIC_RELAXED )
+#define conc_or(n,b)        ((void)__atomic_fetch_or( &node_color(n), \
+                                (char)(b), __ATOMIC_RELAXED ))
+#define conc_and(n,b)       ((void)__atomic_fetch_and( &node_color(n), \
+                                (char)(b), __ATOMIC_RELAXED ))
+#define conc_is_red(n)      ((conc_color(n)&1)!=0)
+#define conc_is_black(n)    ((conc_color(n)&1)==0)
+#define conc_set_red(n)     conc_or(n,1)
+#define conc_set_black(n)   conc_and(n,~1)
+#define conc_is_data(n,d)   ((conc_color(n)&((d)?RBT_RIGHT_DATA:RBT_LEFT_DATA))!=0)
+#define conc_set_data(n,d)  conc_or(n,(d)?RBT_RIGHT_DATA:RBT_LEFT_DATA)
+#define conc_set_thrd(n,d)  conc_and(n,~((d)?RBT_RIGHT_DATA:RBT_LEFT_DATA))
+#define conc_red_child(n,d) (conc_is_data(n,d) && conc_is_red(child(n,d)))
+#define conc_is_tomb(n)     ((conc_color(n)&RBT_TOMB)!=0)
+#define conc_set_tomb(n)    conc_or(n,RBT_TOMB)
+#define is_replaced(n)      ((conc_color(n)&NODE_REPLACED)!=0)
+#define set_replaced(n)     conc_or(n,NODE_REPLACED)
+#define lock_node(n)        rbti_lock( &node_color(n) )
+#define unlock_node(n)      rbti_unlock( &node_color(n) )
+#define lock_shared(n)      rbti_lock_shared( &node_color(n) )
+#define unlock_shared(n)    rbti_unlock_shared( &node_color(n) )
+
+#define RBTI_CONC_THREADS   64  /* threads that may hold nodes */
+
+typedef struct RBTIRETIRED {
+    void          * node;         /* out of the tree, */
+    unsigned long   epoch;        /*   since this epoch */
+} RBTIRETIRED;
+
+typedef struct RBTISLOT {
+    const void    * id;           /* thread (see rbt_concurrent.c), */
+    unsigned long   seen;         /*   epoch at its last rbt_quiescent */
+    char            pad[64 - sizeof(void*) - sizeof(unsigned long)];
+} RBTISLOT;
+
+struct RBTCONC {
+    char          root_lock;      /* lock of rbt->root */
+    char          retire_lock;    /* lock of retired, epoch and slot */
+    int           no_free;        /* a thread got no slot: keep all */
+    RBTIRETIRED * retired;        /* deleted and replaced nodes, in */
+    size_t        n_retired;      /*   epoch order, freed when all */
+    size_t        max_retired;    /*   threads have seen a later one */
+    size_t        reserved;       /* room reserved in retired */
+    unsigned long epoch;          /* advanced when all have seen it */
+    RBTISLOT      slot[RBTI_CONC_THREADS];
+};
+
+void   rbti_lock_wait( char * c );
+void   rbti_lock_shared_wait( char * c );
+
+static inline void rbti_lock( char * c )
+{
+    char old;
+
+    old = __atomic_load_n( c, __ATOMIC_RELAXED ) & ~(NODE_LOCK|NODE_READERS);
+    if( !__atomic_compare_exchange_n( c, &old, old | NODE_LOCK, 0,
+            __ATOMIC_ACQUIRE, __ATOMIC_RELAXED ) )
+        rbti_lock_wait( c );
+}
+
+static inline void rbti_unlock( char * c )
+{
+    __atomic_fetch_and( c, (char)~NODE_LOCK, __ATOMIC_RELEASE );
+}
+
+static inline void rbti_lock_shared( char * c )
+{
+    char old;
+
+    old = __atomic_load_n( c, __ATOMIC_RELAXED );
+    if( ( old & NODE_LOCK ) || ( old & NODE_READERS ) == NODE_READERS
+        || !__atomic_compare_exchange_n( c, &old, (char)( old + NODE_READER ),
+            0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED ) )
+        rbti_lock_shared_wait( c );
+}
+
+static inline void rbti_unlock_shared( char * c )
+{
+    __atomic_fetch_sub( c, (char)NODE_READER, __ATOMIC_RELEASE );
+}
+
+/* multiset mode: equal nodes are ordered by address */
+#define is_multiset(def)    (((def)->flags & RBT_MULTISET)!=0)
+
+/* fixed-length keys (def->key_len, see rbt_key.c): compared inline as
+   unsigned bytes (memcmp order), 16 at a time with SSE2 (32 if built
+   with AVX2), else 8; keys of RBT_KEY_LONG bytes or more are compared
+   with AVX2 if the CPU has it: */
+#if defined(__x86_64__) || ( defined(__i386__) && defined(__SSE2__) )
+#include <immintrin.h>
+#define RBT_KEY_SIMD
+#endif
+#define RBT_KEY_LONG        64
+#define key_of(n)           ((const unsigned char*)(n)+def->key_ofs)
+
+int    rbti_bytes_cmp_long( const unsigned char * a,
+                  const unsigned char * b, size_t len );
+
+/* compare from byte i, after the longer steps */
+static inline int rbti_bytes_cmp_from( const unsigned char * a,
+    const unsigned char * b, size_t len, size_t i )
+{
+    unsigned long long x, y;
+#ifdef RBT_KEY_SIMD
+    unsigned m;
+
+    for( ; i + 16 <= len ; i += 16 )
+    {
+        m = 0xFFFFu ^ (unsigned)_mm_movemask_epi8( _mm_cmpeq_epi8(
+            _mm_loadu_si128( (const __m128i*)( a + i ) ),
+            _mm_loadu_si128( (const __m128i*)( b + i ) ) ) );
+        if( m )
+        {
+            i += __builtin_ctz( m );
+            return a[i] - b[i];
+        }
+    }
+#endif
+    for( ; i + 8 <= len ; i += 8 )
+    {
+        __builtin_memcpy( &x, a + i, 8 );
+        __builtin_memcpy( &y, b + i, 8 );
+        if( x != y )
+        {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+            x = __builtin_bswap64( x );
+            y = __builtin_bswap64( y );
+#endif
+            return x < y ? -1 : 1;
+        }
+    }
+    for( ; i < len ; i++ )
+        if( a[i] != b[i] )
+            return a[i] - b[i];
+    return 0;
+}
+
+static inline int rbti_bytes_cmp( const unsigned char * a,
+    const unsigned char * b, size_t len )
+{
+    size_t i;
+
+    i = 0;
+#if defined(RBT_KEY_SIMD) && !defined(__AVX2__)
+    if( len >= RBT_KEY_LONG )
+        return rbti_bytes_cmp_long( a, b, len );
+#endif
+#ifdef __AVX2__
+    for( ; i + 32 <= len ; i += 32 )
+    {
+        unsigned m = ~(unsigned)_mm256_movemask_epi8( _mm256_cmpeq_epi8(
+            _mm256_loadu_si256( (const __m256i*)( a + i ) ),
+            _mm256_loadu_si256( (const __m256i*)( b + i ) ) ) );
+        if( m )
+        {
+            i += __builtin_ctz( m );
+            return a[i] - b[i];
+        }
+    }
+#endif
+    return rbti_bytes_cmp_from( a, b, len, i );
+}
+
+/* def->keyCmp( node, key ) */
+static inline int rbti_keycmp( RBTDEF * def, void * node, void * key )
+{
+    if( def->key_len )
+        return rbti_bytes_cmp( key_of(node), (const unsigned char*)key,
+            def->key_len );
+    return def->keyCmp( node, key );
+}
+
+/* def->nodeCmp( n1, n2 ) */
+static inline int rbti_nodecmp( RBTDEF * def, void * n1, void * n2 )
+{
+    if( def->key_len )
+        return rbti_bytes_cmp( key_of(n1), key_of(n2), def->key_len );
+    return def->nodeCmp( n1, n2 );
+}
+
+/* cmp( node, key ) for a cmp argument, inline if it is def->keyCmp or
+   def->nodeCmp of a fixed-length key: */
+static inline int rbti_cmp( RBTDEF * def, int (*cmp)(void*,void*),
+    void * node, void * key )
+{
+    if( def->key_len && cmp == def->keyCmp )
+        return rbti_keycmp( def, node, key );
+    if( def->key_len && cmp == def->nodeCmp )
+        return rbti_nodecmp( def, node, key );
+    return cmp( node, key );
+}
+
+static inline int rbti_node_cmp( RBTDEF * def, void * n1, void * n2 )
+{
+    int rc;
+
+    rc = rbti_nodecmp( def, n1, n2 );
+    if( rc == 0 && is_multiset(def) )
+        rc = (char*)n1 < (char*)n2 ? -1 : (char*)n1 > (char*)n2;
+    return rc;
+}
+
+/* rotate subtree root to side dir (its child on side !dir moves up),
+   the old root becomes red and the new one black; returns the new
+   root of the subtree: */
+static inline void * rbti_rotate( RBTDEF * def, void * root, int dir )
+{
+    void * save;
+
+    save = child(root,!dir);
+    if( !is_data(save,dir) ) /* save has a thread back to root */
+    {
+        child(root,!dir) = save;
+        set_thrd(root,!dir);
+        set_data(save,dir);
+    }
+    else
+        child(root,!dir) = child(save,dir);
+    child(save,dir) = root;
+    set_red(root);
+    set_black(save);
+    return save;
+}
+
+/* rbti_rotate in concurrent mode, root and its child on side !dir
+   locked: */
+static inline void * rbti_rotate_conc( RBTDEF * def, void * root, int dir )
+{
+    void * save;
+
+    save = child(root,!dir);
+    if( !conc_is_data(save,dir) ) /* save has a thread back to root */
+    {
+        child(root,!dir) = save;
+        conc_set_thrd(root,!dir);
+        conc_set_data(save,dir);
+    }
+    else
+        child(root,!dir) = child(save,dir);
+    child(save,dir) = root;
+    conc_set_red(root);
+    conc_set_black(save);
+    return save;
+}
+
+/* in-order neighbours by the threads: */
+static inline void * rbti_next( RBTDEF * def, void * n )
+{
+    if( is_right_thrd(n) )
+        return child_right(n);
+    n = child_right(n);
+    while( is_left_data(n) )
+        n = child_left(n);
+    return n;
+}
+
+static inline void * rbti_prev( RBTDEF * def, void * n )
+{
+    if( is_left_thrd(n) )
+        return child_left(n);
+    n = child_left(n);
+    while( is_right_data(n) )
+        n = child_right(n);
+    return n;
+}
+
+/* operation statistics, r is the RBT and f a RBTSTATS field: */
+#ifdef RBT_STATS
+#define stat_inc(r,f)       ((r)->stats.f++)
+#else
+#define stat_inc(r,f)       ((void)(r))
+#endif
+
+/* latency of an operation: lat_begin() after the declarations, and
+   lat_end(RBT_LAT_xxx) at the end: */
+#ifdef RBT_LATENCY
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define rbti_ticks()        __rdtsc()
+#else
+unsigned long long rbti_ticks( void );
+#endif
+void rbti_lat_record( int op, unsigned long long t0 );
+#define lat_begin()         unsigned long long lat_t0 = rbti_ticks()
+#define lat_end(op)         rbti_lat_record( op, lat_t0 )
+#else
+#define lat_begin()         ((void)0)
+#define lat_end(op)         ((void)0)
+#endif
+
+/*********************************************************************
+*
+* internal functions shared between the rbt_ modules.
+* (rbt.h must be included first)
+*
+*********************************************************************/
+
+/* rbt_capacity.c: */
+void   rbti_cap_evict( RBT * rbt, void * keep );
+
+/* rbt_concurrent.c: */
+void   rbti_conc_join( RBT * rbt );
+void   rbti_conc_replace( RBTDEF * def, RBT * rbt, void * p, int dir,
+    void * q, void * n );
+int    rbti_conc_reserve( RBT * rbt );
+void   rbti_conc_unreserve( RBT * rbt );
+void   rbti_conc_retire( RBT * rbt, void * node );
+size_t rbti_conc_bytes( RBT * rbt );
+
+/* rbt_rebalance.c: */
+void   rbti_relax_fix( RBT * rbt );
+void   rbti_relax_replace( RBT * rbt, void * old_node, void * node );
+
+/* rbt_replica.c: */
+void   rbti_repl_drop( RBT * rbt );
+size_t rbti_repl_bytes( RBT * rbt );
+
+/* rbt_first.c (and rbti_minmax, above): */
+void * rbti_find_concurrent( RBT * rbt, int (*cmp)(void*,void*),
+    void * key, int dir, int gt );
+void * rbti_buffered_pick( RBT * rbt, void * n, void * x, int dir );
+
+/* rbt_buffer.c: */
+size_t rbti_buffered_size( RBT * rbt );
+
+/* rbt_join.c: */
+void   rbti_size_count( RBT * rbt );
+void * rbti_join( RBTDEF * def, void * l, int bhl, void * k,
+                  void * r, int bhr, int * bh );
+void * rbti_join_fix( RBTDEF * def, void * l, int bhl, void * k,
+                  void * r, int bhr, int * bh );
+void * rbti_join2( RBTDEF * def, void * l, int bhl,
+                  void * r, int bhr, int * bh );
+void   rbti_split( RBTDEF * def, void * t, int bh,
+                  int (*cmp)(void*,void*), void * key, int eq_left,
+                  void ** l, int * bhl, void ** r, int * bhr,
+                  void ** eq );
+void * rbti_split_first( RBTDEF * def, void * t, int bh,
+                  void ** first, int * bh_out );
+int    rbti_black_height( RBTDEF * def, void * t );
+void * rbti_min( RBTDEF * def, void * t );
+void * rbti_max( RBTDEF * def, void * t );
+void * rbti_build( RBTDEF * def, void * list, size_t n );
+
+/* rbt_dump.c: */
+void   rbti_checksum( unsigned long long sum[2], const void * buf,
+                  size_t len );
+
+/* rbt_journal.c: journal record types */
+#define RBTI_J_INSERT  1
+#define RBTI_J_DELETE  2
+#define RBTI_J_CLEAR   3
+void   rbti_journal( RBT * rbt, int op, void * node );
+size_t rbti_journal_bytes( RBT * rbt );
+
+/* rbt_hash.c: */
+void   rbti_hash_insert( RBT * rbt, void * node, void * old_node );
+void   rbti_hash_delete( RBT * rbt, void * node );
+void   rbti_hash_drop( RBT * rbt );
+void   rbti_hash_clear( RBT * rbt );
+void * rbti_hash_get( RBT * rbt, void * key );
+size_t rbti_hash_bytes( RBT * rbt );
 
 #endif//RBT_INTERNAL_H_
 
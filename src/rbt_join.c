@@ -0,0 +1,722 @@
+/*********************************************************************
+* Red Black Tree functions (threaded)
+*
+* rbt_join.c
+*
+**********************************************************************
+* functions:
+*
+*   int rbt_split( RBT * rbt, void * key, RBT * left_out, RBT * right_out )
+*   int rbt_join ( RBT * left, void * pivot, RBT * right )
+*
+* internal functions (see rbt_internal.h):
+*
+*   void * rbti_join ( RBTDEF * def, void * l, int bhl, void * k,
+*                      void * r, int bhr, int * bh )
+*   void * rbti_join_fix( RBTDEF * def, void * l, int bhl, void * k,
+*                      void * r, int bhr, int * bh )
+*   void * rbti_join2( RBTDEF * def, void * l, int bhl,
+*                      void * r, int bhr, int * bh )
+*   void   rbti_split( RBTDEF * def, void * t, int bh,
+*                      int (*cmp)(void*,void*), void * key, int eq_left,
+*                      void ** l, int * bhl, void ** r, int * bhr,
+*                      void ** eq )
+*   void * rbti_split_first( RBTDEF * def, void * t, int bh,
+*                      void ** first, int * bh_out )
+*   int    rbti_black_height( RBTDEF * def, void * t )
+*   void * rbti_min( RBTDEF * def, void * t )
+*   void * rbti_max( RBTDEF * def, void * t )
+*   void * rbti_build( RBTDEF * def, void * list, size_t n )
+*   void   rbti_size_count( RBT * rbt )
+*
+**********************************************************************
+* Join and split of (sub)trees, based on black heights, in O(log n).
+*
+* Thread pointers: a join of (l, k, r) expects the right thread of the
+* last node in l and the left thread of the first node in r to point
+* to k already (true for split, where k is the original neighbour).
+* An empty side of k keeps its thread if it was a thread, and becomes
+* a NULL thread if it was a data link. The caller has to set the
+* outermost threads of the final tree(s) to NULL.
+**********************************************************************
+* Copyright (c) 2020 Michael Walsh Pedersen
+*********************************************************************/
+
+#include "rbt.h"
+#include "rbt_internal.h"
+
+#define left_of(n)   (is_left_data(n)  ? child_left(n)  : NULL)
+#define right_of(n)  (is_right_data(n) ? child_right(n) : NULL)
+
+/*********************************************************************
+* static void link_left(...), link_right(...)
+* Set a child of k. An empty child becomes a thread to 'thrd' (if not
+* NULL), a NULL thread if it was a data link, else it is kept.
+*********************************************************************/
+
+static void link_left(
+    RBTDEF * def,
+    void   * k,
+    void   * c,
+    void   * thrd)
+{
+    if( c )
+    {
+        child_left(k) = c;
+        set_left_data(k);
+    }
+    else if( thrd )
+    {
+        child_left(k) = thrd;
+        set_left_thrd(k);
+    }
+    else if( is_left_data(k) )
+    {
+        child_left(k) = NULL;
+        set_left_thrd(k);
+    }
+}
+
+static void link_right(
+    RBTDEF * def,
+    void   * k,
+    void   * c,
+    void   * thrd)
+{
+    if( c )
+    {
+        child_right(k) = c;
+        set_right_data(k);
+    }
+    else if( thrd )
+    {
+        child_right(k) = thrd;
+        set_right_thrd(k);
+    }
+    else if( is_right_data(k) )
+    {
+        child_right(k) = NULL;
+        set_right_thrd(k);
+    }
+}
+
+/*********************************************************************
+* static void * rotate_left(...), rotate_right(...)
+* Return: new subtree root.
+*********************************************************************/
+
+static void * rotate_left(
+    RBTDEF * def,
+    void   * p)
+{
+    void * s;
+
+    s = child_right(p);
+    if( is_left_thrd(s) ) /**/
+    {
+        child_right(p) = s;
+        set_right_thrd(p);
+        set_left_data(s);
+    }
+    else
+        child_right(p) = child_left(s);
+    child_left(s) = p;
+    return s;
+}
+
+static void * rotate_right(
+    RBTDEF * def,
+    void   * p)
+{
+    void * s;
+
+    s = child_left(p);
+    if( is_right_thrd(s) ) /**/
+    {
+        child_left(p) = s;
+        set_left_thrd(p);
+        set_right_data(s);
+    }
+    else
+        child_left(p) = child_right(s);
+    child_right(s) = p;
+    return s;
+}
+
+/*********************************************************************
+* static void * join_right(...)
+* Join k and r into the right spine of t (bht > bhr).
+* p is the parent of t (when t is a right child).
+* Return: new subtree root (same black height as t).
+*********************************************************************/
+
+static void * join_right(
+    RBTDEF * def,
+    void   * t,
+    int      bht,
+    void   * k,
+    void   * r,
+    int      bhr,
+    void   * p)
+{
+    void * c;
+
+    if( t == NULL || ( is_black(t) && bht == bhr ) )
+    {
+        link_left( def, k, t, t ? NULL : p );
+        link_right( def, k, r, NULL );
+        set_red(k);
+        return k;
+    }
+    c = join_right( def, right_of(t), bht - (is_black(t) ? 1 : 0),
+        k, r, bhr, t );
+    child_right(t) = c;
+    set_right_data(t);
+    if( is_black(t) && is_red(c) && is_right_data(c)
+        && is_red(child_right(c)) )
+    {
+        set_black(child_right(c));
+        return rotate_left( def, t );
+    }
+    return t;
+}
+
+/*********************************************************************
+* static void * join_left(...)
+* Join l and k into the left spine of t (bht > bhl).
+* p is the parent of t (when t is a left child).
+* Return: new subtree root (same black height as t).
+*********************************************************************/
+
+static void * join_left(
+    RBTDEF * def,
+    void   * l,
+    int      bhl,
+    void   * k,
+    void   * t,
+    int      bht,
+    void   * p)
+{
+    void * c;
+
+    if( t == NULL || ( is_black(t) && bht == bhl ) )
+    {
+        link_left( def, k, l, NULL );
+        link_right( def, k, t, t ? NULL : p );
+        set_red(k);
+        return k;
+    }
+    c = join_left( def, l, bhl, k, left_of(t),
+        bht - (is_black(t) ? 1 : 0), t );
+    child_left(t) = c;
+    set_left_data(t);
+    if( is_black(t) && is_red(c) && is_left_data(c)
+        && is_red(child_left(c)) )
+    {
+        set_black(child_left(c));
+        return rotate_right( def, t );
+    }
+    return t;
+}
+
+/*********************************************************************
+* void * rbti_join(...)
+* Join l, k and r (all nodes in l < k < all nodes in r).
+* Return: new root (may be red), black height in *bh.
+*********************************************************************/
+
+void * rbti_join(
+    RBTDEF * def,
+    void   * l,
+    int      bhl,
+    void   * k,
+    void   * r,
+    int      bhr,
+    int    * bh)
+{
+    void * t;
+
+    if( bhl > bhr )
+    {
+        t = join_right( def, l, bhl, k, r, bhr, NULL );
+        *bh = bhl;
+        if( is_red(t) && is_right_data(t) && is_red(child_right(t)) )
+        {
+            set_black(t);
+            (*bh)++;
+        }
+        return t;
+    }
+    if( bhr > bhl )
+    {
+        t = join_left( def, l, bhl, k, r, bhr, NULL );
+        *bh = bhr;
+        if( is_red(t) && is_left_data(t) && is_red(child_left(t)) )
+        {
+            set_black(t);
+            (*bh)++;
+        }
+        return t;
+    }
+    link_left( def, k, l, NULL );
+    link_right( def, k, r, NULL );
+    if( ( l == NULL || is_black(l) ) && ( r == NULL || is_black(r) ) )
+    {
+        set_red(k);
+        *bh = bhl;
+    }
+    else
+    {
+        set_black(k);
+        *bh = bhl + 1;
+    }
+    return k;
+}
+
+/*********************************************************************
+* void * rbti_join_fix(...)
+* Join l, k and r, where k is a new node (not from l or r), and l and r
+* are complete trees (the outermost threads are ignored).
+* Return: new root (may be red), black height in *bh.
+*********************************************************************/
+
+void * rbti_join_fix(
+    RBTDEF * def,
+    void   * l,
+    int      bhl,
+    void   * k,
+    void   * r,
+    int      bhr,
+    int    * bh)
+{
+    child_left(k)  = NULL;
+    child_right(k) = NULL;
+    node_color(k)  = 0;
+    if( l )
+        child_right(rbti_max( def, l )) = k; /* thread ptr */
+    if( r )
+        child_left(rbti_min( def, r )) = k;  /* thread ptr */
+    return rbti_join( def, l, bhl, k, r, bhr, bh );
+}
+
+/*********************************************************************
+* void * rbti_join2(...)
+* Join two complete trees l and r (all nodes in l < all nodes in r),
+* the first node in r is used as pivot.
+* Return: new root (may be red), black height in *bh.
+*********************************************************************/
+
+void * rbti_join2(
+    RBTDEF * def,
+    void   * l,
+    int      bhl,
+    void   * r,
+    int      bhr,
+    int    * bh)
+{
+    void * k;
+
+    if( r == NULL )
+    {
+        if( l )
+            child_right(rbti_max( def, l )) = NULL; /* thread ptr */
+        *bh = bhl;
+        return l;
+    }
+    r = rbti_split_first( def, r, bhr, &k, &bhr );
+    return rbti_join_fix( def, l, bhl, k, r, bhr, bh );
+}
+
+/*********************************************************************
+* void rbti_split(...)
+* Split t into l (cmp < 0) and r (cmp > 0). Nodes with cmp == 0 goes
+* to l if eq_left, else to r. A NULL cmp splits by the tree order
+* (rbti_node_cmp, key is a node): in a multiset at this very node.
+* If eq is not NULL, the first node found with cmp == 0 is removed and
+* returned in *eq instead (else NULL).
+*********************************************************************/
+
+void rbti_split(
+    RBTDEF * def,
+    void   * t,
+    int      bh,
+    int    (*cmp)(void*,void*),
+    void   * key,
+    int      eq_left,
+    void  ** l,
+    int    * bhl,
+    void  ** r,
+    int    * bhr,
+    void  ** eq)
+{
+    void * a;
+    void * b;
+    int    bha;
+    int    bhb;
+    int    rc;
+
+    if( eq )
+        *eq = NULL;
+    if( t == NULL )
+    {
+        *l = *r = NULL;
+        *bhl = *bhr = 0;
+        return;
+    }
+    bh -= is_black(t) ? 1 : 0; /* black height of the children */
+    rc = cmp ? rbti_cmp( def, cmp, t, key ) : rbti_node_cmp( def, t, key );
+    if( rc == 0 && eq ) /* t is removed */
+    {
+        *eq = t;
+        *l = left_of(t);
+        *r = right_of(t);
+        *bhl = *bhr = bh;
+        return;
+    }
+    if( rc < 0 || ( rc == 0 && eq_left ) ) /* t goes left */
+    {
+        rbti_split( def, right_of(t), bh, cmp, key, eq_left,
+            &a, &bha, &b, &bhb, eq );
+        *l = rbti_join( def, left_of(t), bh, t, a, bha, bhl );
+        *r = b;
+        *bhr = bhb;
+    }
+    else /* t goes right */
+    {
+        rbti_split( def, left_of(t), bh, cmp, key, eq_left,
+            &a, &bha, &b, &bhb, eq );
+        *r = rbti_join( def, b, bhb, t, right_of(t), bh, bhr );
+        *l = a;
+        *bhl = bha;
+    }
+}
+
+/*********************************************************************
+* void * rbti_split_first(...)
+* Remove the first node of t, returned in *first.
+* The left thread of the new first node still points to *first.
+* Return: new root, black height in *bh_out.
+*********************************************************************/
+
+void * rbti_split_first(
+    RBTDEF * def,
+    void   * t,
+    int      bh,
+    void  ** first,
+    int    * bh_out)
+{
+    void * rest;
+    int    bhrest;
+
+    bh -= is_black(t) ? 1 : 0; /* black height of the children */
+    if( is_left_thrd(t) )
+    {
+        *first = t;
+        *bh_out = bh;
+        return right_of(t);
+    }
+    rest = rbti_split_first( def, child_left(t), bh, first, &bhrest );
+    return rbti_join( def, rest, bhrest, t, right_of(t), bh, bh_out );
+}
+
+/*********************************************************************
+* int rbti_black_height(...)
+* Return: count of black nodes on the left spine of t.
+*********************************************************************/
+
+int rbti_black_height(
+    RBTDEF * def,
+    void   * t)
+{
+    int bh;
+
+    for( bh = 0 ; t ; t = left_of(t) )
+        if( is_black(t) )
+            bh++;
+    return bh;
+}
+
+/*********************************************************************
+* void * rbti_min(...), rbti_max(...)
+* Return: first/last node of subtree t or NULL.
+*********************************************************************/
+
+void * rbti_min(
+    RBTDEF * def,
+    void   * t)
+{
+    if( t )
+        while( is_left_data(t) )
+            t = child_left(t);
+    return t;
+}
+
+void * rbti_max(
+    RBTDEF * def,
+    void   * t)
+{
+    if( t )
+        while( is_right_data(t) )
+            t = child_right(t);
+    return t;
+}
+
+/*********************************************************************
+* static void * build(...)
+* Build a balanced tree of the next n nodes in the list.
+*********************************************************************/
+
+typedef struct {
+    void * list;      /* next node to use */
+    void * prev;      /* previous node used */
+    void * pend;      /* node waiting for its right thread */
+    int    red_depth; /* nodes on this depth are red */
+} BUILD;
+
+static void * build(
+    RBTDEF * def,
+    BUILD  * b,
+    size_t   n,
+    int      depth)
+{
+    void * k;
+    void * c;
+
+    if( n == 0 )
+        return NULL;
+    c = build( def, b, (n-1)/2, depth+1 );
+    k = b->list;
+    b->list = child_right(k);
+    node_color(k) = 0;
+    if( depth == b->red_depth )
+        set_red(k);
+    if( c )
+    {
+        child_left(k) = c;
+        set_left_data(k);
+    }
+    else
+        child_left(k) = b->prev; /* thread ptr */
+    if( b->pend )
+        child_right(b->pend) = k; /* thread ptr */
+    b->pend = NULL;
+    b->prev = k;
+    c = build( def, b, n/2, depth+1 );
+    if( c )
+    {
+        child_right(k) = c;
+        set_right_data(k);
+    }
+    else
+    {
+        child_right(k) = NULL; /* thread ptr, set by the next node */
+        b->pend = k;
+    }
+    return k;
+}
+
+/*********************************************************************
+* void * rbti_build(...)
+* Build a tree from n sorted nodes, in a list linked by the right
+* pointer, in O(n) and without compares. Nodes on the deepest level
+* are red, all other nodes are black.
+* Return: new root (black).
+*********************************************************************/
+
+void * rbti_build(
+    RBTDEF * def,
+    void   * list,
+    size_t   n)
+{
+    BUILD  b;
+    void * root;
+
+    b.list = list;
+    b.prev = NULL;
+    b.pend = NULL;
+    for( b.red_depth = 0 ; (n >> b.red_depth) > 1 ; b.red_depth++ )
+        ;
+    root = build( def, &b, n, 0 );
+    if( root )
+        set_black(root);
+    return root;
+}
+
+/*********************************************************************
+* void rbti_size_count(...)
+* Count the nodes of a tree from rbt_split (without the tombstones), in
+* O(n): once, when the size is used (rbt_size etc.), not by the split.
+*********************************************************************/
+
+void rbti_size_count(
+    RBT    * rbt)
+{
+    RBTDEF * def;
+    void   * n;
+    size_t   cnt;
+
+    def = rbt->def;
+    cnt = 0;
+    for( n = rbti_min( def, rbt->root ) ; n ; n = rbti_next( def, n ) )
+        if( !is_tomb(n) )
+            cnt++;
+    rbt->size = cnt;
+    rbt->size_unknown = 0;
+}
+
+/*********************************************************************
+* int rbt_split( RBT * rbt, void * key, RBT * left_out, RBT * right_out )
+* Move all nodes < key to left_out and all nodes >= key to right_out.
+* left_out and right_out must be empty (or rbt), with the def of rbt;
+* rbt is left empty.
+* The split is O(log n): the sizes of the two trees are not known, and
+* are counted when used (by rbt_size etc., see rbti_size_count).
+* Not journaled: an error while a tree has a journal (rbt_journal_open),
+* or is in concurrent mode.
+* Return: RBT_RC_OK(0), RBT_RC_ERROR(-1)
+*********************************************************************/
+
+int rbt_split(
+    RBT   * rbt,
+    void  * key,
+    RBT   * left_out,
+    RBT   * right_out )
+{
+    RBTDEF * def;
+    void   * root;
+    void   * l, * r;
+    int      bhl, bhr;
+    size_t   size;
+    int      unknown;
+
+    def = rbt->def;
+    if( left_out == NULL || right_out == NULL || left_out == right_out
+        || left_out->def != def || right_out->def != def
+        || rbt->journal || left_out->journal || right_out->journal
+        || rbt->conc || left_out->conc || right_out->conc )
+        return RBT_RC_ERROR;
+    delta_merge(left_out);
+    delta_merge(right_out);
+    if( ( left_out != rbt && left_out->root != NULL )
+        || ( right_out != rbt && right_out->root != NULL ) )
+        return RBT_RC_ERROR;
+
+    delta_merge(rbt);
+    relax_fix(rbt);
+    if( rbt->tombs )
+        rbt_purge( rbt, 0 );
+    rbti_hash_drop( rbt );
+    rbti_hash_drop( left_out );
+    rbti_hash_drop( right_out );
+    cap_drop(rbt);
+    cap_drop(left_out);
+    cap_drop(right_out);
+    rbt->del_gen++;
+    left_out->del_gen++;
+    right_out->del_gen++;
+    root = rbt->root;
+    size = rbt->size;
+    unknown = rbt->size_unknown;
+    rbt->root = NULL;
+    rbt->size = 0;
+    rbt->size_unknown = 0;
+
+    rbti_split( def, root, rbti_black_height( def, root ),
+        def->keyCmp, key, 0, &l, &bhl, &r, &bhr, NULL );
+    if( l )
+    {
+        child_right(rbti_max( def, l )) = NULL; /* thread ptr */
+        set_black(l);
+    }
+    if( r )
+    {
+        child_left(rbti_min( def, r )) = NULL;  /* thread ptr */
+        set_black(r);
+    }
+
+    left_out->root  = l;
+    left_out->size  = l ? size : 0;
+    left_out->size_unknown = l && ( r || unknown );
+    right_out->root = r;
+    right_out->size = r ? size : 0;
+    right_out->size_unknown = r && ( l || unknown );
+    rbti_minmax( rbt );
+    rbti_minmax( left_out );
+    rbti_minmax( right_out );
+    return RBT_RC_OK;
+}
+
+/*********************************************************************
+* int rbt_join( RBT * left, void * pivot, RBT * right )
+* Move pivot and all nodes in right to left, in O(log n). All nodes in
+* left must be < pivot < all nodes in right. pivot may be NULL.
+* Not journaled: an error while a tree has a journal, or is in
+* concurrent mode.
+* Return: RBT_RC_OK(0), RBT_RC_ERROR(-1)
+*********************************************************************/
+
+int rbt_join(
+    RBT   * left,
+    void  * pivot,
+    RBT   * right )
+{
+    RBTDEF * def;
+    int      bh;
+
+    def = left->def;
+    if( left == right || left->def != right->def
+        || left->journal || right->journal || left->conc || right->conc )
+        return RBT_RC_ERROR;
+    delta_merge(left);
+    delta_merge(right);
+    relax_fix(left);
+    relax_fix(right);
+    if( left->tombs )
+        rbt_purge( left, 0 );
+    if( right->tombs )
+        rbt_purge( right, 0 );
+    if( pivot )
+    {
+        if( left->root
+            && rbti_node_cmp( def,
+                rbti_max( def, left->root ), pivot ) >= 0 )
+            return RBT_RC_ERROR;
+        if( right->root
+            && rbti_node_cmp( def,
+                pivot, rbti_min( def, right->root ) ) >= 0 )
+            return RBT_RC_ERROR;
+        left->root = rbti_join_fix( def,
+            left->root, rbti_black_height( def, left->root ), pivot,
+            right->root, rbti_black_height( def, right->root ), &bh );
+        left->size++;
+    }
+    else
+    {
+        if( left->root && right->root
+            && rbti_node_cmp( def, rbti_max( def, left->root ),
+                             rbti_min( def, right->root ) ) >= 0 )
+            return RBT_RC_ERROR;
+        left->root = rbti_join2( def,
+            left->root, rbti_black_height( def, left->root ),
+            right->root, rbti_black_height( def, right->root ), &bh );
+    }
+    if( left->root )
+        set_black(left->root);
+    rbti_hash_drop( left );
+    rbti_hash_drop( right );
+    cap_drop(left);
+    right->bytes = 0;
+    left->del_gen++;
+    right->del_gen++;
+    left->size += right->size;
+    left->size_unknown |= right->size_unknown;
+    right->root = NULL;
+    right->size = 0;
+    right->size_unknown = 0;
+    rbti_minmax( left );
+    rbti_minmax( right );
+    return RBT_RC_OK;
+}
+
+/***[end-of-file]****************************************************/
+/********************************************************************/
@@ -0,0 +1,479 @@
+/*********************************************************************
+* Red Black Tree functions (threaded)
+*
+* rbt_journal.c
+*
+**********************************************************************
+* functions:
+*
+*   int rbt_journal_open  ( RBT * rbt, int fd,
+*                           size_t (*serialize)(void*node,void*buf,
+*                                               size_t size),
+*                           unsigned max_ops, unsigned max_ms )
+*   int rbt_journal_sync  ( RBT * rbt )
+*   int rbt_journal_close ( RBT * rbt )
+*   int rbt_journal_replay( RBT * rbt, int fd,
+*                           void * (*deserialize)(void*buf,size_t size) )
+*
+* internal:
+*
+*   void   rbti_journal      ( RBT * rbt, int op, void * node )
+*   size_t rbti_journal_bytes( RBT * rbt )
+*
+**********************************************************************
+* Write-ahead journal of the changes to a tree. Inserts, deletes and
+* clears are appended as records to a buffer, and written to the
+* journal file with group commit: one write and fsync per max_ops
+* records or when max_ms milliseconds have passed since the last
+* commit (checked when a record is added). rbt_journal_sync commits
+* at once, eg. from a timer or before a change must be acknowledged.
+*
+* Recovery: rbt_load the latest snapshot (rbt_dump), then replay the
+* journal written since the snapshot.
+*
+* Record format ('varint' is LEB128):
+*
+*   type (1 byte), length (varint), bytes, checksum (4 bytes)
+*
+* A record with a bad checksum, or a short record at the end (a torn
+* write at a crash), ends the replay.
+*
+* Not journaled: rbt_split, rbt_join, rbt_union etc. and rbt_load,
+* which return RBT_RC_ERROR while a tree has a journal (replay would
+* not see their changes): close the journal, and make a new snapshot
+* after them. Not for multiset trees (a delete could not find its node
+* again by the serialized copy), nor in concurrent mode (the record
+* buffer has no lock).
+**********************************************************************
+* Copyright (c) 2020 Michael Walsh Pedersen
+*********************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include "rbt.h"
+#include "rbt_internal.h"
+
+#define JOURNAL_BUF_SIZE  65536   /* write when this much is buffered */
+#define JOURNAL_REC_SIZE  256     /* initial record buffer size */
+#define JOURNAL_REC_MAX   15      /* type + varint + checksum */
+
+/*********************************************************************
+*
+*********************************************************************/
+
+struct RBTJOURNAL {
+    int             fd;
+    size_t        (*serialize)(void*node,void*buf,size_t size);
+    unsigned        max_ops;   /* commit after max_ops records */
+    unsigned        max_ms;    /* commit after max_ms milliseconds */
+    unsigned        ops;       /* records since last commit */
+    long long       last_ms;   /* time of last commit */
+    int             error;     /* a write or fsync has failed */
+    unsigned char * buf;       /* records not written yet */
+    size_t          buf_len;
+    size_t          buf_size;
+};
+
+/*********************************************************************
+* static long long now_ms(...)
+*********************************************************************/
+
+static long long now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/*********************************************************************
+* static int buf_size(...)
+* Make room for at least size bytes in *buf.
+* Return: 0: ok, -1: out of memory
+*********************************************************************/
+
+static int buf_size(
+    unsigned char ** buf,
+    size_t         * cur_size,
+    size_t           size)
+{
+    unsigned char * p;
+
+    if( size <= *cur_size )
+        return 0;
+    if( size < 2 * *cur_size )
+        size = 2 * *cur_size;
+    p = (unsigned char *)realloc( *buf, size );
+    if( p == NULL )
+        return -1;
+    *buf = p;
+    *cur_size = size;
+    return 0;
+}
+
+/*********************************************************************
+* static int write_out(...)
+* Write the buffered records, and fsync if sync.
+* Return: 0: ok, -1: error
+*********************************************************************/
+
+static int write_out(
+    RBTJOURNAL * j,
+    int          sync)
+{
+    size_t  pos;
+    ssize_t rc;
+
+    if( j->error )
+        return -1;
+    for( pos = 0 ; pos < j->buf_len ; pos += rc )
+    {
+        rc = write( j->fd, j->buf + pos, j->buf_len - pos );
+        if( rc < 0 && errno == EINTR )
+            rc = 0;
+        else if( rc <= 0 )
+        {
+            j->error = 1;
+            return -1;
+        }
+    }
+    j->buf_len = 0;
+    if( sync )
+    {
+        if( fsync( j->fd ) != 0 )
+        {
+            j->error = 1;
+            return -1;
+        }
+        j->ops = 0;
+        if( j->max_ms )
+            j->last_ms = now_ms();
+    }
+    return 0;
+}
+
+/*********************************************************************
+* void rbti_journal(...)
+* Add a record of type op (RBTI_J_xxx) for node to the journal of rbt,
+* and commit if max_ops or max_ms is reached. Errors are kept in the
+* journal and returned by rbt_journal_sync.
+*********************************************************************/
+
+void rbti_journal(
+    RBT  * rbt,
+    int    op,
+    void * node)
+{
+    RBTJOURNAL        * j;
+    unsigned char     * p;
+    unsigned long long  sum[2];
+    unsigned long long  v;
+    size_t              room, len, hdr, n;
+
+    j = rbt->journal;
+    if( j->error )
+        return;
+
+    /* serialize behind room for type and length */
+    len = 0;
+    if( node )
+    {
+        room = j->buf_size - j->buf_len - JOURNAL_REC_MAX;
+        len = j->serialize( node, j->buf + j->buf_len + 11, room );
+        if( len > room )
+        {
+            if( buf_size( &j->buf, &j->buf_size,
+                j->buf_len + len + JOURNAL_REC_MAX ) )
+            {
+                j->error = 1;
+                return;
+            }
+            len = j->serialize( node, j->buf + j->buf_len + 11, len );
+        }
+    }
+
+    /* type and length, moved next to the bytes */
+    p = j->buf + j->buf_len;
+    hdr = 1;
+    p[0] = (unsigned char)op;
+    for( v = len ; v >= 0x80 ; v >>= 7 )
+        p[hdr++] = (unsigned char)(v | 0x80);
+    p[hdr++] = (unsigned char)v;
+    if( hdr < 11 )
+        memmove( p + hdr, p + 11, len );
+
+    sum[0] = 1;
+    sum[1] = 0;
+    rbti_checksum( sum, p, hdr + len );
+    v = ( sum[1] << 16 ) ^ sum[0];
+    for( n = 0 ; n < 4 ; n++, v >>= 8 )
+        p[hdr+len+n] = (unsigned char)v;
+    j->buf_len += hdr + len + 4;
+    j->ops++;
+
+    if( ( j->max_ops && j->ops >= j->max_ops )
+        || ( j->max_ms && now_ms() - j->last_ms >= j->max_ms ) )
+        write_out( j, 1 );
+    else if( j->buf_len >= JOURNAL_BUF_SIZE )
+        write_out( j, 0 );
+    if( j->buf_size - j->buf_len < JOURNAL_REC_SIZE + JOURNAL_REC_MAX
+        && buf_size( &j->buf, &j->buf_size,
+            j->buf_len + JOURNAL_REC_SIZE + JOURNAL_REC_MAX ) )
+        j->error = 1;
+}
+
+/*********************************************************************
+* size_t rbti_journal_bytes(...)
+* Return: bytes allocated for the journal and its buffer (0: none).
+*********************************************************************/
+
+size_t rbti_journal_bytes(
+    RBT    * rbt)
+{
+    if( rbt->journal == NULL )
+        return 0;
+    return sizeof(RBTJOURNAL) + rbt->journal->buf_size;
+}
+
+/*********************************************************************
+* int rbt_journal_open(...)
+* Attach a journal to rbt, appending records to fd (opened for write,
+* eg. with O_APPEND). serialize(node,buf,size) must write the node to
+* buf and return its length. If the length is > size, serialize is
+* called again with a larger buf. The records are committed (written
+* and fsync'ed) per max_ops records or when max_ms milliseconds have
+* passed (0: no limit, both 0: every record is committed).
+* Return: RBT_RC_OK(0), RBT_RC_ERROR(-1) (also for multiset trees and
+* in concurrent mode)
+*********************************************************************/
+
+int rbt_journal_open(
+    RBT      * rbt,
+    int        fd,
+    size_t   (*serialize)(void*node,void*buf,size_t size),
+    unsigned   max_ops,
+    unsigned   max_ms )
+{
+    RBTJOURNAL * j;
+
+    if( rbt->journal || rbt->conc || serialize == NULL
+        || is_multiset(rbt->def) )
+        return RBT_RC_ERROR;
+    j = (RBTJOURNAL*)calloc( 1, sizeof(RBTJOURNAL) );
+    if( j == NULL )
+        return RBT_RC_ERROR;
+    if( buf_size( &j->buf, &j->buf_size,
+        JOURNAL_BUF_SIZE + JOURNAL_REC_MAX ) )
+    {
+        free( j );
+        return RBT_RC_ERROR;
+    }
+    j->fd = fd;
+    j->serialize = serialize;
+    j->max_ops = max_ops || max_ms ? max_ops : 1;
+    j->max_ms = max_ms;
+    if( max_ms )
+        j->last_ms = now_ms();
+    rbt->journal = j;
+    return RBT_RC_OK;
+}
+
+/*********************************************************************
+* int rbt_journal_sync( RBT * rbt )
+* Commit all records now.
+* Return: RBT_RC_OK(0), RBT_RC_ERROR(-1) (also if an earlier commit
+* has failed)
+*********************************************************************/
+
+int rbt_journal_sync(
+    RBT * rbt )
+{
+    if( rbt->journal == NULL || write_out( rbt->journal, 1 ) )
+        return RBT_RC_ERROR;
+    return RBT_RC_OK;
+}
+
+/*********************************************************************
+* int rbt_journal_close( RBT * rbt )
+* Commit all records and detach the journal (fd is not closed).
+* Return: RBT_RC_OK(0), RBT_RC_ERROR(-1)
+*********************************************************************/
+
+int rbt_journal_close(
+    RBT * rbt )
+{
+    RBTJOURNAL * j;
+    int          rc;
+
+    j = rbt->journal;
+    if( j == NULL )
+        return RBT_RC_ERROR;
+    rc = write_out( j, 1 ) ? RBT_RC_ERROR : RBT_RC_OK;
+    rbt->journal = NULL;
+    free( j->buf );
+    free( j );
+    return rc;
+}
+
+/*********************************************************************
+* static int get_bytes(...)
+* Read len bytes from fd, via io (of JOURNAL_BUF_SIZE bytes).
+* Return: 0: ok, -1: error or end of file
+*********************************************************************/
+
+static int get_bytes(
+    int             fd,
+    unsigned char * io,
+    size_t        * io_pos,
+    size_t        * io_len,
+    unsigned char * buf,
+    size_t          len)
+{
+    size_t  n;
+    ssize_t rc;
+
+    while( len )
+    {
+        if( *io_pos == *io_len )
+        {
+            rc = read( fd, io, JOURNAL_BUF_SIZE );
+            if( rc < 0 && errno == EINTR )
+                continue;
+            if( rc <= 0 )
+                return -1;
+            *io_pos = 0;
+            *io_len = rc;
+        }
+        n = *io_len - *io_pos;
+        if( n > len )
+            n = len;
+        memcpy( buf, io + *io_pos, n );
+        *io_pos += n;
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/*********************************************************************
+* int rbt_journal_replay(...)
+* Apply the records in fd to rbt (rbt_insert, rbt_delnode, rbt_clr).
+* deserialize(buf,size) must return a new node (or NULL on errors).
+* Nodes for deletes are freed by freeNode after use. The replay stops
+* at the first bad or short record, and fd is left at the end of the
+* last good record (to be truncated there before more is appended).
+* Return: RBT_RC_OK(0), RBT_RC_ERROR(-1) (deserialize or read error)
+*********************************************************************/
+
+int rbt_journal_replay(
+    RBT    * rbt,
+    int      fd,
+    void * (*deserialize)(void*buf,size_t size) )
+{
+    RBTDEF            * def;
+    RBTJOURNAL        * j;
+    unsigned char     * io;
+    unsigned char     * rec;
+    size_t              io_pos, io_len, rec_size;
+    size_t              hdr, len, n;
+    unsigned long long  sum[2];
+    unsigned long long  v;
+    off_t               start, good;
+    void              * node;
+    int                 rc, shift;
+
+    def = rbt->def;
+    start = lseek( fd, 0, SEEK_CUR );
+    io = (unsigned char *)malloc( JOURNAL_BUF_SIZE );
+    rec = NULL;
+    rec_size = 0;
+    if( io == NULL
+        || buf_size( &rec, &rec_size, JOURNAL_REC_SIZE + JOURNAL_REC_MAX ) )
+    {
+        free( io );
+        free( rec );
+        return RBT_RC_ERROR;
+    }
+
+    j = rbt->journal; /* do not journal the replay */
+    rbt->journal = NULL;
+    rc = RBT_RC_OK;
+    good = 0;
+    io_pos = io_len = 0;
+    for( ;; )
+    {
+        /* type and length */
+        if( get_bytes( fd, io, &io_pos, &io_len, rec, 1 ) )
+            break;
+        len = 0;
+        for( hdr = 1, shift = 0 ; hdr < 11 ; shift += 7 )
+        {
+            if( get_bytes( fd, io, &io_pos, &io_len, rec + hdr, 1 ) )
+                break;
+            len |= (size_t)(rec[hdr] & 0x7f) << shift;
+            if( ( rec[hdr++] & 0x80 ) == 0 )
+                break;
+        }
+        if( ( rec[hdr-1] & 0x80 ) || hdr == 1 )
+            break; /* short record */
+
+        /* bytes and checksum */
+        if( buf_size( &rec, &rec_size, hdr + len + 4 ) )
+        {
+            rc = RBT_RC_ERROR;
+            break;
+        }
+        if( get_bytes( fd, io, &io_pos, &io_len, rec + hdr, len + 4 ) )
+            break;
+        sum[0] = 1;
+        sum[1] = 0;
+        rbti_checksum( sum, rec, hdr + len );
+        v = ( sum[1] << 16 ) ^ sum[0];
+        for( n = 0 ; n < 4 ; n++, v >>= 8 )
+            if( rec[hdr+len+n] != (unsigned char)v )
+                break;
+        if( n < 4 )
+            break;
+
+        switch( rec[0] )
+        {
+        case RBTI_J_INSERT:
+        case RBTI_J_DELETE:
+            node = deserialize( rec + hdr, len );
+            if( node == NULL )
+            {
+                rc = RBT_RC_ERROR;
+                break;
+            }
+            if( rec[0] == RBTI_J_INSERT )
+                rbt_insert( rbt, node );
+            else
+            {
+                rbt_delnode( rbt, node );
+                def->freeNode( node );
+            }
+            break;
+        case RBTI_J_CLEAR:
+            rbt_clr( rbt );
+            break;
+        default:
+            rc = RBT_RC_ERROR;
+            break;
+        }
+        if( rc )
+            break;
+        good += hdr + len + 4;
+    }
+    rbt->journal = j;
+    free( io );
+    free( rec );
+    if( start >= 0 && lseek( fd, start + good, SEEK_SET ) < 0 )
+        rc = RBT_RC_ERROR;
+    return rc;
+}
+
+/***[end-of-file]****************************************************/
+/********************************************************************/
@@ -0,0 +1,94 @@
+/*********************************************************************
+* Red Black Tree functions (threaded)
+*
+* rbt_key.c
+*
+**********************************************************************
+* internal:
+*
+*   int    rbti_bytes_cmp_long( const unsigned char * a,
+*                               const unsigned char * b, size_t len )
+*
+**********************************************************************
+* Fixed-length keys: a def with key_len > 0 has its keys in key_len
+* bytes at key_ofs of each node, and the key passed to rbt_get, rbt_delkey
+* etc. points to key_len bytes. The searches compare them inline (see
+* rbti_bytes_cmp in rbt_internal.h), without calling nodeCmp/keyCmp,
+* as unsigned bytes: a string key must be padded with zero bytes.
+*
+* The inline compare uses SSE2 (on all x86-64 CPUs), or AVX2 when the
+* library is built for it (eg. RBT_OPT=-mavx2). Else keys of
+* RBT_KEY_LONG bytes or more are compared here, with AVX2 if the CPU
+* has it: a direct call, which the 32 byte steps pay for.
+**********************************************************************
+* Copyright (c) 2020 Michael Walsh Pedersen
+*********************************************************************/
+
+#include "rbt.h"
+#include "rbt_internal.h"
+
+#if defined(RBT_KEY_SIMD) && !defined(__AVX2__)
+
+static int cpu_avx2 = -1;   /* -1: not checked yet */
+
+/*********************************************************************
+* static int cmp_avx2(...)
+* Compare 32 bytes at a time, and the rest by the inline compare.
+* Return: <0, 0, >0 as memcmp
+*********************************************************************/
+
+__attribute__((target("avx2")))
+static int cmp_avx2(
+    const unsigned char * a,
+    const unsigned char * b,
+    size_t   len)
+{
+    size_t   i;
+    unsigned m;
+
+    for( i = 0 ; i + 32 <= len ; i += 32 )
+    {
+        m = ~(unsigned)_mm256_movemask_epi8( _mm256_cmpeq_epi8(
+            _mm256_loadu_si256( (const __m256i*)( a + i ) ),
+            _mm256_loadu_si256( (const __m256i*)( b + i ) ) ) );
+        if( m )
+        {
+            i += __builtin_ctz( m );
+            return a[i] - b[i];
+        }
+    }
+    return rbti_bytes_cmp_from( a, b, len, i );
+}
+
+#endif
+
+/*********************************************************************
+* int rbti_bytes_cmp_long(...)
+* Compare len bytes of a long key, with AVX2 if the CPU has it (checked
+* at the first call), else SSE2.
+* Return: <0, 0, >0 as memcmp
+*********************************************************************/
+
+int rbti_bytes_cmp_long(
+    const unsigned char * a,
+    const unsigned char * b,
+    size_t   len)
+{
+#if defined(RBT_KEY_SIMD) && !defined(__AVX2__)
+    int avx2;
+
+    avx2 = __atomic_load_n( &cpu_avx2, __ATOMIC_RELAXED );
+    if( avx2 < 0 )
+    {
+        __builtin_cpu_init();
+        avx2 = __builtin_cpu_supports( "avx2" ) != 0;
+        __atomic_store_n( &cpu_avx2, avx2, __ATOMIC_RELAXED );
+    }
+    if( avx2 )
+        return cmp_avx2( a, b, len );
+#endif
+    return rbti_bytes_cmp_from( a, b, len, 0 );
+}
+
+/***[end-of-file]****************************************************/
+/********************************************************************/
@@ -0,0 +1,357 @@
+/*********************************************************************
+* Red Black Tree functions (threaded)
+*
+* rbt_latency.c
+*
+**********************************************************************
+* functions:
+*
+*   int    rbt_latency_merge ( RBTLATENCY * out )
+*   void   rbt_latency_add   ( RBTLATENCY * out, RBTLATENCY * in )
+*   void   rbt_latency_reset ( void )
+*   double rbt_latency_pct   ( RBTLATENCY * h, int op, double pct )
+*   int    rbt_latency_export( RBTLATENCY * h, int fd, int json )
+*
+**********************************************************************
+* Latency histograms of the tree operations (RBT_LAT_xxx), recorded
+* when the library is build with -DRBT_LATENCY (make RBT_OPT=...).
+*
+* Each thread records into its own histogram (no locks or atomics on
+* the hot path), timed with the cycle counter (rdtsc on x86, else
+* clock_gettime). The buckets are log-linear (HDR style): exact below
+* 16 ticks, then 16 buckets per power of 2 (max error 1/16).
+* The histograms of all threads (also ended threads) are summed by
+* rbt_latency_merge, and the tick length is calibrated against the
+* monotonic clock since the first recording.
+**********************************************************************
+* Copyright (c) 2020 Michael Walsh Pedersen
+*********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include "rbt.h"
+#include "rbt_internal.h"
+
+#define LAT_SUB_BITS  4
+#define LAT_SUB       (1 << LAT_SUB_BITS)  /* buckets per power of 2 */
+
+static const char * op_names[RBT_LAT_OPS] =
+    { "insert", "get", "delete", "iter", "range" };
+
+/*********************************************************************
+* static unsigned long long bucket_high(...)
+* Return: highest value in bucket i.
+*********************************************************************/
+
+static unsigned long long bucket_high(
+    int i)
+{
+    int e;
+
+    if( i < LAT_SUB )
+        return i;
+    e = i / LAT_SUB + LAT_SUB_BITS - 1;
+    return ( ( (unsigned long long)( LAT_SUB + i % LAT_SUB + 1 )
+        << ( e - LAT_SUB_BITS ) ) - 1 );
+}
+
+#ifdef RBT_LATENCY
+/*********************************************************************
+*
+*********************************************************************/
+
+typedef struct LATTHREAD {
+    struct LATTHREAD * next;
+    RBTLATENCY         hist;
+} LATTHREAD;
+
+static LATTHREAD * all_threads;         /* all histograms */
+static _Thread_local LATTHREAD * my_thread;
+
+static unsigned long long tick0;        /* first recording: */
+static long long          ns0;          /*   ticks and ns */
+static int                calibrating;
+
+/*********************************************************************
+* static long long now_ns(...)
+*********************************************************************/
+
+static long long now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return (long long)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+#if !defined(__x86_64__) && !defined(__i386__)
+/*********************************************************************
+* unsigned long long rbti_ticks(...)
+* Return: cycle counter (here ns).
+*********************************************************************/
+
+unsigned long long rbti_ticks(void)
+{
+    return (unsigned long long)now_ns();
+}
+#endif
+
+/*********************************************************************
+* static int bucket(...)
+* Return: bucket index for v ticks.
+*********************************************************************/
+
+static int bucket(
+    unsigned long long v)
+{
+    int e;
+
+    if( v < LAT_SUB )
+        return (int)v;
+    e = 63 - __builtin_clzll( v );
+    return ( e - LAT_SUB_BITS + 1 ) * LAT_SUB
+        + (int)( ( v >> ( e - LAT_SUB_BITS ) ) & ( LAT_SUB - 1 ) );
+}
+
+/*********************************************************************
+* static LATTHREAD * new_thread(...)
+* Create and register the histogram of this thread.
+*********************************************************************/
+
+static LATTHREAD * new_thread(void)
+{
+    LATTHREAD * t;
+    LATTHREAD * head;
+    int         zero;
+
+    t = (LATTHREAD*)calloc( 1, sizeof(LATTHREAD) );
+    if( t == NULL )
+        return NULL;
+    zero = 0;
+    if( __atomic_load_n( &ns0, __ATOMIC_ACQUIRE ) == 0 )
+    {
+        if( __atomic_compare_exchange_n( &calibrating, &zero, 1, 0,
+            __ATOMIC_ACQ_REL, __ATOMIC_RELAXED ) )
+        {
+            tick0 = rbti_ticks();
+            __atomic_store_n( &ns0, now_ns(), __ATOMIC_RELEASE );
+        }
+    }
+    head = __atomic_load_n( &all_threads, __ATOMIC_RELAXED );
+    do
+        t->next = head;
+    while( !__atomic_compare_exchange_n( &all_threads, &head, t, 1,
+        __ATOMIC_RELEASE, __ATOMIC_RELAXED ) );
+    my_thread = t;
+    return t;
+}
+
+/*********************************************************************
+* void rbti_lat_record(...)
+* Record the time since t0 (ticks) for op.
+*********************************************************************/
+
+void rbti_lat_record(
+    int                op,
+    unsigned long long t0)
+{
+    unsigned long long d;
+    LATTHREAD        * t;
+
+    d = rbti_ticks() - t0;
+    t = my_thread;
+    if( t == NULL && ( t = new_thread() ) == NULL )
+        return;
+    t->hist.count[op][bucket( d )]++;
+}
+#endif
+
+/*********************************************************************
+* int rbt_latency_merge( RBTLATENCY * out )
+* Add the histograms of all threads to out (zero it first, or merge
+* more), and set out->ns_per_tick.
+* Return: RBT_RC_OK(0), RBT_RC_ERROR(-1) if not build with RBT_LATENCY
+*********************************************************************/
+
+int rbt_latency_merge(
+    RBTLATENCY * out )
+{
+#ifdef RBT_LATENCY
+    LATTHREAD        * t;
+    unsigned long long ticks;
+    long long          ns, start;
+
+    t = __atomic_load_n( &all_threads, __ATOMIC_ACQUIRE );
+    for( ; t ; t = t->next )
+        rbt_latency_add( out, &t->hist );
+    start = __atomic_load_n( &ns0, __ATOMIC_ACQUIRE );
+    ticks = rbti_ticks() - tick0;
+    ns = now_ns() - start;
+    if( start && ticks && ns > 0 )
+        out->ns_per_tick = (double)ns / ticks;
+    else if( out->ns_per_tick == 0 )
+        out->ns_per_tick = 1;
+    return RBT_RC_OK;
+#else
+    (void)out;
+    return RBT_RC_ERROR;
+#endif
+}
+
+/*********************************************************************
+* void rbt_latency_add( RBTLATENCY * out, RBTLATENCY * in )
+* Add the counts in in to out.
+*********************************************************************/
+
+void rbt_latency_add(
+    RBTLATENCY * out,
+    RBTLATENCY * in )
+{
+    int op, i;
+
+    for( op = 0 ; op < RBT_LAT_OPS ; op++ )
+        for( i = 0 ; i < RBT_LAT_BUCKETS ; i++ )
+            out->count[op][i] += in->count[op][i];
+    if( out->ns_per_tick == 0 )
+        out->ns_per_tick = in->ns_per_tick;
+}
+
+/*********************************************************************
+* void rbt_latency_reset( void )
+* Set the histograms of all threads to zero (counts being recorded at
+* the same time may be kept).
+*********************************************************************/
+
+void rbt_latency_reset( void )
+{
+#ifdef RBT_LATENCY
+    LATTHREAD * t;
+
+    t = __atomic_load_n( &all_threads, __ATOMIC_ACQUIRE );
+    for( ; t ; t = t->next )
+        memset( t->hist.count, 0, sizeof(t->hist.count) );
+#endif
+}
+
+/*********************************************************************
+* double rbt_latency_pct( RBTLATENCY * h, int op, double pct )
+* Return: latency in ns at percentile pct (0..100) for op, as the high
+* end of its bucket, or 0 if no counts.
+*********************************************************************/
+
+double rbt_latency_pct(
+    RBTLATENCY * h,
+    int          op,
+    double       pct )
+{
+    unsigned long long total, sum;
+    double             rank;
+    int                i;
+
+    total = 0;
+    for( i = 0 ; i < RBT_LAT_BUCKETS ; i++ )
+        total += h->count[op][i];
+    if( total == 0 )
+        return 0;
+    rank = pct / 100 * total;
+    sum = 0;
+    for( i = 0 ; i < RBT_LAT_BUCKETS - 1 ; i++ )
+    {
+        sum += h->count[op][i];
+        if( sum >= rank && sum > 0 )
+            break;
+    }
+    return bucket_high( i ) * h->ns_per_tick;
+}
+
+/*********************************************************************
+* static int put_text(...)
+* Return: 0: ok, -1: error
+*********************************************************************/
+
+static int put_text(
+    int          fd,
+    const char * buf,
+    size_t       len)
+{
+    ssize_t rc;
+
+    while( len )
+    {
+        rc = write( fd, buf, len );
+        if( rc < 0 && errno == EINTR )
+            continue;
+        if( rc <= 0 )
+            return -1;
+        buf += rc;
+        len -= rc;
+    }
+    return 0;
+}
+
+/*********************************************************************
+* int rbt_latency_export( RBTLATENCY * h, int fd, int json )
+* Write count and percentiles (ns) per op to fd, as text (json = 0):
+*   op count p50 p90 p99 p99.9 max
+* or as json, incl. the non-empty buckets as [high ns, count].
+* Return: RBT_RC_OK(0), RBT_RC_ERROR(-1)
+*********************************************************************/
+
+int rbt_latency_export(
+    RBTLATENCY * h,
+    int          fd,
+    int          json )
+{
+    static const double pcts[] = { 50, 90, 99, 99.9, 100 };
+    static const char * text_head = "op count p50 p90 p99 p99.9 max (ns)\n";
+    char               buf[256];
+    unsigned long long total;
+    int                op, i, n, first, rc;
+
+    rc = json ? put_text( fd, "{", 1 )
+        : put_text( fd, text_head, strlen( text_head ) );
+    for( op = 0 ; op < RBT_LAT_OPS && rc == 0 ; op++ )
+    {
+        for( total = 0, i = 0 ; i < RBT_LAT_BUCKETS ; i++ )
+            total += h->count[op][i];
+        n = snprintf( buf, sizeof(buf), json
+            ? "%s\n \"%s\":{\"count\":%llu,\"pct\":{" : "%s%s %llu",
+            op && json ? "," : "", op_names[op], total );
+        for( i = 0 ; i < 5 ; i++ )
+        {
+            if( json )
+                n += snprintf( buf + n, sizeof(buf) - n, "%s\"%g\":%.0f",
+                    i ? "," : "", pcts[i],
+                    rbt_latency_pct( h, op, pcts[i] ) );
+            else
+                n += snprintf( buf + n, sizeof(buf) - n, " %.0f",
+                    rbt_latency_pct( h, op, pcts[i] ) );
+        }
+        n += snprintf( buf + n, sizeof(buf) - n,
+            json ? "},\"buckets\":[" : "\n" );
+        rc = put_text( fd, buf, n );
+        for( first = 1, i = 0 ; json && i < RBT_LAT_BUCKETS && rc == 0 ;
+            i++ )
+        {
+            if( h->count[op][i] == 0 )
+                continue;
+            n = snprintf( buf, sizeof(buf), "%s[%.0f,%llu]",
+                first ? "" : ",", bucket_high( i ) * h->ns_per_tick,
+                h->count[op][i] );
+            rc = put_text( fd, buf, n );
+            first = 0;
+        }
+        if( json && rc == 0 )
+            rc = put_text( fd, "]}", 2 );
+    }
+    if( json && rc == 0 )
+        rc = put_text( fd, "\n}\n", 3 );
+    return rc ? RBT_RC_ERROR : RBT_RC_OK;
+}
+
+/***[end-of-file]****************************************************/
+/********************************************************************/
@@ -0,0 +1,337 @@
+/*********************************************************************
+* Red Black Tree functions (threaded)
+*
+* rbt_mapped.c
+*
+**********************************************************************
+* functions:
+*
+*   RBT  * rbt_open_mapped ( const char * path, RBTDEF * def,
+*                            size_t max_size )
+*   int    rbt_sync_mapped ( RBT * rbt )
+*   int    rbt_close_mapped( RBT * rbt )
+*   void * rbt_mapped_alloc( RBT * rbt, size_t size )
+*   void   rbt_mapped_free ( void * node )
+*
+**********************************************************************
+* Persistent tree in a memory mapped file. All nodes live in the file,
+* which is always mapped at the same address (saved in the file
+* header), so the node pointers are valid in every process that opens
+* the file. Opening is O(1), pages are read on demand.
+*
+* File layout:
+*
+*   header (MAPHDR: fixed layout, with a version; the root, size and
+*           tombstones of the tree, written by rbt_sync_mapped)
+*   blocks: size (8 bytes), header ptr (8 bytes), node ...
+*
+* The RBT itself is in memory only (MAPTREE), so its runtime fields may
+* change without changing the file format.
+*
+* Freed blocks are kept in free lists by size (linked by the first
+* word of the node), and the file grows (up to max_size) when more
+* room is needed.
+**********************************************************************
+* Copyright (c) 2020 Michael Walsh Pedersen
+*********************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "rbt.h"
+#include "rbt_internal.h"
+
+#define MAP_MAGIC        "RBTMAP"
+#define MAP_VERSION      2          /* of MAPHDR and the blocks */
+#define MAP_ALIGN        16
+#define MAP_CLASSES      64         /* free lists for 16..1024 bytes */
+#define MAP_INIT_SIZE    65536
+#define MAP_DEF_MAX_SIZE ((size_t)1 << 36)
+
+/*********************************************************************
+*
+*********************************************************************/
+
+typedef struct {                    /* file header */
+    char      magic[8];             /* MAP_MAGIC */
+    unsigned  version;              /* MAP_VERSION */
+    unsigned  hdr_size;             /* sizeof(MAPHDR) */
+    void    * base;                 /* mapped at this address */
+    size_t    max_size;             /* mapped (reserved) size */
+    size_t    file_size;            /* current file size */
+    size_t    used;                 /* bytes used */
+    void    * free_list[MAP_CLASSES+1]; /* last: larger blocks */
+    size_t    root_ofs;             /* root - base (0: empty tree) */
+    size_t    size;                 /* nodes in the tree */
+    size_t    tombs;                /* lazy deleted nodes in the tree */
+} MAPHDR;
+
+typedef struct {                    /* in memory only */
+    RBT       rbt;                  /* (first: the tree is a MAPTREE) */
+    MAPHDR  * hdr;
+    int       fd;
+} MAPTREE;
+
+typedef struct {
+    size_t    size;                 /* block size, incl. BLKHDR */
+    MAPHDR  * hdr;
+} BLKHDR;
+
+#define hdr_of_rbt(r) (((MAPTREE*)(r))->hdr)
+#define blk_of_node(n) ((BLKHDR*)(n) - 1)
+
+/*********************************************************************
+* static size_t round_up(...), size_class(...)
+*********************************************************************/
+
+static size_t round_up(
+    size_t v,
+    size_t align)
+{
+    return ( v + align - 1 ) / align * align;
+}
+
+static int size_class(
+    size_t size)
+{
+    size_t c;
+
+    c = size / MAP_ALIGN - 1;
+    return c < MAP_CLASSES ? (int)c : MAP_CLASSES;
+}
+
+/*********************************************************************
+* RBT * rbt_open_mapped( const char * path, RBTDEF * def, size_t max_size )
+* Open (or create) a tree in a file. max_size is the maximum file size
+* for a new file (0: 64GB of address space); a existing file keeps its
+* own. def->freeNode should be rbt_mapped_free.
+* Return: tree or NULL on errors (also if the address is in use).
+*********************************************************************/
+
+RBT * rbt_open_mapped(
+    const char * path,
+    RBTDEF     * def,
+    size_t       max_size )
+{
+    MAPHDR   h;
+    MAPHDR * hdr;
+    MAPTREE * mt;
+    void   * base;
+    struct stat st;
+    int      fd;
+
+    mt = (MAPTREE*)malloc( sizeof(MAPTREE) );
+    if( mt == NULL )
+        return NULL;
+    fd = open( path, O_RDWR | O_CREAT, 0644 );
+    if( fd < 0 || fstat( fd, &st ) != 0 )
+    {
+        if( fd >= 0 )
+            close( fd );
+        free( mt );
+        return NULL;
+    }
+
+    if( st.st_size == 0 ) /* new file */
+    {
+        if( max_size == 0 )
+            max_size = MAP_DEF_MAX_SIZE;
+        max_size = round_up( max_size, MAP_INIT_SIZE );
+        base = mmap( NULL, max_size, PROT_READ | PROT_WRITE,
+            MAP_SHARED, fd, 0 );
+        if( base == MAP_FAILED )
+        {
+            close( fd );
+            free( mt );
+            return NULL;
+        }
+        if( ftruncate( fd, MAP_INIT_SIZE ) != 0 )
+        {
+            munmap( base, max_size );
+            close( fd );
+            free( mt );
+            return NULL;
+        }
+        hdr = (MAPHDR*)base;
+        memset( hdr, 0, sizeof(MAPHDR) );
+        memcpy( hdr->magic, MAP_MAGIC, sizeof(MAP_MAGIC) );
+        hdr->version = MAP_VERSION;
+        hdr->hdr_size = sizeof(MAPHDR);
+        hdr->base = base;
+        hdr->max_size = max_size;
+        hdr->file_size = MAP_INIT_SIZE;
+        hdr->used = round_up( sizeof(MAPHDR), MAP_ALIGN );
+    }
+    else /* existing file */
+    {
+        if( pread( fd, &h, sizeof(h), 0 ) != (ssize_t)sizeof(h)
+            || memcmp( h.magic, MAP_MAGIC, sizeof(MAP_MAGIC) ) != 0
+            || h.version != MAP_VERSION || h.hdr_size != sizeof(MAPHDR)
+            || (size_t)st.st_size != h.file_size )
+        {
+            close( fd );
+            free( mt );
+            return NULL;
+        }
+        base = mmap( h.base, h.max_size, PROT_READ | PROT_WRITE,
+            MAP_SHARED, fd, 0 );
+        if( base == MAP_FAILED )
+        {
+            close( fd );
+            free( mt );
+            return NULL;
+        }
+        if( base != h.base ) /* address not free */
+        {
+            munmap( base, h.max_size );
+            close( fd );
+            free( mt );
+            return NULL;
+        }
+        hdr = (MAPHDR*)base;
+    }
+    rbt_init( &mt->rbt, def );
+    mt->rbt.root = hdr->root_ofs ? (char*)base + hdr->root_ofs : NULL;
+    mt->rbt.size = hdr->size;
+    mt->rbt.tombs = hdr->tombs;   /* lazy deleted nodes in the file */
+    minmax_reset(&mt->rbt);
+    rbti_minmax( &mt->rbt );
+    mt->hdr = hdr;
+    mt->fd = fd;
+    return &mt->rbt;
+}
+
+/*********************************************************************
+* int rbt_sync_mapped( RBT * rbt )
+* Write all changes to the file, and the root, size and tombstones of
+* the tree to its header.
+* Return: RBT_RC_OK(0), RBT_RC_ERROR(-1)
+*********************************************************************/
+
+int rbt_sync_mapped(
+    RBT * rbt )
+{
+    MAPHDR * hdr;
+
+    delta_merge(rbt);
+    relax_fix(rbt);   /* the violations are not kept in the file */
+    size_count(rbt);  /* eg. after rbt_split */
+    hdr = hdr_of_rbt(rbt);
+    hdr->root_ofs = rbt->root ? (size_t)( (char*)rbt->root
+                                          - (char*)hdr->base ) : 0;
+    hdr->size = rbt->size;
+    hdr->tombs = rbt->tombs;
+    if( msync( hdr->base, hdr->file_size, MS_SYNC ) != 0 )
+        return RBT_RC_ERROR;
+    return RBT_RC_OK;
+}
+
+/*********************************************************************
+* int rbt_close_mapped( RBT * rbt )
+* Sync and close the file. rbt is freed (it is no longer valid).
+* Return: RBT_RC_OK(0), RBT_RC_ERROR(-1)
+*********************************************************************/
+
+int rbt_close_mapped(
+    RBT * rbt )
+{
+    MAPHDR * hdr;
+    int      rc;
+    int      fd;
+
+    hdr = hdr_of_rbt(rbt);
+    rbt_buffer( rbt, 0 );  /* merge, and free the buffer */
+    rbt_capacity( rbt, NULL );
+    rbt_relaxed( rbt, 0, 0 );
+    rbti_hash_drop( rbt ); /* in memory only */
+    rbti_repl_drop( rbt );
+    rc = rbt_sync_mapped( rbt );
+    fd = ((MAPTREE*)rbt)->fd;
+    if( munmap( hdr->base, hdr->max_size ) != 0 )
+        rc = RBT_RC_ERROR;
+    if( close( fd ) != 0 )
+        rc = RBT_RC_ERROR;
+    free( rbt );
+    return rc;
+}
+
+/*********************************************************************
+* void * rbt_mapped_alloc( RBT * rbt, size_t size )
+* Allocate a node of size bytes in the file of rbt.
+* Return: node or NULL (file is full).
+*********************************************************************/
+
+void * rbt_mapped_alloc(
+    RBT    * rbt,
+    size_t   size )
+{
+    MAPHDR * hdr;
+    BLKHDR * blk;
+    void  ** pp;
+    size_t   new_size;
+    int      c;
+
+    hdr = hdr_of_rbt(rbt);
+    if( size < sizeof(void*) )
+        size = sizeof(void*); /* room for the free list link */
+    size = round_up( size + sizeof(BLKHDR), MAP_ALIGN );
+    c = size_class( size );
+
+    /* reuse a freed block */
+    for( pp = &hdr->free_list[c] ; *pp ; pp = (void**)*pp )
+    {
+        blk = blk_of_node(*pp);
+        if( blk->size >= size )
+        {
+            *pp = *(void**)*pp;
+            blk->hdr = hdr;
+            return blk + 1;
+        }
+    }
+
+    /* grow the file */
+    if( hdr->used + size > hdr->file_size )
+    {
+        new_size = round_up( hdr->used + size, MAP_INIT_SIZE );
+        if( new_size < 2 * hdr->file_size )
+            new_size = 2 * hdr->file_size;
+        if( new_size > hdr->max_size )
+            new_size = hdr->max_size;
+        if( hdr->used + size > new_size
+            || ftruncate( ((MAPTREE*)rbt)->fd, new_size ) != 0 )
+            return NULL;
+        hdr->file_size = new_size;
+    }
+    blk = (BLKHDR*)( (char*)hdr->base + hdr->used );
+    hdr->used += size;
+    blk->size = size;
+    blk->hdr = hdr;
+    return blk + 1;
+}
+
+/*********************************************************************
+* void rbt_mapped_free( void * node )
+* Free a node allocated by rbt_mapped_alloc (to be used as freeNode).
+*********************************************************************/
+
+void rbt_mapped_free(
+    void * node )
+{
+    BLKHDR * blk;
+    MAPHDR * hdr;
+    int      c;
+
+    if( node == NULL )
+        return;
+    blk = blk_of_node(node);
+    hdr = blk->hdr;
+    c = size_class( blk->size );
+    *(void**)node = hdr->free_list[c];
+    hdr->free_list[c] = node;
+}
+
+/***[end-of-file]****************************************************/
+/********************************************************************/
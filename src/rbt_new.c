@@ -17,6 +17,7 @@
 * Copyright (c) 2020 Michael Walsh Pedersen
 *********************************************************************/
 
+#include <stdlib.h>
 #include "rbt.h"
 #include "rbt_internal.h"
 
@@ -38,7 +39,27 @@ RBT * rbt_new(
         return NULL;
     r->root = NULL;
     r->size = 0;
+    r->size_unknown = 0;
     r->def  = def;
+    r->journal = NULL;
+    r->hash = NULL;
+    r->del_gen = 0;
+    r->lazy = 0;
+    r->tombs = 0;
+    r->max_tombs = 0;
+    r->purge_pos = NULL;
+    r->purge_gen = 0;
+    r->delta = NULL;
+    r->delta_max = 0;
+    r->first = NULL;
+    r->last = NULL;
+    r->minmax_gen = r->del_gen; /* valid: empty */
+    r->cap = NULL;
+    r->bytes = 0;
+    r->conc = NULL;
+    r->repl = NULL;
+    r->relax = NULL;
+    rbt_stats_reset( r );
     return r;
 }
 
@@ -53,7 +74,27 @@ void rbt_init(
 {
     r->root = NULL;
     r->size = 0;
+    r->size_unknown = 0;
     r->def  = def;
+    r->journal = NULL;
+    r->hash = NULL;
+    r->del_gen = 0;
+    r->lazy = 0;
+    r->tombs = 0;
+    r->max_tombs = 0;
+    r->purge_pos = NULL;
+    r->purge_gen = 0;
+    r->delta = NULL;
+    r->delta_max = 0;
+    r->first = NULL;
+    r->last = NULL;
+    r->minmax_gen = r->del_gen; /* valid: empty */
+    r->cap = NULL;
+    r->bytes = 0;
+    r->conc = NULL;
+    r->repl = NULL;
+    r->relax = NULL;
+    rbt_stats_reset( r );
 }
 
 /*********************************************************************
@@ -80,12 +121,24 @@ static void free_node(
 
 /*********************************************************************
 * void rbt_free(...)
-* Free a complete tree including all its nodes.
+* Free a complete tree including all its nodes (and close its journal).
 *********************************************************************/
 
 void rbt_free(
     RBT * rbt)
 {
+    rbt_concurrent( rbt, 0 );
+    if( rbt->journal )
+        rbt_journal_close( rbt );
+    if( rbt->delta )
+    {
+        rbt_clr( rbt->delta );
+        rbt_buffer( rbt, 0 ); /* nothing to merge, free the buffer */
+    }
+    rbt_capacity( rbt, NULL );
+    rbti_hash_drop( rbt );
+    rbti_repl_drop( rbt );
+    free( rbt->relax );
     free_node( rbt, rbt->root );
     if( rbt->def->freeRoot )
         rbt->def->freeRoot( rbt );
@@ -93,42 +146,72 @@ void rbt_free(
     {
         rbt->root = NULL;
         rbt->size = 0;
+        rbt->size_unknown = 0;
     }
 }
 
 /*********************************************************************
 * void rbt_clr(...)
-* Clear all nodes
+* Clear all nodes. The hash index is emptied and kept, as are the write
+* buffer and the modes of the tree (rbt_free frees them).
 *********************************************************************/
 
 void rbt_clr(
     RBT * rbt)
 {
+    if( rbt->journal )
+        rbti_journal( rbt, RBTI_J_CLEAR, NULL );
+    rbti_hash_clear( rbt );
+    rbt->del_gen++;
+    if( rbt->delta )
+        rbt_clr( rbt->delta );
     free_node( rbt, rbt->root );
     rbt->root = NULL;
     rbt->size = 0;
+    rbt->size_unknown = 0;
+    rbt->tombs = 0;
+    rbt->bytes = 0;
+    if( rbt->relax )
+        rbt->relax->n = 0;
+    rbti_minmax( rbt );
 }
 
 /*********************************************************************
 * void rbt_clr2(...)
-* Clear all nodes for 2nd (3rd..) tree
+* Clear all nodes for 2nd (3rd..) tree (without freeing them; the
+* hash index is kept, as by rbt_clr)
 *********************************************************************/
 
 void rbt_clr2(
     RBT * rbt)
 {
+    if( rbt->journal )
+        rbti_journal( rbt, RBTI_J_CLEAR, NULL );
+    rbti_hash_clear( rbt );
+    rbt->del_gen++;
+    if( rbt->delta )
+        rbt_clr2( rbt->delta );
     rbt->root = NULL;
     rbt->size = 0;
+    rbt->size_unknown = 0;
+    rbt->tombs = 0;
+    rbt->bytes = 0;
+    if( rbt->relax )
+        rbt->relax->n = 0;
+    rbti_minmax( rbt );
 }
 
 /*********************************************************************
 * size_t rbt_size(...)
-* Return count of nodes
+* Return count of nodes (with the write buffer, see rbti_buffered_size)
 *********************************************************************/
 
 size_t rbt_size(
     RBT * rbt)
 {
+    size_count(rbt);
+    if( delta_used(rbt) )
+        return rbti_buffered_size( rbt );
     return rbt->size;
 }
 
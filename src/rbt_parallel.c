@@ -0,0 +1,273 @@
+/*********************************************************************
+* Red Black Tree functions (threaded)
+*
+* rbt_parallel.c
+*
+**********************************************************************
+* functions:
+*
+*   int rbt_parallel_for   ( RBT * rbt, int nthreads,
+*                            void (*fn)(void*node,void*ctx), void * ctx )
+*   int rbt_parallel_reduce( RBT * rbt, int nthreads,
+*                            void (*fn)(void*node,void*acc,void*ctx),
+*                            void (*merge)(void*acc,void*acc2,void*ctx),
+*                            void * acc, size_t acc_size, void * ctx )
+*
+**********************************************************************
+* In-order traversal in parallel. The nodes in the top levels of the
+* tree split it into chunks of about the same size (a red-black tree
+* is balanced), about PAR_CHUNKS per thread, so a slow chunk does not
+* hold up the others. Each chunk is walked by the threads from its
+* first node up to the next split node.
+*
+* The chunks are taken by a pool of nthreads (incl. the caller) when
+* build with -DRBT_PTHREAD, else all run in the calling thread.
+* The tree must not be changed during the traversal.
+**********************************************************************
+* Copyright (c) 2020 Michael Walsh Pedersen
+*********************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include "rbt.h"
+#include "rbt_internal.h"
+
+#ifdef RBT_PTHREAD
+#include <pthread.h>
+#endif
+
+#define PAR_CHUNKS     4    /* chunks per thread */
+#define PAR_MAX_DEPTH  10   /* max 1023 split nodes */
+#define PAR_MAX_THREADS 256  /* incl. the caller */
+
+/*********************************************************************
+*
+*********************************************************************/
+
+typedef struct {
+    RBT      * rbt;
+    void    (* fn)(void*node,void*ctx);
+    void    (* fn_acc)(void*node,void*acc,void*ctx);
+    void     * ctx;
+    char     * accs;        /* reduce: accumulator per chunk */
+    size_t     acc_size;
+    void     * split[1 << PAR_MAX_DEPTH];  /* in order */
+    int        nsplit;
+    int        next_chunk;  /* next chunk to take (atomic) */
+} VAR;
+
+/*********************************************************************
+* static void collect(...)
+* Add the nodes above depth max of subtree n to var->split, in order.
+*********************************************************************/
+
+static void collect(
+    RBTDEF * def,
+    VAR    * var,
+    void   * n,
+    int      depth,
+    int      max)
+{
+    if( depth == max )
+        return;
+    if( is_left_data(n) )
+        collect( def, var, child_left(n), depth + 1, max );
+    var->split[var->nsplit++] = n;
+    if( is_right_data(n) )
+        collect( def, var, child_right(n), depth + 1, max );
+}
+
+/*********************************************************************
+* static void run_chunk(...)
+* Chunk i: from split[i-1] (or the first node) up to split[i].
+*********************************************************************/
+
+static void run_chunk(
+    VAR * var,
+    int   i)
+{
+    RBTDEF * def;
+    void   * n;
+    void   * end;
+    void   * acc;
+
+    def = var->rbt->def;
+    if( i > 0 )
+        n = var->split[i-1];
+    else
+        n = rbti_min( def, var->rbt->root );
+    end = i < var->nsplit ? var->split[i] : NULL;
+    acc = var->accs ? var->accs + i * var->acc_size : NULL;
+    for( ; n != end ; n = rbti_next( def, n ) )
+    {
+        if( is_tomb(n) ) /* lazy deleted */
+            continue;
+        if( acc )
+            var->fn_acc( n, acc, var->ctx );
+        else
+            var->fn( n, var->ctx );
+    }
+}
+
+/*********************************************************************
+* static void * worker(...)
+* Take chunks until all are done.
+*********************************************************************/
+
+static void * worker(
+    void * arg)
+{
+    VAR * var;
+    int   i;
+
+    var = (VAR*)arg;
+    while( ( i = __atomic_fetch_add( &var->next_chunk, 1, __ATOMIC_RELAXED ) )
+        <= var->nsplit )
+        run_chunk( var, i );
+    return NULL;
+}
+
+/*********************************************************************
+* static void split_tree(...)
+* Collect the split nodes for nthreads.
+*********************************************************************/
+
+static void split_tree(
+    VAR * var,
+    int   nthreads)
+{
+    int depth;
+
+    depth = 0;
+    if( nthreads > PAR_MAX_THREADS )
+        nthreads = PAR_MAX_THREADS;
+    if( nthreads > 1 )
+        while( depth < PAR_MAX_DEPTH
+            && ( 1 << depth ) < nthreads * PAR_CHUNKS )
+            depth++;
+    var->nsplit = 0;
+    var->next_chunk = 0;
+    collect( var->rbt->def, var, var->rbt->root, 0, depth );
+}
+
+/*********************************************************************
+* static void run_chunks(...)
+* Run all chunks (nsplit + 1) on nthreads.
+*********************************************************************/
+
+static void run_chunks(
+    VAR * var,
+    int   nthreads)
+{
+#ifdef RBT_PTHREAD
+    pthread_t th[PAR_MAX_THREADS];
+    int       i, n;
+
+    for( n = 0 ; n < nthreads - 1 && n < PAR_MAX_THREADS - 1 ; n++ )
+        if( pthread_create( &th[n], NULL, worker, var ) != 0 )
+            break;
+    worker( var );
+    for( i = 0 ; i < n ; i++ )
+        pthread_join( th[i], NULL );
+#else
+    (void)nthreads;
+    worker( var );
+#endif
+}
+
+/*********************************************************************
+* int rbt_parallel_for( RBT * rbt, int nthreads,
+*                       void (*fn)(void*node,void*ctx), void * ctx )
+* Call fn for all nodes, on nthreads threads. Each thread calls fn in
+* ascending order within a chunk, but the chunks run in any order.
+* Not in concurrent mode (the tree must not change meanwhile).
+* Return: RBT_RC_OK(0), RBT_RC_ERROR(-1)
+*********************************************************************/
+
+int rbt_parallel_for(
+    RBT    * rbt,
+    int      nthreads,
+    void  (* fn)(void*node,void*ctx),
+    void   * ctx )
+{
+    VAR * var;
+
+    if( fn == NULL || rbt->conc )
+        return RBT_RC_ERROR;
+    delta_merge(rbt);
+    if( rbt->root == NULL )
+        return RBT_RC_OK;
+    var = (VAR*)malloc( sizeof(VAR) );
+    if( var == NULL )
+        return RBT_RC_ERROR;
+    var->rbt = rbt;
+    var->fn = fn;
+    var->fn_acc = NULL;
+    var->ctx = ctx;
+    var->accs = NULL;
+    var->acc_size = 0;
+    split_tree( var, nthreads );
+    run_chunks( var, nthreads );
+    free( var );
+    return RBT_RC_OK;
+}
+
+/*********************************************************************
+* int rbt_parallel_reduce( RBT * rbt, int nthreads,
+*                          void (*fn)(void*node,void*acc,void*ctx),
+*                          void (*merge)(void*acc,void*acc2,void*ctx),
+*                          void * acc, size_t acc_size, void * ctx )
+* Reduce all nodes into acc (acc_size bytes), on nthreads threads.
+* acc must be the identity (eg. 0 for a sum): each chunk starts with a
+* copy of it, folds its nodes by fn in ascending order, and the chunks
+* are merged into acc in ascending order by merge(acc, chunk acc), so
+* merge need not be commutative (eg. a checksum of the ordered nodes).
+* Not in concurrent mode.
+* Return: RBT_RC_OK(0), RBT_RC_ERROR(-1)
+*********************************************************************/
+
+int rbt_parallel_reduce(
+    RBT    * rbt,
+    int      nthreads,
+    void  (* fn)(void*node,void*acc,void*ctx),
+    void  (* merge)(void*acc,void*acc2,void*ctx),
+    void   * acc,
+    size_t   acc_size,
+    void   * ctx )
+{
+    VAR * var;
+    int   i;
+
+    if( fn == NULL || merge == NULL || acc == NULL || acc_size == 0
+        || rbt->conc )
+        return RBT_RC_ERROR;
+    delta_merge(rbt);
+    if( rbt->root == NULL )
+        return RBT_RC_OK;
+    var = (VAR*)malloc( sizeof(VAR) );
+    if( var == NULL )
+        return RBT_RC_ERROR;
+    var->rbt = rbt;
+    var->fn = NULL;
+    var->fn_acc = fn;
+    var->ctx = ctx;
+    var->acc_size = acc_size;
+    split_tree( var, nthreads );
+    var->accs = (char*)malloc( acc_size * ( var->nsplit + 1 ) );
+    if( var->accs == NULL )
+    {
+        free( var );
+        return RBT_RC_ERROR;
+    }
+    for( i = 0 ; i <= var->nsplit ; i++ )
+        memcpy( var->accs + i * acc_size, acc, acc_size );
+    run_chunks( var, nthreads );
+    for( i = 0 ; i <= var->nsplit ; i++ )
+        merge( acc, var->accs + i * acc_size, ctx );
+    free( var->accs );
+    free( var );
+    return RBT_RC_OK;
+}
+
+/***[end-of-file]****************************************************/
+/********************************************************************/
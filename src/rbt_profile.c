@@ -0,0 +1,148 @@
+/*********************************************************************
+* Red Black Tree functions (threaded)
+*
+* rbt_profile.c
+*
+**********************************************************************
+* functions:
+*
+*   int rbt_profile( RBT * rbt, RBTPROFILE * report )
+*
+**********************************************************************
+* Tree shape and memory footprint, eg. to decide when to rebuild or
+* compact a tree. One in-order walk following the thread pointers (no
+* recursion), O(n) time and O(log n) memory (the depths of the nodes
+* where the walk went left, to be used when their thread is followed).
+**********************************************************************
+* Copyright (c) 2020 Michael Walsh Pedersen
+*********************************************************************/
+
+#include <string.h>
+#include "rbt.h"
+#include "rbt_internal.h"
+
+#define PAGE_SIZE_4K 4096
+
+/*********************************************************************
+*
+*********************************************************************/
+
+typedef struct {
+    size_t       depth_sum;
+    size_t       reds;
+    size_t       links;
+    size_t       page_links;
+    double       dist_sum;
+    size_t       addr_lo;
+    size_t       addr_hi;
+} VAR;
+
+/*********************************************************************
+* static void link_stat(...)
+* Count the data link from parent p to child c.
+*********************************************************************/
+
+static void link_stat(
+    VAR  * var,
+    void * p,
+    void * c)
+{
+    size_t a, b;
+
+    a = (size_t)p;
+    b = (size_t)c;
+    var->links++;
+    var->dist_sum += a < b ? b - a : a - b;
+    if( a / PAGE_SIZE_4K == b / PAGE_SIZE_4K )
+        var->page_links++;
+}
+
+/*********************************************************************
+* int rbt_profile( RBT * rbt, RBTPROFILE * report )
+* Fill report for rbt. A depth is the count of nodes visited by a
+* search (the root has depth 1).
+* Return: RBT_RC_OK(0)
+*********************************************************************/
+
+int rbt_profile(
+    RBT        * rbt,
+    RBTPROFILE * report )
+{
+    RBTDEF * def;
+    VAR      Var;
+    void   * n;
+    int      stack[RBT_PROFILE_DEPTHS]; /* depths of left turns */
+    int      sp, d, down;
+    size_t   a;
+
+    def = rbt->def;
+    delta_merge(rbt);
+    memset( report, 0, sizeof(*report) );
+    memset( &Var, 0, sizeof(Var) );
+    Var.addr_lo = (size_t)-1;
+
+    n = rbt->root;
+    sp = 0;
+    d = 1;
+    down = 1;
+    while( n )
+    {
+        /* down to the first node of subtree n */
+        while( down && is_left_data(n) && sp < RBT_PROFILE_DEPTHS )
+        {
+            link_stat( &Var, n, child_left(n) );
+            stack[sp++] = d++;
+            n = child_left(n);
+        }
+
+        /* visit n */
+        report->nodes++;
+        report->depth_hist[d < RBT_PROFILE_DEPTHS ? d : 0]++;
+        if( d > report->max_depth )
+            report->max_depth = d;
+        Var.depth_sum += d;
+        if( is_red(n) )
+            Var.reds++;
+        a = (size_t)n;
+        if( a < Var.addr_lo )
+            Var.addr_lo = a;
+        if( a > Var.addr_hi )
+            Var.addr_hi = a;
+
+        /* next node */
+        if( is_right_data(n) )
+        {
+            link_stat( &Var, n, child_right(n) );
+            n = child_right(n);
+            d++;
+            down = 1;
+        }
+        else
+        {
+            n = child_right(n); /* thread ptr */
+            if( n == NULL || sp == 0 )
+                break;
+            d = stack[--sp];
+            down = 0; /* left subtree of n is done */
+        }
+    }
+
+    if( report->nodes )
+    {
+        report->avg_depth = (double)Var.depth_sum / report->nodes;
+        report->black_height = rbti_black_height( def, rbt->root );
+        report->red_ratio = (double)Var.reds / report->nodes;
+        report->addr_spread = Var.addr_hi - Var.addr_lo;
+        report->node_bytes = report->nodes * def->node_size;
+        report->link_bytes = report->nodes * ( 2 * sizeof(void*) + 1 );
+    }
+    if( Var.links )
+    {
+        report->avg_link_dist = Var.dist_sum / Var.links;
+        report->page_locality = (double)Var.page_links / Var.links;
+    }
+    return RBT_RC_OK;
+}
+
+/***[end-of-file]****************************************************/
+/********************************************************************/
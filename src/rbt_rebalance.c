@@ -0,0 +1,250 @@
+/*********************************************************************
+* Red Black Tree functions (threaded)
+*
+* rbt_rebalance.c
+*
+**********************************************************************
+* functions:
+*
+*   int    rbt_relaxed       ( RBT * rbt, int on, size_t max_viol )
+*   size_t rbt_rebalance_step( RBT * rbt, size_t budget )
+*
+* internal:
+*
+*   void   rbti_relax_fix    ( RBT * rbt )
+*   void   rbti_relax_replace( RBT * rbt, void * old_node, void * node )
+*
+**********************************************************************
+* Relaxed balance: an insert adds the new red node without recoloring
+* or rotations, and if its parent is red, records it (rbt->relax). The
+* black heights stay equal, so the only violations are red nodes with
+* a red parent, and each such node is recorded (rotations move them,
+* but keep them red with a red parent). Deletes are lazy (tombstones),
+* which defers their rebalancing too.
+*
+* A repair searches the path to a recorded node, and fixes the topmost
+* red-red on the path as an insert does: the root becomes black, or a
+* red uncle and the parent become black and the grandparent red (which
+* may make a red-red higher up the path), or one or two rotations. It
+* goes on until the path has no red-red.
+*
+* A path has at most as many red nodes with a black parent as it has
+* black nodes, so the depth is at most 2 * black height + recorded
+* nodes (max_viol).
+**********************************************************************
+* Copyright (c) 2020 Michael Walsh Pedersen
+*********************************************************************/
+
+#include <stdlib.h>
+#include "rbt.h"
+#include "rbt_internal.h"
+
+#define RELAX_DEF_VIOL   32    /* max_viol 0 */
+#define RELAX_MAX_VIOL   64    /* (the depth must stay < 128) */
+#define RELAX_MAX_PATH   256   /* > 2 * black height + RELAX_MAX_VIOL */
+
+/*********************************************************************
+* static size_t find_path(...)
+* Search node from the root, path[0] is the root.
+* Return: count of nodes on the path to node, 0: not found
+*********************************************************************/
+
+static size_t find_path(
+    RBT    * rbt,
+    void   * node,
+    void  ** path)
+{
+    RBTDEF * def;
+    void   * n;
+    size_t   d;
+    int      rc;
+
+    def = rbt->def;
+    for( n = rbt->root, d = 0 ; n && d < RELAX_MAX_PATH ; )
+    {
+        path[d++] = n;
+        if( n == node )
+            return d;
+        stat_inc(rbt, visits);
+        stat_inc(rbt, node_cmp);
+        rc = rbti_node_cmp( def, n, node );
+        if( rc == 0 || !is_data(n,rc<0) )
+            return 0;
+        n = child(n,rc<0);
+    }
+    return 0;
+}
+
+/*********************************************************************
+* static void repair(...)
+* Fix the red-red nodes on the path to node (recorded by an insert).
+*********************************************************************/
+
+static void repair(
+    RBT    * rbt,
+    void   * node)
+{
+    RBTDEF * def;
+    void   * path[RELAX_MAX_PATH];
+    void   * x, * p, * g, * u, * t, * s;
+    size_t   d, i;
+    int      last;
+
+    def = rbt->def;
+    while( ( d = find_path( rbt, node, path ) ) != 0 )
+    {
+        for( i = 1 ; i < d ; i++ ) /* the topmost red-red */
+            if( is_red(path[i]) && is_red(path[i-1]) )
+                break;
+        if( i == d )
+            return;
+        x = path[i];
+        p = path[i-1];
+        stat_inc(rbt, recolors);
+        if( i == 1 ) /* p is the root */
+        {
+            set_black(p);
+            continue;
+        }
+        g = path[i-2]; /* black (as the red-red is the topmost) */
+        last = is_data(g,1) && child(g,1) == p;
+        u = is_data(g,!last) ? child(g,!last) : NULL;
+        if( u && is_red(u) )
+        {
+            set_black(p);
+            set_black(u);
+            if( i > 2 ) /* the root stays black */
+                set_red(g);
+            continue;
+        }
+        if( !( is_data(p,last) && child(p,last) == x ) ) /* inner x */
+        {
+            child(g,last) = rbti_rotate( def, p, last );
+            stat_inc(rbt, rotations);
+        }
+        s = rbti_rotate( def, g, !last );
+        stat_inc(rbt, rotations);
+        if( i == 2 )
+            rbt->root = s;
+        else
+        {
+            t = path[i-3];
+            child(t,is_data(t,1) && child(t,1) == g) = s;
+        }
+    }
+}
+
+/*********************************************************************
+* void rbti_relax_fix(...)
+* Repair all recorded nodes.
+*********************************************************************/
+
+void rbti_relax_fix(
+    RBT    * rbt)
+{
+    RBTRELAX * rx;
+
+    rx = rbt->relax;
+    while( rx->n )
+        repair( rbt, rx->viol[--rx->n] );
+}
+
+/*********************************************************************
+* void rbti_relax_replace(...)
+* node replaced old_node (an insert of an equal key): keep it recorded
+* (in O(max_viol), as old_node may be recorded, even if black by now).
+*********************************************************************/
+
+void rbti_relax_replace(
+    RBT    * rbt,
+    void   * old_node,
+    void   * node)
+{
+    RBTRELAX * rx;
+    size_t     i;
+
+    rx = rbt->relax;
+    for( i = rx->n ; i > 0 ; i-- )
+        if( rx->viol[i-1] == old_node )
+        {
+            rx->viol[i-1] = node;
+            return;
+        }
+}
+
+/*********************************************************************
+* int rbt_relaxed( RBT * rbt, int on, size_t max_viol )
+* Relaxed balance on/off. When on, inserts do not rebalance the tree,
+* but record where it is out of balance, and deletes are lazy (see
+* rbt_lazy_delete); searches and iterations are not affected. The tree
+* is rebalanced by rbt_rebalance_step (eg. in idle time), and by an
+* insert when max_viol (1..64, 0: 32) nodes are recorded, so its depth
+* is at most 2 * black height + max_viol. All recorded nodes are also
+* repaired before the _keep deletes, rbt_erase_keep, rbt_pop_xxx,
+* split, join, the set operations and rbt_purge. When turned off, the
+* tree is rebalanced, and the tombstones are purged (unless lazy
+* delete is on). Not for multiset trees, nor in concurrent mode.
+* Return: RBT_RC_OK(0), RBT_RC_ERROR(-1)
+*********************************************************************/
+
+int rbt_relaxed(
+    RBT    * rbt,
+    int      on,
+    size_t   max_viol )
+{
+    RBTRELAX * rx;
+
+    if( on && ( is_multiset(rbt->def) || rbt->conc
+        || max_viol > RELAX_MAX_VIOL ) )
+        return RBT_RC_ERROR;
+    if( rbt->relax )
+    {
+        relax_fix(rbt);
+        free( rbt->relax );
+        rbt->relax = NULL;
+    }
+    if( !on )
+    {
+        if( !rbt->lazy && rbt->tombs )
+            rbt_purge( rbt, 0 );
+        return RBT_RC_OK;
+    }
+    if( max_viol == 0 )
+        max_viol = RELAX_DEF_VIOL;
+    rx = (RBTRELAX*)malloc( sizeof(RBTRELAX) + max_viol * sizeof(void*) );
+    if( rx == NULL )
+        return RBT_RC_ERROR;
+    rx->max = max_viol;
+    rx->n = 0;
+    rx->viol = (void**)( rx + 1 );
+    rbt->relax = rx;
+    return RBT_RC_OK;
+}
+
+/*********************************************************************
+* size_t rbt_rebalance_step( RBT * rbt, size_t budget )
+* Repair at most budget recorded nodes (0: all), each in O(log n),
+* and then, with the rest of the budget, remove tombstones (visiting
+* at most that many nodes, see rbt_purge).
+* Return: count of recorded nodes and tombstones left (0: balanced)
+*********************************************************************/
+
+size_t rbt_rebalance_step(
+    RBT    * rbt,
+    size_t   budget )
+{
+    RBTRELAX * rx;
+    size_t     done;
+
+    rx = rbt->relax;
+    done = 0;
+    if( rx )
+        for( ; rx->n && ( budget == 0 || done < budget ) ; done++ )
+            repair( rbt, rx->viol[--rx->n] );
+    if( rbt->tombs && ( budget == 0 || done < budget ) )
+        rbt_purge( rbt, budget ? budget - done : 0 );
+    return ( rx ? rx->n : 0 ) + rbt->tombs;
+}
+
+/***[end-of-file]****************************************************/
+/********************************************************************/
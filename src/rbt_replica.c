@@ -0,0 +1,393 @@
+/*********************************************************************
+* Red Black Tree functions (threaded)
+*
+* rbt_replica.c
+*
+**********************************************************************
+* functions:
+*
+*   int          rbt_publish        ( RBT * rbt )
+*   RBTREPLICA * rbt_replica_new    ( RBT * primary )
+*   int          rbt_replica_refresh( RBTREPLICA * rep )
+*   RBT        * rbt_replica_tree   ( RBTREPLICA * rep )
+*   void         rbt_replica_release( RBTREPLICA * rep, RBT * tree )
+*   void         rbt_replica_free   ( RBTREPLICA * rep )
+*
+* internal:
+*
+*   void         rbti_repl_drop     ( RBT * rbt )
+*   size_t       rbti_repl_bytes    ( RBT * rbt )
+*
+**********************************************************************
+* Read-only replicas of a read-mostly tree: the writer publishes an
+* image of the primary tree (all nodes in key order, in one block)
+* after its changes, and each group of readers refreshes its own copy
+* of the latest image when it suits it. A copy is one block of nodes
+* allocated by the refreshing thread (so on its NUMA node), with the
+* links built in O(n) without compares (rbti_build), and a hash index
+* if the def has keyHash. Readers then never touch the nodes of the
+* primary, or of other groups.
+*
+* The refreshed copy is swapped in atomically, into the slot of the
+* copy before the current one. Each slot counts its readers: a reader
+* gets the current copy by rbt_replica_tree, and gives it back by
+* rbt_replica_release; a refresh does not free a copy that has readers
+* (it returns RBT_RC_NOTFOUND, and is tried again later), so a reader
+* may scan one copy across any number of refreshes.
+*
+* The nodes are copied by memcpy (def->node_size): data they point to
+* is shared with the primary, and must not be changed or freed while
+* an image or copy has the node.
+**********************************************************************
+* Copyright (c) 2020 Michael Walsh Pedersen
+*********************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include "rbt.h"
+#include "rbt_internal.h"
+
+/*********************************************************************
+*
+*********************************************************************/
+
+typedef struct {
+    size_t     refs;              /* the primary and refreshing copies */
+    unsigned long long version;
+    size_t     n;                 /* nodes */
+    char     * nodes;             /* n * node_size bytes, in key order */
+} RBTIMAGE;
+
+struct RBTREPL {                  /* rbt->repl of the primary */
+    char       lock;              /* lock of image and refs */
+    size_t     refs;              /* the primary and its replicas */
+    unsigned long long version;   /* of the last image */
+    RBTIMAGE * image;             /* last published image */
+};
+
+struct RBTREPLICA {
+    RBTREPL  * repl;              /* images of the primary */
+    RBTDEF     def;               /* def of the primary, no freeNode */
+    RBT        tree[2];           /* current and previous copy */
+    void     * block[2];          /* their nodes */
+    size_t     readers[2];        /* readers using tree[k] */
+    int        cur;               /* tree[cur] is current */
+    unsigned long long version;   /* image version of tree[cur] */
+};
+
+/*********************************************************************
+* static void no_free(...)
+* The nodes of a copy are freed with its block.
+*********************************************************************/
+
+static void no_free(
+    void   * node)
+{
+    (void)node;
+}
+
+/*********************************************************************
+* static void image_release(...)
+* Drop a reference to img, and free it with the last one.
+*********************************************************************/
+
+static void image_release(
+    RBTIMAGE * img)
+{
+    if( img && __atomic_sub_fetch( &img->refs, 1, __ATOMIC_ACQ_REL ) == 0 )
+    {
+        free( img->nodes );
+        free( img );
+    }
+}
+
+/*********************************************************************
+* static void repl_release(...)
+* Drop a reference to repl, and free it with the last one.
+*********************************************************************/
+
+static void repl_release(
+    RBTREPL  * repl)
+{
+    size_t refs;
+
+    rbti_lock( &repl->lock );
+    refs = --repl->refs;
+    rbti_unlock( &repl->lock );
+    if( refs == 0 )
+    {
+        image_release( repl->image );
+        free( repl );
+    }
+}
+
+/*********************************************************************
+* void rbti_repl_drop(...)
+* The primary rbt is freed or closed: its replicas keep the images.
+*********************************************************************/
+
+void rbti_repl_drop(
+    RBT    * rbt)
+{
+    if( rbt->repl )
+    {
+        repl_release( rbt->repl );
+        rbt->repl = NULL;
+    }
+}
+
+/*********************************************************************
+* size_t rbti_repl_bytes(...)
+* Return: bytes of the images of the primary rbt: its last published
+*         image (shared with the replicas that copy it), 0: none.
+*********************************************************************/
+
+size_t rbti_repl_bytes(
+    RBT    * rbt)
+{
+    RBTREPL * repl;
+    size_t    bytes;
+
+    repl = rbt->repl;
+    if( repl == NULL )
+        return 0;
+    rbti_lock( &repl->lock );
+    bytes = sizeof(RBTREPL);
+    if( repl->image )
+        bytes += sizeof(RBTIMAGE) + repl->image->n * rbt->def->node_size;
+    rbti_unlock( &repl->lock );
+    return bytes;
+}
+
+/*********************************************************************
+* int rbt_publish( RBT * rbt )
+* Publish an image of rbt (merging its write buffer, and without the
+* lazy deleted nodes) for rbt_replica_refresh. Call it from the writer,
+* after a batch of changes. Not in concurrent mode, and the nodes must
+* have a size (def->node_size).
+* Return: RBT_RC_OK(0), RBT_RC_ERROR(-1)
+*********************************************************************/
+
+int rbt_publish(
+    RBT    * rbt )
+{
+    RBTDEF   * def;
+    RBTREPL  * repl;
+    RBTIMAGE * img, * old;
+    char     * p;
+    void     * n;
+
+    def = rbt->def;
+    if( rbt->conc || def->node_size == 0 )
+        return RBT_RC_ERROR;
+    delta_merge(rbt);
+    if( rbt->repl == NULL )
+    {
+        rbt->repl = (RBTREPL*)calloc( 1, sizeof(RBTREPL) );
+        if( rbt->repl == NULL )
+            return RBT_RC_ERROR;
+        rbt->repl->refs = 1;
+    }
+    repl = rbt->repl;
+    img = (RBTIMAGE*)malloc( sizeof(RBTIMAGE) );
+    if( img == NULL )
+        return RBT_RC_ERROR;
+    img->refs = 1;
+    size_count(rbt);
+    img->n = rbt->size;
+    img->nodes = NULL;
+    if( img->n )
+    {
+        img->nodes = (char*)malloc( img->n * def->node_size );
+        if( img->nodes == NULL )
+        {
+            free( img );
+            return RBT_RC_ERROR;
+        }
+    }
+    p = img->nodes;
+    for( n = rbti_min( def, rbt->root ) ; n ; n = rbti_next( def, n ) )
+        if( !is_tomb(n) )
+        {
+            memcpy( p, n, def->node_size );
+            p += def->node_size;
+        }
+
+    rbti_lock( &repl->lock );
+    img->version = ++repl->version;
+    old = repl->image;
+    repl->image = img;
+    rbti_unlock( &repl->lock );
+    image_release( old );
+    return RBT_RC_OK;
+}
+
+/*********************************************************************
+* RBTREPLICA * rbt_replica_new( RBT * primary )
+* Create a replica of primary (after its first rbt_publish), with a
+* copy of the last image. Call it from the thread that refreshes the
+* replica, so the copies are allocated on its NUMA node.
+* Return: the replica, or NULL (not published, or no memory).
+*********************************************************************/
+
+RBTREPLICA * rbt_replica_new(
+    RBT    * primary )
+{
+    RBTREPLICA * rep;
+    RBTREPL    * repl;
+
+    repl = primary->repl;
+    if( repl == NULL )
+        return NULL;
+    rep = (RBTREPLICA*)malloc( sizeof(RBTREPLICA) );
+    if( rep == NULL )
+        return NULL;
+    rbti_lock( &repl->lock );
+    repl->refs++;
+    rbti_unlock( &repl->lock );
+    rep->repl = repl;
+    rep->def = *primary->def;
+    rep->def.freeNode = no_free;
+    rbt_init( &rep->tree[0], &rep->def );
+    rbt_init( &rep->tree[1], &rep->def );
+    rep->block[0] = rep->block[1] = NULL;
+    rep->readers[0] = rep->readers[1] = 0;
+    rep->cur = 0;
+    rep->version = 0;
+    if( rbt_replica_refresh( rep ) == RBT_RC_ERROR )
+    {
+        rbt_replica_free( rep );
+        return NULL;
+    }
+    return rep;
+}
+
+/*********************************************************************
+* int rbt_replica_refresh( RBTREPLICA * rep )
+* Copy the last published image into a new block, and make it the
+* current tree of rep; the tree before the previous refresh is freed,
+* unless a reader still has it (see rbt_replica_release).
+* One thread at a time per replica (the readers may go on meanwhile).
+* Return: RBT_RC_OK(0): refreshed, RBT_RC_NOTFOUND(1): not refreshed,
+*         rep has the last image already, or the tree before still has
+*         readers (try again later), RBT_RC_ERROR(-1): no memory (rep
+*         keeps its current tree)
+*********************************************************************/
+
+int rbt_replica_refresh(
+    RBTREPLICA * rep )
+{
+    RBTDEF   * def;
+    RBTIMAGE * img;
+    RBT      * t;
+    char     * block;
+    size_t     i;
+    int        k;
+
+    def = &rep->def;
+    rbti_lock( &rep->repl->lock );
+    img = rep->repl->image;
+    __atomic_add_fetch( &img->refs, 1, __ATOMIC_RELAXED );
+    rbti_unlock( &rep->repl->lock );
+    k = 1 - rep->cur;
+    /* readers pin tree[k] before they check rep->cur (seq_cst both
+       sides): a reader counted after this sees k is not current, and
+       lets go of it without using it */
+    if( img->version == rep->version
+        || __atomic_load_n( &rep->readers[k], __ATOMIC_SEQ_CST ) )
+    {
+        image_release( img );
+        return RBT_RC_NOTFOUND;
+    }
+    block = NULL;
+    if( img->n )
+    {
+        block = (char*)malloc( img->n * def->node_size );
+        if( block == NULL )
+        {
+            image_release( img );
+            return RBT_RC_ERROR;
+        }
+        memcpy( block, img->nodes, img->n * def->node_size );
+        for( i = 0 ; i + 1 < img->n ; i++ ) /* the list for rbti_build */
+            child_right( block + i * def->node_size ) =
+                block + ( i + 1 ) * def->node_size;
+        child_right( block + i * def->node_size ) = NULL;
+    }
+
+    t = &rep->tree[k];
+    rbti_hash_drop( t );
+    free( rep->block[k] );
+    rbt_init( t, def );
+    t->root = rbti_build( def, block, img->n );
+    t->size = img->n;
+    minmax_reset(t);
+    rbti_minmax( t );           /* readers never update the cache */
+    if( def->keyHash && def->nodeHash && !is_multiset(def) )
+        rbt_hash_build( t );    /* (without it, rbt_get uses the tree) */
+    rep->block[k] = block;
+    rep->version = img->version;
+    image_release( img );
+    __atomic_store_n( &rep->cur, k, __ATOMIC_SEQ_CST );
+    return RBT_RC_OK;
+}
+
+/*********************************************************************
+* RBT * rbt_replica_tree( RBTREPLICA * rep )
+* The current copy, for rbt_get, rbt_feq, rbt_first/next etc. It must
+* not be changed, and is kept (by later refreshes) until the reader
+* gives it back by rbt_replica_release.
+* Return: tree (read-only)
+*********************************************************************/
+
+RBT * rbt_replica_tree(
+    RBTREPLICA * rep )
+{
+    int k;
+
+    for( ;; )
+    {
+        k = __atomic_load_n( &rep->cur, __ATOMIC_ACQUIRE );
+        __atomic_add_fetch( &rep->readers[k], 1, __ATOMIC_SEQ_CST );
+        if( __atomic_load_n( &rep->cur, __ATOMIC_SEQ_CST ) == k )
+            return &rep->tree[k];
+        /* refreshed meanwhile: tree[k] may be rebuilt now */
+        __atomic_sub_fetch( &rep->readers[k], 1, __ATOMIC_RELEASE );
+    }
+}
+
+/*********************************************************************
+* void rbt_replica_release( RBTREPLICA * rep, RBT * tree )
+* The reader is done with tree (from rbt_replica_tree): a refresh may
+* free it now.
+*********************************************************************/
+
+void rbt_replica_release(
+    RBTREPLICA * rep,
+    RBT        * tree )
+{
+    __atomic_sub_fetch( &rep->readers[tree - rep->tree], 1,
+        __ATOMIC_RELEASE );
+}
+
+/*********************************************************************
+* void rbt_replica_free( RBTREPLICA * rep )
+* Free the replica and its copies (when its readers are done).
+*********************************************************************/
+
+void rbt_replica_free(
+    RBTREPLICA * rep )
+{
+    int k;
+
+    for( k = 0 ; k < 2 ; k++ )
+    {
+        rbti_hash_drop( &rep->tree[k] );
+        free( rep->block[k] );
+    }
+    repl_release( rep->repl );
+    free( rep );
+}
+
+/***[end-of-file]****************************************************/
+/********************************************************************/
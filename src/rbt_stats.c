@@ -0,0 +1,62 @@
+/*********************************************************************
+* Red Black Tree functions (threaded)
+*
+* rbt_stats.c
+*
+**********************************************************************
+* functions:
+*
+*   int  rbt_stats      ( RBT * rbt, RBTSTATS * out )
+*   void rbt_stats_reset( RBT * rbt )
+*
+**********************************************************************
+* Operation statistics. The counters in RBT are only updated when the
+* library is build with -DRBT_STATS (make RBT_OPT=-DRBT_STATS), the
+* RBT struct is the same in both builds.
+* Counted: nodeCmp and keyCmp calls and nodes visited in insert, delete
+* and rbt_get, rotations and recolorings in the insert and delete
+* rebalancing, replaced duplicates, and deletes with no node found.
+* The counters are not atomic (rbt_get from more threads may lose
+* counts).
+**********************************************************************
+* Copyright (c) 2020 Michael Walsh Pedersen
+*********************************************************************/
+
+#include <string.h>
+#include "rbt.h"
+#include "rbt_internal.h"
+
+/*********************************************************************
+* int rbt_stats( RBT * rbt, RBTSTATS * out )
+* Copy the counters of rbt to out.
+* Return: RBT_RC_OK(0), RBT_RC_ERROR(-1) if not build with RBT_STATS
+* (out is then all zeroes).
+*********************************************************************/
+
+int rbt_stats(
+    RBT      * rbt,
+    RBTSTATS * out )
+{
+#ifdef RBT_STATS
+    *out = rbt->stats;
+    return RBT_RC_OK;
+#else
+    (void)rbt;
+    memset( out, 0, sizeof(*out) );
+    return RBT_RC_ERROR;
+#endif
+}
+
+/*********************************************************************
+* void rbt_stats_reset( RBT * rbt )
+* Set all counters of rbt to zero.
+*********************************************************************/
+
+void rbt_stats_reset(
+    RBT * rbt )
+{
+    memset( &rbt->stats, 0, sizeof(rbt->stats) );
+}
+
+/***[end-of-file]****************************************************/
+/********************************************************************/
@@ -4,11 +4,17 @@
 * rbt_tests.c
 *
 **********************************************************************
-* Validation tests.
+* Validation tests: rbttest_all etc. check the structure of a tree, and
+* rbttest_split_join etc. check the behavior of a feature on trees of
+* their own (0 if ok, else the failed step, < 0).
 **********************************************************************
 * Copyright (c) 2020 Michael Walsh Pedersen
 *********************************************************************/
 
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include "rbt.h"
 #include "rbt_internal.h"
 
@@ -84,7 +90,7 @@ int rbttest_first( RBT * rbt )
     for( sz = 0, r = rbt_first(rbt) ; r ; r = rbt_next(rbt,r) )
         sz++;
     //printf(" first:%s", rbt->size == sz ? "ok" : "ERROR" );
-    return sz-rbt->size;
+    return sz-rbt_size(rbt);
 }
 
 int rbttest_last( RBT * rbt )
@@ -94,7 +100,7 @@ int rbttest_last( RBT * rbt )
     for( sz=0, r = rbt_last(rbt) ; r ; r = rbt_prev(rbt,r) )
         sz++;
     //printf(" last:%s", rbt->size == sz ? "ok" : "ERROR" );
-    return sz != rbt->size ? -1 : 0 ;
+    return sz != rbt_size(rbt) ? -1 : 0 ;
 }
 
 int rbttest_ascending( RBT * rbt )
@@ -111,7 +117,7 @@ int rbttest_ascending( RBT * rbt )
     r2 = r1 ? rbt_next( rbt, r1 ) : NULL ;
     for( ; r2 !=NULL ; r1 = r2, r2 = rbt_next(rbt,r2) )
     {
-        rc = rbt->def->nodeCmp( r1, r2 );
+        rc = rbti_node_cmp( rbt->def, r1, r2 );
         if( rc < 0 )
             sz ++;
     }
@@ -119,7 +125,7 @@ int rbttest_ascending( RBT * rbt )
 
     //printf( "    size=%ld; ", rbt->size);
     //printf("\n");
-    return sz != rbt->size ? -1 : 0 ;
+    return sz != rbt_size(rbt) ? -1 : 0 ;
 }
 
 
@@ -138,5 +144,429 @@ int rbttest_all( RBT * rbt )
     return 0;
 }
 
+/*********************************************************************
+* behavior tests: trees of TNODE with keys 0 .. TEST_KEYS-1, compared
+* with a model, in[k] != 0 if key k is in the tree.
+*********************************************************************/
+
+#define TEST_KEYS  1000
+#define TEST_STEP  7919     /* prime: scrambles the order of the keys */
+
+typedef struct
+{
+    void * left;
+    void * right;
+    char   color;
+    int    key;
+} TNODE;
+
+static int tnode_cmp( void * n1, void * n2 )
+{
+    return ((TNODE*)n1)->key < ((TNODE*)n2)->key ? -1
+        : ((TNODE*)n1)->key > ((TNODE*)n2)->key;
+}
+
+static int tnode_keycmp( void * n, void * key )
+{
+    return ((TNODE*)n)->key < *(int*)key ? -1 : ((TNODE*)n)->key > *(int*)key;
+}
+
+static unsigned long long tnode_keyhash( void * key )
+{
+    return (unsigned long long)*(int*)key * 0x9E3779B97F4A7C15ULL;
+}
+
+static unsigned long long tnode_hash( void * n )
+{
+    return tnode_keyhash( &((TNODE*)n)->key );
+}
+
+static size_t tnode_serialize( void * n, void * buf, size_t size )
+{
+    if( size >= sizeof(int) )
+        memcpy( buf, &((TNODE*)n)->key, sizeof(int) );
+    return sizeof(int);
+}
+
+static void * tnode_deserialize( void * buf, size_t size )
+{
+    TNODE * n;
+
+    if( size != sizeof(int) || ( n = (TNODE*)calloc( 1, sizeof(TNODE) ) )
+        == NULL )
+        return NULL;
+    memcpy( &n->key, buf, sizeof(int) );
+    return n;
+}
+
+static void tnode_nop( void * n, void * ctx )
+{
+    (void)n;
+    (void)ctx;
+}
+
+static RBTDEF tnode_def = {
+    offsetof(TNODE,left), offsetof(TNODE,right), offsetof(TNODE,color),
+    tnode_cmp, tnode_keycmp, malloc, free, free, sizeof(TNODE), 0,
+    NULL, NULL, 0, 0 };
+
+static TNODE * tnode_new( RBT * mapped, int key )
+{
+    TNODE * n;
+
+    n = mapped ? (TNODE*)rbt_mapped_alloc( mapped, sizeof(TNODE) )
+        : (TNODE*)malloc( sizeof(TNODE) );
+    if( n )
+    {
+        memset( n, 0, sizeof(TNODE) );
+        n->key = key;
+    }
+    return n;
+}
+
+/* the keys of rbt are those of the model, by rbt_get and by rbt_next,
+   and the tree is valid: */
+static int test_keys( RBT * rbt, const char * in )
+{
+    TNODE * n;
+    int     k, last, cnt;
+
+    if( rbttest_all( rbt ) != 0 )
+        return -1;
+    cnt = 0;
+    last = -1;
+    for( n = (TNODE*)rbt_first( rbt ) ; n ; n = (TNODE*)rbt_next( rbt, n ) )
+    {
+        if( n->key <= last || n->key >= TEST_KEYS || !in[n->key] )
+            return -1;
+        last = n->key;
+        cnt++;
+    }
+    for( k = 0 ; k < TEST_KEYS ; k++ )
+    {
+        n = (TNODE*)rbt_get( rbt, &k );
+        if( in[k] ? n == NULL || n->key != k : n != NULL )
+            return -1;
+        if( in[k] )
+            cnt--;
+    }
+    return cnt == 0 ? 0 : -1;
+}
+
+/* insert the keys from .. to-1 (scrambled), and delete every third of
+   them if del: */
+static int test_fill( RBT * rbt, RBT * mapped, char * in, int from, int to,
+    int del )
+{
+    TNODE * n;
+    int     i, k;
+
+    for( i = 0 ; i < to - from ; i++ )
+    {
+        k = from + (int)( (long)i * TEST_STEP % ( to - from ) );
+        if( ( n = tnode_new( mapped, k ) ) == NULL
+            || rbt_insert( rbt, n ) != RBT_RC_OK )
+            return -1;
+        in[k] = 1;
+    }
+    for( k = from ; k < to && del ; k += 3 )
+    {
+        if( rbt_delkey( rbt, &k ) != RBT_RC_OK )
+            return -1;
+        in[k] = 0;
+    }
+    return 0;
+}
+
+/*********************************************************************
+* int rbttest_split_join( void )
+* rbt_split at keys in and out of the tree, and rbt_join with and
+* without a pivot.
+*********************************************************************/
+
+int rbttest_split_join( void )
+{
+    RBT   * rbt, * left, * right;
+    TNODE * pivot;
+    char    in[TEST_KEYS], lin[TEST_KEYS];
+    int     k, rc;
+
+    rbt = rbt_new( &tnode_def );
+    left = rbt_new( &tnode_def );
+    right = rbt_new( &tnode_def );
+    memset( in, 0, sizeof(in) );
+    rc = 0;
+    if( rc == 0 && test_fill( rbt, NULL, in, 0, TEST_KEYS, 1 ) )
+        rc = -1;
+    k = TEST_KEYS / 3; /* deleted: not in the tree */
+    if( rc == 0 && ( rbt_split( rbt, &k, left, right ) != RBT_RC_OK
+        || rbt->root != NULL ) )
+        rc = -2;
+    memcpy( lin, in, sizeof(in) );
+    memset( lin + k, 0, TEST_KEYS - k );
+    if( rc == 0 && test_keys( left, lin ) )
+        rc = -3;
+    memset( lin, 0, k );
+    memcpy( lin + k, in + k, TEST_KEYS - k );
+    if( rc == 0 && test_keys( right, lin ) )
+        rc = -4;
+    k++; /* in the tree: the first node of right */
+    if( rc == 0 && ( ( pivot = (TNODE*)rbt_pop_first( right ) ) == NULL
+        || pivot->key != k
+        || rbt_join( left, pivot, right ) != RBT_RC_OK
+        || right->root != NULL || test_keys( left, in ) ) )
+        rc = -5;
+    if( rc == 0 && ( rbt_split( left, &k, left, right ) != RBT_RC_OK
+        || rbt_join( left, NULL, right ) != RBT_RC_OK
+        || test_keys( left, in ) ) )
+        rc = -6;
+    rbt_free( rbt );
+    rbt_free( left );
+    rbt_free( right );
+    return rc;
+}
+
+/*********************************************************************
+* int rbttest_journal( const char * path )
+* A journal (in file path) replayed into an empty tree gives the keys of
+* the tree, also across rbt_clr; the changes that are not journaled are
+* refused while the journal is open (else the replay would diverge).
+*********************************************************************/
+
+int rbttest_journal( const char * path )
+{
+    RBT   * rbt, * copy, * other;
+    char    in[TEST_KEYS];
+    int     fd, k, rc;
+
+    fd = open( path, O_RDWR | O_CREAT | O_TRUNC, 0644 );
+    if( fd < 0 )
+        return -1;
+    rbt = rbt_new( &tnode_def );
+    copy = rbt_new( &tnode_def );
+    other = rbt_new( &tnode_def );
+    memset( in, 0, sizeof(in) );
+    rc = 0;
+    if( rbt_journal_open( rbt, fd, tnode_serialize, 16, 0 ) != RBT_RC_OK
+        || test_fill( rbt, NULL, in, 0, TEST_KEYS / 2, 0 ) )
+        rc = -2;
+    if( rc == 0 && ( rbt_clr( rbt ), memset( in, 0, sizeof(in) ),
+        test_fill( rbt, NULL, in, 0, TEST_KEYS, 1 ) ) )
+        rc = -3;
+    k = TEST_KEYS / 2;
+    if( rc == 0 && ( rbt_split( rbt, &k, other, copy ) != RBT_RC_ERROR
+        || rbt_join( rbt, NULL, other ) != RBT_RC_ERROR
+        || rbt_union( rbt, other, 1 ) != RBT_RC_ERROR
+        || rbt_load( rbt, fd, tnode_deserialize ) != RBT_RC_ERROR ) )
+        rc = -4;
+    if( rc == 0 && ( rbt_journal_close( rbt ) != RBT_RC_OK
+        || lseek( fd, 0, SEEK_SET ) != 0
+        || rbt_journal_replay( copy, fd, tnode_deserialize ) != RBT_RC_OK
+        || test_keys( copy, in ) || test_keys( rbt, in ) ) )
+        rc = -5;
+    close( fd );
+    unlink( path );
+    rbt_free( rbt );
+    rbt_free( copy );
+    rbt_free( other );
+    return rc;
+}
+
+/*********************************************************************
+* int rbttest_hash( void )
+* rbt_get by the hash index, kept by inserts and deletes, dropped by
+* split and join, and rebuilt.
+*********************************************************************/
+
+int rbttest_hash( void )
+{
+    RBTDEF  def;
+    RBT   * rbt, * right;
+    char    in[TEST_KEYS];
+    int     k, rc;
+
+    def = tnode_def;
+    def.keyHash = tnode_keyhash;
+    def.nodeHash = tnode_hash;
+    rbt = rbt_new( &def );
+    right = rbt_new( &def );
+    memset( in, 0, sizeof(in) );
+    rc = 0;
+    if( test_fill( rbt, NULL, in, 0, TEST_KEYS, 1 ) || rbt->hash == NULL
+        || test_keys( rbt, in ) )
+        rc = -1;
+    k = TEST_KEYS / 2;
+    if( rc == 0 && ( rbt_split( rbt, &k, rbt, right ) != RBT_RC_OK
+        || rbt_join( rbt, NULL, right ) != RBT_RC_OK
+        || test_keys( rbt, in ) ) )
+        rc = -2;
+    if( rc == 0 && ( rbt_hash_build( rbt ) != RBT_RC_OK || rbt->hash == NULL
+        || test_fill( rbt, NULL, in, TEST_KEYS / 2, TEST_KEYS, 1 )
+        || test_keys( rbt, in ) ) )
+        rc = -3;
+    if( rc == 0 && ( rbt_clr( rbt ), memset( in, 0, sizeof(in) ),
+        test_keys( rbt, in ) ) )
+        rc = -4;
+    rbt_free( rbt );
+    rbt_free( right );
+    return rc;
+}
+
+/*********************************************************************
+* int rbttest_buffer( void )
+* A write buffer (rbt_buffer) read as one with the tree, with inserts
+* and deletes of buffered and merged keys, before and after merges.
+*********************************************************************/
+
+int rbttest_buffer( void )
+{
+    RBT   * rbt;
+    TNODE * n;
+    char    in[TEST_KEYS];
+    int     i, k, rc;
+
+    rbt = rbt_new( &tnode_def );
+    memset( in, 0, sizeof(in) );
+    rc = 0;
+    if( test_fill( rbt, NULL, in, 0, TEST_KEYS / 2, 1 )
+        || rbt_buffer( rbt, 64 ) != RBT_RC_OK )
+        rc = -1;
+    for( i = 0 ; i < 4 * TEST_KEYS && rc == 0 ; i++ )
+    {
+        k = (int)( (long)i * TEST_STEP % TEST_KEYS );
+        if( i % 3 == 2 )
+        {
+            if( rbt_delkey( rbt, &k ) != ( in[k] ? RBT_RC_OK
+                : RBT_RC_NOTFOUND ) )
+                rc = -2;
+            in[k] = 0;
+        }
+        else if( ( n = tnode_new( NULL, k ) ) == NULL
+            || rbt_insert( rbt, n ) != RBT_RC_OK )
+            rc = -3;
+        else
+            in[k] = 1;
+        if( rc == 0 && i % 500 == 0 && test_keys( rbt, in ) )
+            rc = -4;
+    }
+    if( rc == 0 && test_keys( rbt, in ) )
+        rc = -5;
+    if( rc == 0 && ( rbt_buffer( rbt, 0 ) != RBT_RC_OK
+        || rbt->delta != NULL || test_keys( rbt, in ) ) )
+        rc = -6;
+    rbt_free( rbt );
+    return rc;
+}
+
+/*********************************************************************
+* int rbttest_concurrent( void )
+* Concurrent mode in one thread: the calls not for the mode fail, and
+* a replaced node stays readable, rbt_next from it finds its neighbour.
+* (See test/rbt_test.c for many threads.)
+*********************************************************************/
+
+int rbttest_concurrent( void )
+{
+    RBTCAPACITY cap;
+    RBT   * rbt, * other;
+    TNODE * n, * old;
+    char    in[TEST_KEYS];
+    int     k, rc;
+
+    rbt = rbt_new( &tnode_def );
+    other = rbt_new( &tnode_def );
+    memset( in, 0, sizeof(in) );
+    memset( &cap, 0, sizeof(cap) );
+    cap.max_nodes = 1;
+    rc = 0;
+    if( test_fill( rbt, NULL, in, 0, TEST_KEYS, 1 )
+        || rbt_concurrent( rbt, 1 ) != RBT_RC_OK || test_keys( rbt, in ) )
+        rc = -1;
+    k = TEST_KEYS / 2;
+    if( rc == 0 && ( rbt_buffer( rbt, 64 ) != RBT_RC_ERROR
+        || rbt_capacity( rbt, &cap ) != RBT_RC_ERROR
+        || rbt_split( rbt, &k, rbt, other ) != RBT_RC_ERROR
+        || rbt_join( rbt, NULL, other ) != RBT_RC_ERROR
+        || rbt_union( rbt, other, 1 ) != RBT_RC_ERROR
+        || rbt_parallel_for( rbt, 1, tnode_nop, NULL ) != RBT_RC_ERROR
+        || rbt_journal_open( rbt, -1, tnode_serialize, 1, 0 )
+            != RBT_RC_ERROR ) )
+        rc = -2;
+    k = 1; /* replaced by an equal node, then deleted with its next */
+    old = (TNODE*)rbt_get( rbt, &k );
+    if( rc == 0 && ( old == NULL || ( n = tnode_new( NULL, k ) ) == NULL
+        || rbt_insert( rbt, n ) != RBT_RC_OK || rbt_get( rbt, &k ) != n
+        || ( n = (TNODE*)rbt_next( rbt, old ) ) == NULL || n->key != 2 ) )
+        rc = -3;
+    for( k = 1 ; k <= 2 && rc == 0 ; k++ )
+    {
+        if( rbt_delkey( rbt, &k ) != RBT_RC_OK )
+            rc = -4;
+        in[k] = 0;
+    }
+    if( rc == 0 && ( old->key != 1
+        || ( n = (TNODE*)rbt_next( rbt, old ) ) == NULL || n->key != 4
+        || test_keys( rbt, in ) ) )
+        rc = -5;
+    rbt_quiescent( rbt );
+    if( rc == 0 && ( rbt_concurrent( rbt, 0 ) != RBT_RC_OK
+        || test_keys( rbt, in ) ) )
+        rc = -6;
+    rbt_free( rbt );
+    rbt_free( other );
+    return rc;
+}
+
+/*********************************************************************
+* int rbttest_mapped( const char * path )
+* A memory mapped tree (in file path) has its nodes and size after it
+* is closed and opened again.
+*********************************************************************/
+
+int rbttest_mapped( const char * path )
+{
+    RBTDEF  def;
+    RBT   * rbt;
+    char    in[TEST_KEYS];
+    int     rc;
+
+    def = tnode_def;
+    def.allocRoot = NULL;
+    def.freeRoot = NULL;
+    def.freeNode = rbt_mapped_free;
+    memset( in, 0, sizeof(in) );
+    unlink( path );
+    rc = 0;
+    rbt = rbt_open_mapped( path, &def, (size_t)1 << 24 );
+    if( rbt == NULL )
+        return -1;
+    if( test_fill( rbt, rbt, in, 0, TEST_KEYS / 2, 1 )
+        || test_keys( rbt, in ) )
+        rc = -2;
+    if( rbt_close_mapped( rbt ) != RBT_RC_OK && rc == 0 )
+        rc = -3;
+    if( rc == 0 && ( rbt = rbt_open_mapped( path, &def, 0 ) ) == NULL )
+        rc = -4;
+    if( rc == 0 )
+    {
+        if( test_keys( rbt, in )
+            || test_fill( rbt, rbt, in, TEST_KEYS / 2, TEST_KEYS, 1 ) )
+            rc = -5;
+        if( rbt_close_mapped( rbt ) != RBT_RC_OK && rc == 0 )
+            rc = -6;
+    }
+    if( rc == 0 && ( rbt = rbt_open_mapped( path, &def, 0 ) ) == NULL )
+        rc = -7;
+    if( rc == 0 )
+    {
+        if( test_keys( rbt, in ) )
+            rc = -8;
+        if( rbt_close_mapped( rbt ) != RBT_RC_OK && rc == 0 )
+            rc = -9;
+    }
+    unlink( path );
+    return rc;
+}
+
 /***[end-of-file]****************************************************/
 /********************************************************************/
@@ -0,0 +1,337 @@
+/*********************************************************************
+* Red Black Tree functions (threaded)
+*
+* rbt_union.c
+*
+**********************************************************************
+* functions:
+*
+*   int rbt_union    ( RBT * rbt, RBT * rbt2, int nthreads )
+*   int rbt_intersect( RBT * rbt, RBT * rbt2, int nthreads )
+*   int rbt_difference( RBT * rbt, RBT * rbt2, int nthreads )
+*
+**********************************************************************
+* Set operations on two trees with the same RBTDEF. The result is left
+* in rbt, and rbt2 is left empty. Nodes not in the result are freed by
+* freeNode (in any thread, when nthreads > 1).
+*
+* Divide and conquer, based on join and split (see rbt_join.c): the
+* root of rbt2 splits rbt, and the two halves are done recursively
+* (in parallel, when build with -DRBT_PTHREAD and nthreads > 1).
+* Work is O(m log(n/m + 1)), m <= n being the sizes of the trees.
+*
+* Sub results may have wrong thread pointers at their ends, they are
+* fixed by each join (rbti_join_fix) and at the end.
+* Not for multiset trees (RBT_MULTISET), nor while a tree has a journal
+* (the moved and freed nodes are not journaled, see rbt_journal.c) or
+* is in concurrent mode.
+**********************************************************************
+* Copyright (c) 2020 Michael Walsh Pedersen
+*********************************************************************/
+
+#include "rbt.h"
+#include "rbt_internal.h"
+
+#ifdef RBT_PTHREAD
+#include <pthread.h>
+#endif
+
+#define left_of(n)   (is_left_data(n)  ? child_left(n)  : NULL)
+#define right_of(n)  (is_right_data(n) ? child_right(n) : NULL)
+
+/* set operations: */
+#define SETOP_UNION       0
+#define SETOP_INTERSECT   1
+#define SETOP_DIFFERENCE  2
+
+/*********************************************************************
+*
+*********************************************************************/
+
+typedef struct {
+    RBTDEF   * def;
+    int        setop;
+    int        par_depth;  /* run in parallel above this depth */
+} VAR;
+
+typedef struct {
+    VAR      * var;
+    void     * t1;
+    int        bh1;
+    void     * t2;
+    int        bh2;
+    int        depth;
+    void     * res;        /* result */
+    int        bh;         /* result black height */
+    size_t     cnt;        /* duplicates (union) or matches */
+} TASK;
+
+static void run_task( TASK * task );
+
+/*********************************************************************
+* static void free_tree(...)
+* Free all nodes in subtree t.
+*********************************************************************/
+
+static void free_tree(
+    RBTDEF * def,
+    void   * t)
+{
+    if( t )
+    {
+        if( is_left_data(t) )
+            free_tree( def, child_left(t) );
+        if( is_right_data(t) )
+            free_tree( def, child_right(t) );
+        def->freeNode( t );
+    }
+}
+
+#ifdef RBT_PTHREAD
+/*********************************************************************
+* static void * task_thread(...)
+*********************************************************************/
+
+static void * task_thread(
+    void * arg)
+{
+    run_task( (TASK*)arg );
+    return NULL;
+}
+#endif
+
+/*********************************************************************
+* static void run_pair(...)
+* Run two tasks, in parallel if above par_depth.
+*********************************************************************/
+
+static void run_pair(
+    VAR    * var,
+    TASK   * a,
+    TASK   * b)
+{
+#ifdef RBT_PTHREAD
+    pthread_t th;
+
+    if( a->depth < var->par_depth
+        && pthread_create( &th, NULL, task_thread, a ) == 0 )
+    {
+        run_task( b );
+        pthread_join( th, NULL );
+        return;
+    }
+#else
+    (void)var;
+#endif
+    run_task( a );
+    run_task( b );
+}
+
+/*********************************************************************
+* static void * set_op(...)
+* Return: result root (may be red), black height in *bh, count of
+* duplicates (union) or matches (intersect, difference) in *cnt.
+*********************************************************************/
+
+static void * set_op(
+    VAR    * var,
+    void   * t1,
+    int      bh1,
+    void   * t2,
+    int      bh2,
+    int      depth,
+    int    * bh,
+    size_t * cnt)
+{
+    RBTDEF * def;
+    void   * k;
+    void   * e;
+    TASK     a, b;
+
+    def = var->def;
+    *cnt = 0;
+    if( t1 == NULL || t2 == NULL )
+    {
+        switch( var->setop )
+        {
+        case SETOP_UNION:
+            *bh = t1 ? bh1 : bh2;
+            return t1 ? t1 : t2;
+        case SETOP_INTERSECT:
+            free_tree( def, t1 ? t1 : t2 );
+            *bh = 0;
+            return NULL;
+        default: /* SETOP_DIFFERENCE */
+            free_tree( def, t2 );
+            *bh = bh1;
+            return t1;
+        }
+    }
+
+    /* split t1 by the root of t2 */
+    k = t2;
+    bh2 -= is_black(k) ? 1 : 0;
+    a.var = b.var = var;
+    a.depth = b.depth = depth + 1;
+    rbti_split( def, t1, bh1, def->nodeCmp, k, 0,
+        &a.t1, &a.bh1, &b.t1, &b.bh1, &e );
+    a.t2 = left_of(k);
+    a.bh2 = bh2;
+    b.t2 = right_of(k);
+    b.bh2 = bh2;
+
+    run_pair( var, &a, &b );
+
+    *cnt = a.cnt + b.cnt;
+    if( e )
+        (*cnt)++;
+    switch( var->setop )
+    {
+    case SETOP_UNION: /* the node from t2 replaces the node from t1 */
+        if( e )
+            def->freeNode( e );
+        return rbti_join_fix( def, a.res, a.bh, k, b.res, b.bh, bh );
+    case SETOP_INTERSECT: /* the node from t1 is kept */
+        def->freeNode( k );
+        if( e )
+            return rbti_join_fix( def, a.res, a.bh, e, b.res, b.bh, bh );
+        return rbti_join2( def, a.res, a.bh, b.res, b.bh, bh );
+    default: /* SETOP_DIFFERENCE */
+        def->freeNode( k );
+        if( e )
+            def->freeNode( e );
+        return rbti_join2( def, a.res, a.bh, b.res, b.bh, bh );
+    }
+}
+
+/*********************************************************************
+* static void run_task(...)
+*********************************************************************/
+
+static void run_task(
+    TASK * task)
+{
+    task->res = set_op( task->var, task->t1, task->bh1,
+        task->t2, task->bh2, task->depth, &task->bh, &task->cnt );
+}
+
+/*********************************************************************
+* static int set_tree(...)
+* Return: RBT_RC_OK(0), RBT_RC_ERROR(-1)
+*********************************************************************/
+
+static int set_tree(
+    RBT    * rbt,
+    RBT    * rbt2,
+    int      setop,
+    int      nthreads)
+{
+    RBTDEF * def;
+    VAR      Var;
+    void   * root;
+    int      bh;
+    size_t   cnt;
+
+    def = rbt->def;
+    if( rbt == rbt2 || rbt->def != rbt2->def || is_multiset(def)
+        || rbt->journal || rbt2->journal || rbt->conc || rbt2->conc )
+        return RBT_RC_ERROR;
+    delta_merge(rbt);
+    delta_merge(rbt2);
+    relax_fix(rbt);
+    relax_fix(rbt2);
+    if( rbt->tombs )
+        rbt_purge( rbt, 0 );
+    if( rbt2->tombs )
+        rbt_purge( rbt2, 0 );
+    size_count(rbt);
+    size_count(rbt2);
+
+    Var.def = def;
+    Var.setop = setop;
+    for( Var.par_depth = 0 ; nthreads > 1 ; nthreads = (nthreads+1)/2 )
+        Var.par_depth++;
+
+    root = set_op( &Var,
+        rbt->root, rbti_black_height( def, rbt->root ),
+        rbt2->root, rbti_black_height( def, rbt2->root ),
+        0, &bh, &cnt );
+    if( root )
+    {
+        child_left(rbti_min( def, root )) = NULL;  /* thread ptr */
+        child_right(rbti_max( def, root )) = NULL; /* thread ptr */
+        set_black(root);
+    }
+    switch( setop )
+    {
+    case SETOP_UNION:
+        rbt->size += rbt2->size - cnt;
+        break;
+    case SETOP_INTERSECT:
+        rbt->size = cnt;
+        break;
+    default: /* SETOP_DIFFERENCE */
+        rbt->size -= cnt;
+        break;
+    }
+    rbti_hash_drop( rbt );
+    rbti_hash_drop( rbt2 );
+    cap_drop(rbt);
+    rbt2->bytes = 0;
+    rbt->del_gen++;
+    rbt2->del_gen++;
+    rbt->root = root;
+    rbt2->root = NULL;
+    rbt2->size = 0;
+    rbti_minmax( rbt );
+    rbti_minmax( rbt2 );
+    return RBT_RC_OK;
+}
+
+/*********************************************************************
+* int rbt_union( RBT * rbt, RBT * rbt2, int nthreads )
+* Move all nodes from rbt2 into rbt. Nodes in rbt with a key also in
+* rbt2 are replaced and freed (as rbt_insert).
+* Return: RBT_RC_OK(0), RBT_RC_ERROR(-1)
+*********************************************************************/
+
+int rbt_union(
+    RBT   * rbt,
+    RBT   * rbt2,
+    int     nthreads )
+{
+    return set_tree( rbt, rbt2, SETOP_UNION, nthreads );
+}
+
+/*********************************************************************
+* int rbt_intersect( RBT * rbt, RBT * rbt2, int nthreads )
+* Keep only nodes in rbt with a key also in rbt2. All other nodes
+* (and all nodes in rbt2) are freed.
+* Return: RBT_RC_OK(0), RBT_RC_ERROR(-1)
+*********************************************************************/
+
+int rbt_intersect(
+    RBT   * rbt,
+    RBT   * rbt2,
+    int     nthreads )
+{
+    return set_tree( rbt, rbt2, SETOP_INTERSECT, nthreads );
+}
+
+/*********************************************************************
+* int rbt_difference( RBT * rbt, RBT * rbt2, int nthreads )
+* Delete nodes in rbt with a key also in rbt2. The deleted nodes (and
+* all nodes in rbt2) are freed.
+* Return: RBT_RC_OK(0), RBT_RC_ERROR(-1)
+*********************************************************************/
+
+int rbt_difference(
+    RBT   * rbt,
+    RBT   * rbt2,
+    int     nthreads )
+{
+    return set_tree( rbt, rbt2, SETOP_DIFFERENCE, nthreads );
+}
+
+/***[end-of-file]****************************************************/
+/********************************************************************/
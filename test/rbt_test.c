@@ -0,0 +1,277 @@
+/*********************************************************************
+* rbt_test.c
+*
+* To compile and run (or: make test, in ../src):
+*
+gcc -Wall -Wextra -pedantic-errors -O2 -I../src -o rbt_test \
+rbt_test.c ../src/librbt.a -lpthread && ./rbt_test
+*
+* The behavior tests of the features (rbttest_split_join etc. in
+* rbt_tests.c), then a stress test of the concurrent mode: writer
+* threads insert, upsert and delete random keys while reader threads
+* get, iterate and range find them, and check what they read; at the
+* end the tree is checked by rbttest_all. Run it with the library and
+* the test build with -fsanitize=thread to find data races, eg.
+* make clean test RBT_OPT=-fsanitize=thread
+*
+* Usage: rbt_test [-t threads] [-n ops]
+*
+*   -t : threads, half writers and half readers (default: 8)
+*   -n : operations per writer thread (default: 200000)
+*
+* Exit code: 0 if all tests passed, else 1.
+*
+**********************************************************************
+* Copyright (c) 2020 Michael Walsh Pedersen
+*********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "rbt.h"
+
+#define TEST_FILE    "rbt_test.tmp"  /* scratch file of the tests */
+#define MAX_THREADS  64
+#define STRESS_KEYS  4096            /* small: the threads meet */
+
+typedef struct
+{
+    void * left;
+    void * right;
+    char   color;
+    int    key;
+    int    check;                    /* ~key: a freed node is seen */
+} SNODE;
+
+static int snode_cmp( void * n1, void * n2 )
+{
+    return ((SNODE*)n1)->key < ((SNODE*)n2)->key ? -1
+        : ((SNODE*)n1)->key > ((SNODE*)n2)->key;
+}
+
+static int snode_keycmp( void * n, void * key )
+{
+    return ((SNODE*)n)->key < *(int*)key ? -1 : ((SNODE*)n)->key > *(int*)key;
+}
+
+static void * snode_create( void * key, void * ctx )
+{
+    SNODE * n;
+
+    (void)ctx;
+    n = (SNODE*)calloc( 1, sizeof(SNODE) );
+    if( n )
+    {
+        n->key = *(int*)key;
+        n->check = ~n->key;
+    }
+    return n;
+}
+
+static void snode_free( void * n )
+{
+    ((SNODE*)n)->check = 0; /* a reader that still has it fails */
+    free( n );
+}
+
+static RBTDEF snode_def = {
+    offsetof(SNODE,left), offsetof(SNODE,right), offsetof(SNODE,color),
+    snode_cmp, snode_keycmp, malloc, free, snode_free, sizeof(SNODE), 0,
+    NULL, NULL, 0, 0 };
+
+static RBT    * tree;
+static long     ops = 200000;
+static int      stop;                /* the writers are done */
+static int      failed;
+
+static unsigned next_rand( unsigned * seed )
+{
+    *seed = *seed * 1103515245u + 12345u;
+    return *seed >> 8;
+}
+
+static void fail( const char * what, int key )
+{
+    fprintf( stderr, "stress: %s (key %d)\n", what, key );
+    __atomic_store_n( &failed, 1, __ATOMIC_RELAXED );
+}
+
+static int bad( SNODE * n )
+{
+    return n->check != ~n->key || n->key < 0 || n->key >= STRESS_KEYS;
+}
+
+/*********************************************************************
+* static void * writer(...)
+*********************************************************************/
+
+static void * writer(
+    void   * arg)
+{
+    SNODE  * n;
+    unsigned seed;
+    long     i;
+    int      key;
+
+    seed = (unsigned)(size_t)arg;
+    for( i = 0 ; i < ops && !__atomic_load_n( &failed, __ATOMIC_RELAXED ) ;
+         i++ )
+    {
+        key = (int)( next_rand( &seed ) % STRESS_KEYS );
+        switch( next_rand( &seed ) % 4 )
+        {
+        case 0:
+            if( ( n = (SNODE*)snode_create( &key, NULL ) ) == NULL
+                || rbt_insert( tree, n ) != RBT_RC_OK )
+                fail( "insert", key );
+            break;
+        case 1:
+            n = (SNODE*)rbt_upsert( tree, &key, snode_create, NULL, NULL );
+            if( n == NULL || n->key != key || bad( n ) )
+                fail( "upsert", key );
+            break;
+        default:
+            if( rbt_delkey( tree, &key ) == RBT_RC_ERROR )
+                fail( "delkey", key );
+            break;
+        }
+        if( i % 64 == 0 )
+            rbt_quiescent( tree );
+    }
+    rbt_concurrent_leave( tree );
+    return NULL;
+}
+
+/*********************************************************************
+* static void * reader(...)
+*********************************************************************/
+
+static void * reader(
+    void   * arg)
+{
+    SNODE  * n, * prev;
+    unsigned seed;
+    int      key, i;
+
+    seed = (unsigned)(size_t)arg;
+    while( !__atomic_load_n( &stop, __ATOMIC_RELAXED )
+        && !__atomic_load_n( &failed, __ATOMIC_RELAXED ) )
+    {
+        key = (int)( next_rand( &seed ) % STRESS_KEYS );
+        n = (SNODE*)rbt_get( tree, &key );
+        if( n && ( n->key != key || bad( n ) ) )
+            fail( "rbt_get", key );
+        n = (SNODE*)rbt_fgt( tree, snode_keycmp, &key );
+        if( n && ( n->key <= key || bad( n ) ) )
+            fail( "rbt_fgt", key );
+        n = (SNODE*)rbt_leq( tree, snode_keycmp, &key );
+        if( n && ( n->key != key || bad( n ) ) )
+            fail( "rbt_leq", key );
+        prev = NULL;
+        n = (SNODE*)rbt_fge( tree, snode_keycmp, &key );
+        for( i = 0 ; n && i < 32 ; i++ )
+        {
+            if( n->key < key || bad( n ) || ( prev && prev->key >= n->key ) )
+                fail( "rbt_next", key );
+            prev = n;
+            n = (SNODE*)rbt_next( tree, n );
+        }
+        prev = NULL;
+        n = (SNODE*)rbt_last( tree );
+        for( i = 0 ; n && i < 8 ; i++ )
+        {
+            if( bad( n ) || ( prev && prev->key <= n->key ) )
+                fail( "rbt_prev", key );
+            prev = n;
+            n = (SNODE*)rbt_prev( tree, n );
+        }
+        rbt_quiescent( tree );
+    }
+    rbt_concurrent_leave( tree );
+    return NULL;
+}
+
+/*********************************************************************
+* static int stress(...)
+* Return: 0 if ok, else 1.
+*********************************************************************/
+
+static int stress(
+    int      nthreads,
+    int      lazy)
+{
+    pthread_t th[MAX_THREADS];
+    int       i, n, nw, key, rc;
+
+    tree = rbt_new( &snode_def );
+    for( key = 0 ; key < STRESS_KEYS ; key += 2 )
+        rbt_insert( tree, snode_create( &key, NULL ) );
+    rbt_lazy_delete( tree, lazy, 0 );
+    if( rbt_concurrent( tree, 1 ) != RBT_RC_OK )
+        return 1;
+    stop = failed = 0;
+    nw = nthreads > 1 ? nthreads / 2 : 1;
+    for( n = 0 ; n < nthreads ; n++ )
+        if( pthread_create( &th[n], NULL, n < nw ? writer : reader,
+                (void*)(size_t)( n * 7919 + 1 ) ) != 0 )
+            break;
+    for( i = 0 ; i < n ; i++ )
+    {
+        if( i == nw ) /* the writers are done */
+            __atomic_store_n( &stop, 1, __ATOMIC_RELAXED );
+        pthread_join( th[i], NULL );
+    }
+    rc = failed || n < nthreads;
+    if( rbt_concurrent( tree, 0 ) != RBT_RC_OK || rbttest_all( tree ) != 0 )
+        rc = 1;
+    printf( "stress %s: %d threads, %zu nodes: %s\n",
+        lazy ? "lazy delete" : "delete", nthreads, rbt_size( tree ),
+        rc ? "FAILED" : "ok" );
+    rbt_free( tree );
+    return rc;
+}
+
+/*********************************************************************
+* main
+*********************************************************************/
+
+static int report( const char * name, int rc )
+{
+    printf( "%-14s %s", name, rc ? "FAILED" : "ok" );
+    if( rc )
+        printf( " (step %d)", rc );
+    printf( "\n" );
+    return rc != 0;
+}
+
+int main(
+    int      argc,
+    char  ** argv)
+{
+    int nthreads, rc, i;
+
+    nthreads = 8;
+    for( i = 1 ; i + 1 < argc ; i += 2 )
+    {
+        if( strcmp( argv[i], "-t" ) == 0 )
+            nthreads = atoi( argv[i+1] );
+        else if( strcmp( argv[i], "-n" ) == 0 )
+            ops = atol( argv[i+1] );
+    }
+    if( nthreads < 1 || nthreads > MAX_THREADS || ops < 1 )
+    {
+        fprintf( stderr, "usage: rbt_test [-t threads] [-n ops]\n" );
+        return 1;
+    }
+    rc = 0;
+    rc |= report( "split, join", rbttest_split_join() );
+    rc |= report( "journal", rbttest_journal( TEST_FILE ) );
+    rc |= report( "hash index", rbttest_hash() );
+    rc |= report( "write buffer", rbttest_buffer() );
+    rc |= report( "concurrent", rbttest_concurrent() );
+    rc |= report( "mapped", rbttest_mapped( TEST_FILE ) );
+    rc |= stress( nthreads, 0 );
+    rc |= stress( nthreads, 1 );
+    return rc;
+}